@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2010-2013, A. Hornung, University of Freiburg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Freiburg nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OCTOMAP_SERVER_BOUNDEDQUEUE_H
+#define OCTOMAP_SERVER_BOUNDEDQUEUE_H
+
+#include <deque>
+#include <algorithm>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace octomap_server {
+
+/**
+ * Queue between two stages of the OctomapServer pipeline. It holds at most
+ * a fixed number of items, what happens to more is decided by its policy.
+ */
+template <class T>
+class BoundedQueue {
+public:
+  enum Policy {
+    DROP_OLDEST, ///< discard the oldest queued item
+    DROP_NEWEST, ///< discard the pushed item
+    MERGE        ///< merge the pushed item into the newest queued one, if that fails discard the oldest
+  };
+
+  /// merges item into queued, returns false if they cannot be merged
+  typedef boost::function<bool (T& queued, const T& item)> MergeFunction;
+
+  BoundedQueue(size_t capacity, Policy policy = DROP_OLDEST, const MergeFunction& merge = MergeFunction())
+  : m_capacity(std::max(capacity, size_t(1))), m_policy(policy), m_merge(merge), m_shutdown(false)
+  {}
+
+  /// queue an item, returns false if one was discarded or merged because the queue is full
+  bool push(const T& item) {
+    boost::mutex::scoped_lock lock(m_mutex);
+    bool full = (m_items.size() >= m_capacity);
+    if (full){
+      if (m_policy == DROP_NEWEST)
+        return false;
+      if (m_policy == MERGE && m_merge && m_merge(m_items.back(), item))
+        return false;
+      m_items.pop_front();
+    }
+    m_items.push_back(item);
+    lock.unlock();
+    m_nonEmpty.notify_one();
+    return !full;
+  }
+
+  /// wait for the oldest item, returns false once the queue is shut down
+  bool pop(T& item) {
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_items.empty() && !m_shutdown)
+      m_nonEmpty.wait(lock);
+    if (m_shutdown)
+      return false;
+    item = m_items.front();
+    m_items.pop_front();
+    return true;
+  }
+
+  /// wake up and stop all consumers
+  void shutdown() {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_shutdown = true;
+    m_items.clear();
+    lock.unlock();
+    m_nonEmpty.notify_all();
+  }
+
+private:
+  std::deque<T> m_items;
+  size_t m_capacity;
+  Policy m_policy;
+  MergeFunction m_merge;
+  bool m_shutdown;
+  boost::mutex m_mutex;
+  boost::condition_variable m_nonEmpty;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2012, D. Kuhner, P. Ruchti, University of Freiburg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Freiburg nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef OCTOMAP_SERVER_CHANGEENCODING_H
+#define OCTOMAP_SERVER_CHANGEENCODING_H
+
+#include <stdint.h>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+
+namespace octomap_server {
+
+/// Morton code of a key (z, y, x bits interleaved from the most significant), the order of KeyTreeOrder
+uint64_t mortonCode(const octomap::OcTreeKey& key);
+octomap::OcTreeKey mortonKey(uint64_t code);
+
+/**
+* @brief Append keys to runs in the format of OctomapChanges::runs
+* @param keys sorted by KeyTreeOrder and unique
+* @param runs
+*/
+void encodeKeyRuns(const std::vector<octomap::OcTreeKey>& keys, std::vector<uint8_t>& runs);
+
+/**
+* @brief Append the keys of runs in the format of OctomapChanges::runs
+* @param runs
+* @param keys
+* @param maxKeys decoding stops after this many keys
+* @return false if runs is truncated, invalid or has more than maxKeys keys,
+* keys then holds the complete runs before the error
+*/
+bool decodeKeyRuns(const std::vector<uint8_t>& runs, std::vector<octomap::OcTreeKey>& keys, size_t maxKeys);
+
+}
+
+#endif
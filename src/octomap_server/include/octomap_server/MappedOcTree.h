@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2010-2013, A. Hornung, University of Freiburg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Freiburg nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OCTOMAP_SERVER_MAPPEDOCTREE_H
+#define OCTOMAP_SERVER_MAPPEDOCTREE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <octomap/octomap.h>
+#include <octomap_msgs/Octomap.h>
+
+namespace octomap_server {
+
+/**
+ * Read-only octree in a memory-mapped .mt file, for serving large maps without loading them.
+ *
+ * The file holds the binary (maximum likelihood) and full stream of a tree, as they are sent
+ * in octomap_msgs/Octomap, and an index of the subtrees down to a tile depth. As the binary
+ * stream is written depth first, each subtree is a contiguous range in it, so a query only
+ * reads the pages of the tile it falls into. All numbers are stored in host byte order.
+ */
+class MappedOcTree {
+public:
+  MappedOcTree();
+  ~MappedOcTree();
+
+  /// write tree to filename, indexing the subtrees down to tileDepth
+  static bool write(const octomap::AbstractOccupancyOcTree& tree, const std::string& filename, unsigned tileDepth = 10);
+
+  /// map an .mt file, only its header and index are read
+  bool open(const std::string& filename);
+  void close();
+  bool isOpen() const { return m_data != NULL; }
+
+  std::string getTreeType() const;
+  double getResolution() const;
+  /// number of indexed subtrees at the tile depth
+  size_t numTiles() const;
+
+  /// fill msg like octomap_msgs::binaryMapToMsg, directly from the mapping
+  bool binaryMapToMsg(octomap_msgs::Octomap& msg) const;
+  /// fill msg like octomap_msgs::fullMapToMsg, directly from the mapping
+  bool fullMapToMsg(octomap_msgs::Octomap& msg) const;
+
+  /**
+  * @brief Maximum likelihood occupancy at a point
+  * @param point
+  * @param occupied set if the point is known
+  * @return false if the point is unknown or outside of the map
+  */
+  bool search(const octomap::point3d& point, bool& occupied) const;
+
+  struct Header {
+    char magic[8];
+    char id[32]; // tree type
+    double resolution;
+    uint32_t tileDepth;
+    uint32_t numEntries;
+    uint64_t indexOffset;
+    uint64_t binaryOffset;
+    uint64_t binarySize;
+    uint64_t fullOffset;
+    uint64_t fullSize;
+  };
+
+  /// an inner node of the binary stream, by depth and its smallest key
+  struct Entry {
+    uint16_t key[3];
+    uint16_t depth;
+    uint64_t offset; // in the binary stream
+    uint64_t size;
+  };
+
+private:
+  // owns the mapping
+  MappedOcTree(const MappedOcTree&);
+  MappedOcTree& operator=(const MappedOcTree&);
+
+  const Entry* findEntry(unsigned depth, const octomap::OcTreeKey& key) const;
+
+  const Header* m_header;
+  const Entry* m_entries;
+  const char* m_binary;
+  const char* m_data;
+  size_t m_size;
+};
+
+}
+
+#endif
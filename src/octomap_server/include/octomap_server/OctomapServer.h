@@ -65,6 +65,19 @@
 #include <octomap_ros/conversions.h>
 #include <octomap/octomap.h>
 #include <octomap/OcTreeKey.h>
+#include <octomap_server/BoundedQueue.h>
+
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/unordered_map.hpp>
 
 //#define COLOR_OCTOMAP_SERVER // turned off here, turned on identical ColorOctomapServer.h - easier maintenance, only maintain OctomapServer and then copy and paste to ColorOctomapServer and change define. There are prettier ways to do this, but this works for now
 
@@ -73,6 +86,28 @@
 #endif
 
 namespace octomap_server {
+/**
+ * Orders keys along the octree's Z-order curve (the same child order as
+ * OcTree::computeChildIdx), so consecutive updates share most of their
+ * path from the root. The keys inside any octree node form a contiguous
+ * range starting at the node's lower corner.
+ */
+struct KeyTreeOrder {
+  bool operator()(const octomap::OcTreeKey& a, const octomap::OcTreeKey& b) const {
+    // find the axis whose keys differ in the most significant bit
+    unsigned axis = 2;
+    octomap::key_type axisDiff = a[2] ^ b[2];
+    for (int i = 1; i >= 0; --i){
+      octomap::key_type diff = a[i] ^ b[i];
+      if (axisDiff < diff && axisDiff < (axisDiff ^ diff)){
+        axis = i;
+        axisDiff = diff;
+      }
+    }
+    return a[axis] < b[axis];
+  }
+};
+
 class OctomapServer {
 
 public:
@@ -98,7 +133,13 @@ public:
   virtual void insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud);
   virtual bool openFile(const std::string& filename);
 
+  /// start the pipeline threads (if ~pipeline is set), call once the server is fully constructed and openFile() is done
+  void startPipeline();
+
 protected:
+  /// stop and join the pipeline threads, every derived destructor calls this first
+  void stopPipeline();
+
   inline static void updateMinKey(const octomap::OcTreeKey& in, octomap::OcTreeKey& min) {
     for (unsigned i = 0; i < 3; ++i)
       min[i] = std::min(in[i], min[i]);
@@ -120,6 +161,9 @@ protected:
             && key[1] <= m_updateBBXMax[1]);
   }
 
+  /// the column counts include speckles, so the 2D map is projected from the tree while they are filtered
+  inline bool useProjectionCache() const { return m_projectionCache && !m_filterSpeckles; }
+
   void reconfigureCallback(octomap_server::OctomapServerConfig& config, uint32_t level);
   void publishBinaryOctoMap(const ros::Time& rostime = ros::Time::now()) const;
   void publishFullOctoMap(const ros::Time& rostime = ros::Time::now()) const;
@@ -135,15 +179,154 @@ protected:
   */
   virtual void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
 
+  /// per-thread ray casting results of insertScan(), kept to reuse their storage
+  struct InsertWorker {
+    octomap::KeyRay keyRay;
+    std::vector<octomap::OcTreeKey> freeKeys;     // sorted and unique when done
+    std::vector<octomap::OcTreeKey> occupiedKeys; // sorted and unique when done
+    octomap::OcTreeKey bbxMin;
+    octomap::OcTreeKey bbxMax;
+  };
+
+  /**
+  * @brief cast the rays of scan points [begin, end) into the worker's key buffers.
+  * Points are indexed over ground followed by nonground. Does not modify the octree,
+  * so several workers can run concurrently.
+  */
+  void castRays(InsertWorker& worker, const octomap::point3d& sensorOrigin,
+                const PCLPointCloud& ground, const PCLPointCloud& nonground,
+                size_t begin, size_t end) const;
+
+  /// pass the tree's changed keys on to incremental publishing and the projection cache, then reset them
+  void collectChanges();
+
+  /// a cube in the persistent marker state of incremental publishing
+  struct PublishedCell {
+    unsigned depth;
+    bool occupied;
+    size_t slot; // index into the marker points of its depth, or -1 if not drawn (filtered)
+  };
+  /// published cubes keyed by their lower corner; they never overlap
+  typedef std::map<octomap::OcTreeKey, PublishedCell, KeyTreeOrder> PublishedCellMap;
+
+  /// bring the persistent marker state up to date with the changed keys (rebuilds it if invalidated)
+  void updatePublishedCells();
+
+  /// replace the published cubes at key with the current leaves of the tree
+  void refreshPublishedCells(const octomap::OcTreeKey& key);
+
+  /// add the leaf at a (leaf or leaf_bbx) iterator to the marker state
+  template <class IteratorT>
+  void addPublishedCell(const IteratorT& it);
+
+  void removePublishedCell(PublishedCellMap::iterator cell);
+
+  /// set the header, size and colors of persistent markers before publishing them
+  void finishMarkers(visualization_msgs::MarkerArray& vis, const std_msgs::ColorRGBA& color,
+                     bool heightMap, const ros::Time& rostime) const;
+
+  /**
+  * @brief transform the cloud in place, in one pass without copies
+  *
+  * @param transform applied to all points
+  * @param crop keep only points inside the pointcloud_{min,max}_{x,y,z} box (after transforming)
+  * @param voxels if not NULL, keep only the first point in each octree voxel (keys are stored here)
+  */
+  void prefilterCloud(PCLPointCloud& pc, const Eigen::Matrix4f& transform, bool crop, octomap::KeySet* voxels);
+
+  /// a preprocessed cloud waiting for insertion
+  struct PendingScan {
+    tf::Point sensorOrigin;
+    tf::Point baseOrigin; // center of the local map
+    PCLPointCloud ground;
+    PCLPointCloud nonground;
+    ros::Time stamp;
+  };
+  typedef boost::shared_ptr<PendingScan> PendingScanPtr;
+
+  /// look up the transforms of a cloud and filterCloud() it for insertion, false if it cannot be used
+  bool preprocessCloud(const sensor_msgs::PointCloud2::ConstPtr& cloud, PendingScan& scan);
+
+  /**
+  * @brief transform, filter and segment pc into scan.ground and scan.nonground (origins and
+  * stamp are left to the caller). Call with a read lock on m_filterMutex.
+  *
+  * @param sensorToBase, baseToWorld only used if the ground plane is filtered
+  */
+  void filterCloud(PCLPointCloud& pc, const Eigen::Matrix4f& sensorToWorld,
+                   const Eigen::Matrix4f& sensorToBase, const Eigen::Matrix4f& baseToWorld,
+                   PendingScan& scan);
+
+  /// pipeline stages, each running in its own thread
+  void preprocessThread();
+  void insertThread();
+  void publishThread();
+
+  /// merge policy of the scan queue: add scan to queued if taken from about the same origin
+  bool mergeScans(PendingScanPtr& queued, const PendingScanPtr& scan) const;
+
+  /// publishAll() while only reading the octree (map services can run at the same time)
+  void publishReadLocked(const ros::Time& rostime);
+
+  /**
+  * @brief Move the local map cube to center: tiles outside of it are evicted (and stored
+  * if local_map/tile_directory is set), stored tiles inside are loaded again.
+  */
+  void updateLocalMap(const tf::Point& center);
+
+  /// true if the tile at tileKey (nodes with 2^tileLevel voxels per edge) is inside the local map
+  bool inLocalMap(const octomap::OcTreeKey& tileKey, unsigned tileLevel) const;
+
+  /// file of a stored tile
+  std::string tilePath(const octomap::OcTreeKey& tileKey) const;
+
+  /// insert a stored tile where the octree has no newer data, false if it could not be read
+  bool loadTile(const octomap::OcTreeKey& tileKey, unsigned tileDepth);
+
+  /// remember the cube of depth at corner, changed without change detection, for a subclass (if m_accumulateChanges)
+  void accumulateCube(const octomap::OcTreeKey& corner, unsigned depth);
+
+  /// write the subtree of the cube of depth at corner (a childless node if the cube is part of a larger leaf), nothing if it is unknown
+  void writeCube(std::ostream& out, const octomap::OcTreeKey& corner, unsigned depth) const;
+
+  /**
+  * @brief Replace the cube of depth at corner by a subtree written by writeCube(), delete it if in is empty.
+  * Not change tracked, call finishReplacedCubes() after the last one.
+  * @return false if the subtree could not be read
+  */
+  bool replaceCube(std::istream& in, const octomap::OcTreeKey& corner, unsigned depth);
+
+  /// update the tree's bookkeeping and invalidate the caches after replaceCube() or deleteNode()
+  void finishReplacedCubes();
+
   /// label the input cloud "pc" into ground and nonground. Should be in the robot's fixed frame (not world!)
-  void filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const;
+  virtual void filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const;
+
+  /// empty cloud with the layout of a PCLPointCloud, with room for capacity points
+  void initPointCloud(sensor_msgs::PointCloud2& cloud, size_t capacity) const;
+
+  /// write point into the data of cloud, which grows if needed
+  static void appendPoint(sensor_msgs::PointCloud2& cloud, const PCLPoint& point);
+
+  /// trim cloud to its points and set its header
+  void finishPointCloud(sensor_msgs::PointCloud2& cloud, const ros::Time& rostime) const;
+
+  /// linear time alternative to the RANSAC ground plane: lowest points and their slope in a 2D grid
+  void filterGroundGrid(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const;
 
   /**
   * @brief Find speckle nodes (single occupied voxels with no neighbors). Only works on lowest resolution!
+  * Uses the classification of classifySpeckles(), voxels near changes are searched in the tree.
   * @param key
-  * @return
+  * @return true if none of the 26 neighbors is occupied
   */
-  bool isSpeckleNode(const octomap::OcTreeKey& key) const;
+  bool isSpeckleNode(const octomap::OcTreeKey& key);
+
+  /// classify all occupied voxels at the lowest resolution in one pass over the leaves
+  void classifySpeckles();
+
+  /// drop the speckle classification of a changed voxel and its neighbors
+  void invalidateSpeckles(const octomap::OcTreeKey& changedKey);
 
   /// hook that is called before traversing all nodes
   virtual void handlePreNodeTraversal(const ros::Time& rostime);
@@ -172,6 +355,32 @@ protected:
   /// updates the downprojected 2D map as either occupied or free
   virtual void update2DMap(const OcTreeT::iterator& it, bool occupied);
 
+  /// voxels in the occupancy height range of one column of the 2D map (at full resolution)
+  struct ColumnCounts {
+    unsigned occupied;
+    unsigned free;
+    bool dirty; // changed since last projected
+    ColumnCounts() : occupied(0), free(0), dirty(false) {}
+  };
+  /// columns by x and y key, see columnKey()
+  typedef boost::unordered_map<uint32_t, ColumnCounts> ColumnMap;
+
+  /// true for occupied voxels without occupied neighbors
+  typedef boost::unordered_map<octomap::OcTreeKey, bool, octomap::OcTreeKey::KeyHash> SpeckleMap;
+
+  inline static uint32_t columnKey(const octomap::OcTreeKey& key) {
+    return (uint32_t(key[0]) << 16) | key[1];
+  }
+
+  /// recount all columns from the leaves of the tree
+  void rebuildColumns();
+
+  /// count a voxel state change in its column (-1: unknown, 0: free, 1: occupied)
+  void updateColumn(const octomap::OcTreeKey& key, int before, int after);
+
+  /// write the changed columns into m_gridmap, or all of them when its layout changed
+  void projectColumns(const nav_msgs::MapMetaData& oldMapInfo);
+
   inline unsigned mapIdx(int i, int j) const {
     return m_gridmap.info.width * j + i;
   }
@@ -208,7 +417,7 @@ protected:
   dynamic_reconfigure::Server<OctomapServerConfig> m_reconfigureServer;
 
   OcTreeT* m_octree;
-  octomap::KeyRay m_keyRay;  // temp storage for ray casting
+  std::vector<InsertWorker> m_insertWorkers; // one per ray casting thread
   octomap::OcTreeKey m_updateBBXMin;
   octomap::OcTreeKey m_updateBBXMax;
 
@@ -243,6 +452,8 @@ protected:
   double m_groundFilterDistance;
   double m_groundFilterAngle;
   double m_groundFilterPlaneDistance;
+  bool m_groundFilterGrid;
+  double m_groundFilterCellSize;
 
   bool m_compressMap;
 
@@ -257,6 +468,63 @@ protected:
   unsigned m_multires2DScale;
   bool m_projectCompleteMap;
   bool m_useColoredMap;
+
+  // incremental publishing from the octree's changed keys:
+  bool m_incrementalPublish;
+  bool m_accumulateChanges; // also collect the changed keys for a subclass
+  octomap::KeyBoolMap m_accumulatedChanges; // like the tree's change set, reset by that subclass
+  std::vector<std::pair<octomap::OcTreeKey, unsigned> > m_accumulatedCubes; // corner and depth of cubes replaced as a whole
+  bool m_publishedCellsValid; // false to rebuild the state on the next publish
+  std::vector<octomap::OcTreeKey> m_changedKeys;
+  PublishedCellMap m_publishedCells;
+  visualization_msgs::MarkerArray m_occupiedCellsVis;
+  visualization_msgs::MarkerArray m_freeCellsVis;
+  std::vector<std::vector<octomap::OcTreeKey> > m_occupiedSlotKeys; // cell of each marker point
+  std::vector<std::vector<octomap::OcTreeKey> > m_freeSlotKeys;
+
+  // 2D projection from per-column voxel counts, kept up to date from the changed keys:
+  bool m_projectionCache;
+  bool m_columnsValid; // false to recount on the next projection
+  bool m_columnsProjected; // false to write all columns on the next projection
+  ColumnMap m_columns;
+  std::vector<uint32_t> m_dirtyColumns;
+
+  // speckle classification of the occupied voxels, cleared around the changed keys:
+  bool m_specklesValid; // false to classify all voxels on the next publish
+  SpeckleMap m_speckles;
+
+  bool m_voxelFilter;
+  octomap::KeySet m_voxelKeys; // voxels of the cloud being filtered
+
+  // write lock for changing the octree, read lock for publishing it and map services:
+  boost::shared_mutex m_octreeMutex;
+  boost::mutex m_publishMutex; // publishAll() state under a read lock
+
+  // pipelined insertion:
+  bool m_pipeline;
+  double m_mergeDistance;
+  bool m_updatePublished; // the update BBX was published, start a new one
+  BoundedQueue<sensor_msgs::PointCloud2::ConstPtr>* m_cloudQueue;
+  BoundedQueue<PendingScanPtr>* m_scanQueue;
+  BoundedQueue<ros::Time>* m_publishQueue;
+  boost::thread_group m_pipelineThreads;
+  bool m_pipelineRunning;
+  // filter parameters of preprocessCloud() that reconfigure changes, read lock while preprocessing:
+  boost::shared_mutex m_filterMutex;
+
+  // sliding local map, only the tiles inside a cube around the base frame are kept:
+  double m_localMapSize; // edge length of the cube, 0 keeps the whole map
+  double m_tileSize;
+  std::string m_tileDirectory; // evicted tiles are written here if not empty
+  bool m_localMapValid; // false to check all tiles on the next update
+  octomap::OcTreeKey m_localMapMin; // tile range covered by the cube
+  octomap::OcTreeKey m_localMapMax;
+  octomap::KeySet m_storedTiles;
+
+  // output sizes of the last complete publish, to preallocate the next one:
+  std::vector<size_t> m_occupiedMarkerCounts;
+  std::vector<size_t> m_freeMarkerCounts;
+  size_t m_cloudCount;
 };
 }
 
@@ -54,6 +54,12 @@ protected:
   /// updates the downprojected 2D map as either occupied or free
   virtual void update2DMap(const OcTreeT::iterator& it, bool occupied);
 
+  /// update a cell of the 2D map and mark it in the given layers (one bit per map of m_multiGridmap)
+  void updateCell(unsigned idx, bool occupied, uint32_t layers);
+
+  /// set the arm layer interval from the arm links, their heights are cached until tf has newer ones
+  void updateArmLayer();
+
   /// hook that is called after traversing all nodes
   virtual void handlePostNodeTraversal(const ros::Time& rostime);
 
@@ -62,9 +68,18 @@ protected:
 
   std::vector<std::string> m_armLinks;
   std::vector<double> m_armLinkOffsets;
+  std::vector<double> m_armLinkHeights;
+  std::vector<ros::Time> m_armLinkStamps;
+  std::vector<bool> m_armLinkKnown;
 
   MultilevelGrid m_multiGridmap;
 
+  // per cell of the 2D maps, the layers that occupied and free nodes were projected into
+  // during the current traversal, applied to all maps after it:
+  std::vector<uint32_t> m_occupiedLayers;
+  std::vector<uint32_t> m_freeLayers;
+  std::vector<unsigned> m_touchedCells;
+
 
 };
 }
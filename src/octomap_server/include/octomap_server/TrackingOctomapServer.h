@@ -31,6 +31,7 @@
 #define OCTOMAP_SERVER_TRACKINGOCTOMAPSERVER_H_
 
 #include "octomap_server/OctomapServer.h"
+#include "octomap_server/OctomapChanges.h"
 
 namespace octomap_server {
 
@@ -40,13 +41,17 @@ public:
   virtual ~TrackingOctomapServer();
 
   void trackCallback(sensor_msgs::PointCloud2Ptr cloud);
+  void trackCompactCallback(const octomap_server::OctomapChangesConstPtr& changes);
   void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
 
 protected:
   void trackChanges();
+  /// encode the accumulated changes as OctomapChanges, returns their number
+  size_t encodeChanges(octomap_server::OctomapChanges& changes) const;
 
   bool listen_changes;
   bool track_changes;
+  bool compact_changes; // OctomapChanges instead of PointCloud2
   int min_change_pub;
   std::string change_id_frame;
   ros::Publisher pubFreeChangeSet;
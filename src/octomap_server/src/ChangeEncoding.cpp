@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2012, D. Kuhner, P. Ruchti, University of Freiburg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Freiburg nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <octomap_server/ChangeEncoding.h>
+
+using namespace octomap;
+
+namespace {
+
+void writeVarint(uint64_t value, std::vector<uint8_t>& data){
+  while (value >= 0x80){
+    data.push_back(uint8_t(value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  data.push_back(uint8_t(value));
+}
+
+/// read a varint at pos, false if data ends before it
+bool readVarint(const std::vector<uint8_t>& data, size_t& pos, uint64_t& value){
+  value = 0;
+  for (unsigned shift = 0; pos < data.size() && shift < 64; shift += 7){
+    uint8_t byte = data[pos++];
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+}
+
+namespace octomap_server {
+
+uint64_t mortonCode(const OcTreeKey& key){
+  uint64_t code = 0;
+  for (int level = 15; level >= 0; --level)
+    code = (code << 3) | (((key[2] >> level) & 1) << 2) | (((key[1] >> level) & 1) << 1) | ((key[0] >> level) & 1);
+  return code;
+}
+
+OcTreeKey mortonKey(uint64_t code){
+  OcTreeKey key(0, 0, 0);
+  for (unsigned level = 0; level < 16; ++level){
+    key[0] |= ((code >> (3 * level)) & 1) << level;
+    key[1] |= ((code >> (3 * level + 1)) & 1) << level;
+    key[2] |= ((code >> (3 * level + 2)) & 1) << level;
+  }
+  return key;
+}
+
+void encodeKeyRuns(const std::vector<OcTreeKey>& keys, std::vector<uint8_t>& runs){
+  // runs of consecutive Morton codes, a run ends before the first gap:
+  uint64_t next = 0;
+  size_t runStart = 0;
+  for (size_t i = 0; i < keys.size(); ++i){
+    uint64_t code = mortonCode(keys[i]);
+    if (i + 1 == keys.size() || mortonCode(keys[i + 1]) != code + 1){
+      uint64_t first = code - (i - runStart);
+      writeVarint(first - next, runs);
+      writeVarint(i - runStart, runs);
+      next = code + 1;
+      runStart = i + 1;
+    }
+  }
+}
+
+bool decodeKeyRuns(const std::vector<uint8_t>& runs, std::vector<OcTreeKey>& keys, size_t maxKeys){
+  // codes have 48 bits, anything beyond is not a valid change set:
+  const uint64_t END = uint64_t(1) << 48;
+  size_t pos = 0;
+  size_t n = 0;
+  uint64_t next = 0;
+  uint64_t delta, length;
+  while (pos < runs.size()){
+    if (!readVarint(runs, pos, delta) || !readVarint(runs, pos, length))
+      return false;
+    // n <= maxKeys, the run has length + 1 keys:
+    if (delta >= END - next || length >= END - next - delta || length >= maxKeys - n)
+      return false;
+    uint64_t code = next + delta;
+    for (uint64_t i = 0; i <= length; ++i)
+      keys.push_back(mortonKey(code + i));
+    n += length + 1;
+    next = code + length + 1;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2010-2013, A. Hornung, University of Freiburg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Freiburg nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <octomap_server/MappedOcTree.h>
+#include <ros/ros.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace octomap;
+
+namespace {
+
+const char MAGIC[8] = {'O', 'C', 'T', 'M', 'A', 'P', 'M', 'T'};
+const unsigned TREE_DEPTH = 16;
+const size_t INVALID = size_t(-1);
+
+// child codes of the binary stream, two bits per child:
+const unsigned UNKNOWN = 0;
+const unsigned FREE = 1;
+const unsigned OCCUPIED = 2;
+const unsigned INNER = 3;
+
+/// code of child i in the binary node at node
+inline unsigned childCode(const char* node, unsigned i){
+  return (static_cast<unsigned char>(node[i / 4]) >> ((i % 4) * 2)) & 3;
+}
+
+/// index of the child containing key below a node at the given level (bit of the key)
+inline unsigned childIndex(const OcTreeKey& key, unsigned level){
+  unsigned pos = 0;
+  if (key[0] & (1 << level)) pos |= 1;
+  if (key[1] & (1 << level)) pos |= 2;
+  if (key[2] & (1 << level)) pos |= 4;
+  return pos;
+}
+
+/// smallest key of child i of the node at depth with smallest key
+inline OcTreeKey childKey(const OcTreeKey& key, unsigned depth, unsigned i){
+  unsigned level = TREE_DEPTH - 1 - depth;
+  OcTreeKey child = key;
+  for (unsigned j = 0; j < 3; ++j){
+    if (i & (1 << j))
+      child[j] |= (1 << level);
+  }
+  return child;
+}
+
+/// end of the node at offset in the binary stream, INVALID if it is truncated
+size_t skipNode(const char* binary, size_t size, size_t offset){
+  if (offset + 2 > size)
+    return INVALID;
+
+  size_t end = offset + 2;
+  for (unsigned i = 0; i < 8 && end != INVALID; ++i){
+    if (childCode(binary + offset, i) == INNER)
+      end = skipNode(binary, size, end);
+  }
+  return end;
+}
+
+/// skipNode() that also records the nodes down to tileDepth
+size_t indexNode(const std::string& binary, size_t offset, unsigned depth, const OcTreeKey& key,
+                 unsigned tileDepth, std::vector<octomap_server::MappedOcTree::Entry>& entries){
+  if (offset + 2 > binary.size())
+    return INVALID;
+
+  size_t entry = entries.size();
+  if (depth <= tileDepth){
+    octomap_server::MappedOcTree::Entry e;
+    for (unsigned j = 0; j < 3; ++j)
+      e.key[j] = key[j];
+    e.depth = depth;
+    e.offset = offset;
+    e.size = 0;
+    entries.push_back(e);
+  }
+
+  size_t end = offset + 2;
+  for (unsigned i = 0; i < 8 && end != INVALID; ++i){
+    if (childCode(binary.data() + offset, i) != INNER)
+      continue;
+    if (depth < tileDepth)
+      end = indexNode(binary, end, depth + 1, childKey(key, depth, i), tileDepth, entries);
+    else
+      end = skipNode(binary.data(), binary.size(), end);
+  }
+
+  if (depth <= tileDepth && end != INVALID)
+    entries[entry].size = end - offset;
+  return end;
+}
+
+/// order of the index: by depth, then by key
+struct EntryOrder {
+  bool operator()(const octomap_server::MappedOcTree::Entry& a, const octomap_server::MappedOcTree::Entry& b) const {
+    if (a.depth != b.depth)
+      return a.depth < b.depth;
+    for (unsigned j = 0; j < 3; ++j){
+      if (a.key[j] != b.key[j])
+        return a.key[j] < b.key[j];
+    }
+    return false;
+  }
+};
+
+}
+
+namespace octomap_server{
+
+MappedOcTree::MappedOcTree()
+: m_header(NULL), m_entries(NULL), m_binary(NULL), m_data(NULL), m_size(0)
+{
+}
+
+MappedOcTree::~MappedOcTree(){
+  close();
+}
+
+bool MappedOcTree::write(const AbstractOccupancyOcTree& tree, const std::string& filename, unsigned tileDepth){
+  std::stringstream binaryStream, fullStream;
+  tree.writeBinaryData(binaryStream);
+  tree.writeData(fullStream);
+  std::string binary = binaryStream.str();
+  std::string full = fullStream.str();
+
+  tileDepth = std::min(tileDepth, TREE_DEPTH - 1);
+  std::vector<Entry> entries;
+  if (!binary.empty() && indexNode(binary, 0, 0, OcTreeKey(0, 0, 0), tileDepth, entries) != binary.size()){
+    ROS_ERROR("Could not index the binary stream of the octree");
+    return false;
+  }
+  std::sort(entries.begin(), entries.end(), EntryOrder());
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  strncpy(header.id, tree.getTreeType().c_str(), sizeof(header.id) - 1);
+  header.resolution = tree.getResolution();
+  header.tileDepth = tileDepth;
+  header.numEntries = entries.size();
+  header.indexOffset = sizeof(Header);
+  header.binaryOffset = header.indexOffset + entries.size() * sizeof(Entry);
+  header.binarySize = binary.size();
+  header.fullOffset = header.binaryOffset + binary.size();
+  header.fullSize = full.size();
+
+  std::ofstream file(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!entries.empty())
+    file.write(reinterpret_cast<const char*>(&entries[0]), entries.size() * sizeof(Entry));
+  file.write(binary.data(), binary.size());
+  file.write(full.data(), full.size());
+  if (!file){
+    ROS_ERROR("Could not write mapped octree to %s", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool MappedOcTree::open(const std::string& filename){
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0){
+    ROS_ERROR("Could not open mapped octree %s", filename.c_str());
+    return false;
+  }
+
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header))
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping stays valid without the descriptor
+  ::close(fd);
+  if (data == MAP_FAILED){
+    ROS_ERROR("Could not map octree file %s", filename.c_str());
+    return false;
+  }
+
+  m_data = static_cast<const char*>(data);
+  m_size = st.st_size;
+  m_header = reinterpret_cast<const Header*>(m_data);
+
+  if (memcmp(m_header->magic, MAGIC, sizeof(MAGIC)) != 0
+      || m_header->indexOffset + uint64_t(m_header->numEntries) * sizeof(Entry) > m_size
+      || m_header->binaryOffset + m_header->binarySize > m_size
+      || m_header->fullOffset + m_header->fullSize > m_size)
+  {
+    ROS_ERROR("%s is not a valid mapped octree file", filename.c_str());
+    close();
+    return false;
+  }
+
+  m_entries = reinterpret_cast<const Entry*>(m_data + m_header->indexOffset);
+  m_binary = m_data + m_header->binaryOffset;
+  return true;
+}
+
+void MappedOcTree::close(){
+  if (m_data)
+    munmap(const_cast<char*>(m_data), m_size);
+
+  m_header = NULL;
+  m_entries = NULL;
+  m_binary = NULL;
+  m_data = NULL;
+  m_size = 0;
+}
+
+std::string MappedOcTree::getTreeType() const{
+  return std::string(m_header->id, strnlen(m_header->id, sizeof(m_header->id)));
+}
+
+double MappedOcTree::getResolution() const{
+  return m_header->resolution;
+}
+
+size_t MappedOcTree::numTiles() const{
+  Entry first;
+  memset(&first, 0, sizeof(first));
+  first.depth = m_header->tileDepth;
+  return m_entries + m_header->numEntries - std::lower_bound(m_entries, m_entries + m_header->numEntries, first, EntryOrder());
+}
+
+bool MappedOcTree::binaryMapToMsg(octomap_msgs::Octomap& msg) const{
+  if (!m_data)
+    return false;
+
+  msg.id = getTreeType();
+  msg.resolution = getResolution();
+  msg.binary = true;
+  msg.data.assign(m_binary, m_binary + m_header->binarySize);
+  return true;
+}
+
+bool MappedOcTree::fullMapToMsg(octomap_msgs::Octomap& msg) const{
+  if (!m_data)
+    return false;
+
+  const char* full = m_data + m_header->fullOffset;
+  msg.id = getTreeType();
+  msg.resolution = getResolution();
+  msg.binary = false;
+  msg.data.assign(full, full + m_header->fullSize);
+  return true;
+}
+
+bool MappedOcTree::search(const point3d& point, bool& occupied) const{
+  if (!m_data || m_header->binarySize == 0)
+    return false;
+
+  // same keys as OcTree::coordToKeyChecked, which multiplies by the inverse resolution:
+  double resolutionFactor = 1.0 / m_header->resolution;
+  OcTreeKey key;
+  for (unsigned i = 0; i < 3; ++i){
+    int k = ((int) floor(resolutionFactor * point(i))) + (1 << (TREE_DEPTH - 1));
+    if (k < 0 || k >= (1 << TREE_DEPTH))
+      return false;
+    key[i] = k;
+  }
+
+  OcTreeKey nodeKey(0, 0, 0);
+  size_t offset = 0;
+  for (unsigned depth = 0; depth < TREE_DEPTH; ++depth){
+    if (offset + 2 > m_header->binarySize)
+      return false;
+
+    unsigned pos = childIndex(key, TREE_DEPTH - 1 - depth);
+    unsigned code = childCode(m_binary + offset, pos);
+    if (code != INNER){
+      occupied = (code == OCCUPIED);
+      return code != UNKNOWN;
+    }
+
+    // indexed nodes are looked up, below the tile depth the inner children before pos are skipped:
+    nodeKey = childKey(nodeKey, depth, pos);
+    if (depth + 1 <= m_header->tileDepth){
+      const Entry* entry = findEntry(depth + 1, nodeKey);
+      if (!entry)
+        return false;
+      offset = entry->offset;
+    } else{
+      size_t child = offset + 2;
+      for (unsigned i = 0; i < pos && child != INVALID; ++i){
+        if (childCode(m_binary + offset, i) == INNER)
+          child = skipNode(m_binary, m_header->binarySize, child);
+      }
+      if (child == INVALID)
+        return false;
+      offset = child;
+    }
+  }
+
+  // leaves at the lowest level are stored in their parent's code
+  return false;
+}
+
+const MappedOcTree::Entry* MappedOcTree::findEntry(unsigned depth, const OcTreeKey& key) const{
+  Entry wanted;
+  for (unsigned j = 0; j < 3; ++j)
+    wanted.key[j] = key[j];
+  wanted.depth = depth;
+
+  const Entry* end = m_entries + m_header->numEntries;
+  const Entry* entry = std::lower_bound(m_entries, end, wanted, EntryOrder());
+  if (entry == end || EntryOrder()(wanted, *entry))
+    return NULL;
+  return entry;
+}
+
+}
@@ -37,6 +37,101 @@ bool is_equal (double a, double b, double epsilon = 1.0e-7)
     return std::abs(a - b) < epsilon;
 }
 
+namespace {
+
+/// fewest scan points worth an extra ray casting thread
+const size_t MIN_POINTS_PER_THREAD = 1000;
+
+/// free keys a worker buffers before first removing duplicates
+const size_t MIN_COMPACT_KEYS = 1 << 16;
+
+/// value of PublishedCell::slot for cubes that are tracked but not drawn
+const size_t NOT_DRAWN = size_t(-1);
+
+/// test if the cube at corner, 2^level keys wide, contains key
+inline bool cubeContains(const OcTreeKey& corner, unsigned level, const OcTreeKey& key){
+  for (unsigned i = 0; i < 3; ++i){
+    if ((corner[i] ^ key[i]) >> level)
+      return false;
+  }
+  return true;
+}
+
+void sortUnique(std::vector<OcTreeKey>& keys){
+  std::sort(keys.begin(), keys.end(), KeyTreeOrder());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+/// merge two sorted and unique key lists into keys
+void mergeUnique(std::vector<OcTreeKey>& keys, const std::vector<OcTreeKey>& other){
+  size_t middle = keys.size();
+  keys.insert(keys.end(), other.begin(), other.end());
+  std::inplace_merge(keys.begin(), keys.begin() + middle, keys.end(), KeyTreeOrder());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+/// index of the child containing key below a node at the given level (bit of the key)
+unsigned childIndex(const OcTreeKey& key, unsigned level){
+  unsigned pos = 0;
+  if (key[0] & (1 << level)) pos |= 1;
+  if (key[1] & (1 << level)) pos |= 2;
+  if (key[2] & (1 << level)) pos |= 4;
+  return pos;
+}
+
+/**
+ * Nodes created directly (not through the tree) are missing from the tree's node count,
+ * and its metric bounds are not recomputed. Recount them and mark the bounds as changed.
+ */
+template <class TREE>
+struct TreeBookkeeping : public TREE {
+  static void refresh(TREE& tree){
+    tree.*(&TreeBookkeeping::tree_size) = tree.calcNumNodes();
+    tree.*(&TreeBookkeeping::size_changed) = true;
+  }
+
+  /// the root of tree, created if the tree is empty
+  static typename TREE::NodeType* ensureRoot(TREE& tree, bool& created){
+    typename TREE::NodeType*& root = tree.*(&TreeBookkeeping::root);
+    created = !root;
+    if (created)
+      root = new typename TREE::NodeType();
+    return root;
+  }
+};
+
+/// copy the subtree of src into the childless node dst
+template <class NODE>
+void copyTile(NODE* dst, const NODE* src){
+  dst->setLogOdds(src->getLogOdds());
+  for (unsigned i = 0; i < 8; ++i){
+    if (src->childExists(i)){
+      dst->createChild(i);
+      copyTile(dst->getChild(i), src->getChild(i));
+    }
+  }
+}
+
+/// copy the parts of the subtree of src that are unknown in dst
+template <class NODE>
+void mergeTile(NODE* dst, const NODE* src){
+  if (!dst->hasChildren())
+    return;
+
+  for (unsigned i = 0; i < 8; ++i){
+    if (!src->childExists(i))
+      continue;
+    if (dst->childExists(i))
+      mergeTile(dst->getChild(i), src->getChild(i));
+    else{
+      dst->createChild(i);
+      copyTile(dst->getChild(i), src->getChild(i));
+    }
+  }
+}
+
+}
+
 namespace octomap_server{
 
 OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
@@ -66,9 +161,29 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_minSizeX(0.0), m_minSizeY(0.0),
   m_filterSpeckles(false), m_filterGroundPlane(false),
   m_groundFilterDistance(0.04), m_groundFilterAngle(0.15), m_groundFilterPlaneDistance(0.07),
+  m_groundFilterGrid(false), m_groundFilterCellSize(0.5),
   m_compressMap(true),
   m_incrementalUpdate(false),
-  m_initConfig(true)
+  m_initConfig(true),
+  m_incrementalPublish(false),
+  m_accumulateChanges(false),
+  m_publishedCellsValid(false),
+  m_projectionCache(false),
+  m_columnsValid(false),
+  m_columnsProjected(false),
+  m_specklesValid(false),
+  m_voxelFilter(false),
+  m_pipeline(false),
+  m_mergeDistance(0.0),
+  m_updatePublished(true),
+  m_cloudQueue(NULL),
+  m_scanQueue(NULL),
+  m_publishQueue(NULL),
+  m_pipelineRunning(false),
+  m_localMapSize(0.0),
+  m_tileSize(10.0),
+  m_localMapValid(false),
+  m_cloudCount(0)
 {
   double probHit, probMiss, thresMin, thresMax;
 
@@ -98,6 +213,14 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("ground_filter/angle", m_groundFilterAngle, m_groundFilterAngle);
   // distance of found plane from z=0 to be detected as ground (e.g. to exclude tables)
   private_nh.param("ground_filter/plane_distance", m_groundFilterPlaneDistance, m_groundFilterPlaneDistance);
+  // "ransac" plane fitting or "grid" of lowest points per cell
+  std::string groundFilterMethod("ransac");
+  private_nh.param("ground_filter/method", groundFilterMethod, groundFilterMethod);
+  m_groundFilterGrid = (groundFilterMethod == "grid");
+  if (!m_groundFilterGrid && groundFilterMethod != "ransac")
+    ROS_WARN_STREAM("Unknown ground_filter/method \"" << groundFilterMethod << "\", using RANSAC");
+  // cell size of the grid method
+  private_nh.param("ground_filter/cell_size", m_groundFilterCellSize, m_groundFilterCellSize);
 
   private_nh.param("sensor_model/max_range", m_maxRange, m_maxRange);
 
@@ -109,6 +232,33 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("compress_map", m_compressMap, m_compressMap);
   private_nh.param("incremental_2D_projection", m_incrementalUpdate, m_incrementalUpdate);
 
+  // threads for ray casting in insertScan (0: one per core)
+  int insertThreads;
+  private_nh.param("insert_threads", insertThreads, 1);
+  if (insertThreads <= 0)
+    insertThreads = std::max(1u, boost::thread::hardware_concurrency());
+  m_insertWorkers.resize(insertThreads);
+
+  // patch markers and point cloud from the changed nodes instead of rebuilding them:
+  private_nh.param("incremental_publish", m_incrementalPublish, m_incrementalPublish);
+  // project the 2D map from voxel counts per column instead of the octree (not with filter_speckles):
+  private_nh.param("projection_cache", m_projectionCache, m_projectionCache);
+  // insert only one endpoint per voxel of each scan:
+  private_nh.param("voxel_filter", m_voxelFilter, m_voxelFilter);
+
+  // preprocess, insert and publish clouds in separate threads:
+  private_nh.param("pipeline", m_pipeline, m_pipeline);
+  int queueSize;
+  std::string dropPolicy;
+  private_nh.param("pipeline/queue_size", queueSize, 2);
+  private_nh.param("pipeline/drop_policy", dropPolicy, std::string("drop_oldest"));
+  private_nh.param("pipeline/merge_distance", m_mergeDistance, m_res);
+
+  // keep only a cube of this size around base_frame_id (0: the whole map):
+  private_nh.param("local_map/size", m_localMapSize, m_localMapSize);
+  private_nh.param("local_map/tile_size", m_tileSize, m_tileSize);
+  private_nh.param("local_map/tile_directory", m_tileDirectory, m_tileDirectory);
+
   if (m_filterGroundPlane && (m_pointcloudMinZ > 0.0 || m_pointcloudMaxZ < 0.0)){
     ROS_WARN_STREAM("You enabled ground filtering but incoming pointclouds will be pre-filtered in ["
               <<m_pointcloudMinZ <<", "<< m_pointcloudMaxZ << "], excluding the ground level z=0. "
@@ -128,6 +278,13 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
 #endif
   }
 
+#ifdef COLOR_OCTOMAP_SERVER
+  if (m_incrementalPublish) {
+    ROS_WARN_STREAM("Incremental publishing does not track color changes, publishing the complete map instead.");
+    m_incrementalPublish = false;
+  }
+#endif
+
 
   // initialize octomap object & params
   m_octree = new OcTreeT(m_res);
@@ -138,6 +295,8 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_treeDepth = m_octree->getTreeDepth();
   m_maxTreeDepth = m_treeDepth;
   m_gridmap.info.resolution = m_res;
+  if (m_incrementalPublish || m_projectionCache)
+    m_octree->enableChangeDetection(true);
 
   double r, g, b, a;
   private_nh.param("color/r", r, 0.0);
@@ -173,6 +332,25 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_mapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("projected_map", 5, m_latchedTopics);
   m_fmarkerPub = m_nh.advertise<visualization_msgs::MarkerArray>("free_cells_vis_array", 1, m_latchedTopics);
 
+  if (m_pipeline){
+    // the threads are started by startPipeline(), clouds queue up until then.
+    // stale clouds are dropped before preprocessing, the policy applies to preprocessed scans:
+    BoundedQueue<PendingScanPtr>::Policy policy = BoundedQueue<PendingScanPtr>::DROP_OLDEST;
+    if (dropPolicy == "drop_newest")
+      policy = BoundedQueue<PendingScanPtr>::DROP_NEWEST;
+    else if (dropPolicy == "merge")
+      policy = BoundedQueue<PendingScanPtr>::MERGE;
+    else if (dropPolicy != "drop_oldest")
+      ROS_WARN_STREAM("Unknown pipeline/drop_policy \"" << dropPolicy << "\", dropping the oldest scans");
+
+    m_cloudQueue = new BoundedQueue<sensor_msgs::PointCloud2::ConstPtr>(queueSize);
+    m_scanQueue = new BoundedQueue<PendingScanPtr>(queueSize, policy,
+                                                   boost::bind(&OctomapServer::mergeScans, this, _1, _2));
+    m_publishQueue = new BoundedQueue<ros::Time>(1); // publish once for all scans inserted meanwhile
+
+    ROS_INFO_STREAM("Pipelined insertion, queue size " << queueSize << ", policy " << dropPolicy);
+  }
+
   m_pointCloudSub = new message_filters::Subscriber<sensor_msgs::PointCloud2> (m_nh, "cloud_in", 5);
   m_tfPointCloudSub = new tf::MessageFilter<sensor_msgs::PointCloud2> (*m_pointCloudSub, m_tfListener, m_worldFrameId, 5);
   m_tfPointCloudSub->registerCallback(boost::bind(&OctomapServer::insertCloudCallback, this, _1));
@@ -198,6 +376,13 @@ OctomapServer::~OctomapServer(){
     m_pointCloudSub = NULL;
   }
 
+  stopPipeline();
+  if (m_pipeline){
+    delete m_cloudQueue;
+    delete m_scanQueue;
+    delete m_publishQueue;
+  }
+
 
   if (m_octree){
     delete m_octree;
@@ -206,10 +391,33 @@ OctomapServer::~OctomapServer(){
 
 }
 
+void OctomapServer::startPipeline(){
+  if (!m_pipeline || m_pipelineRunning)
+    return;
+
+  m_pipelineThreads.create_thread(boost::bind(&OctomapServer::preprocessThread, this));
+  m_pipelineThreads.create_thread(boost::bind(&OctomapServer::insertThread, this));
+  m_pipelineThreads.create_thread(boost::bind(&OctomapServer::publishThread, this));
+  m_pipelineRunning = true;
+}
+
+void OctomapServer::stopPipeline(){
+  if (!m_pipelineRunning)
+    return;
+
+  m_cloudQueue->shutdown();
+  m_scanQueue->shutdown();
+  m_publishQueue->shutdown();
+  m_pipelineThreads.join_all();
+  m_pipelineRunning = false;
+}
+
 bool OctomapServer::openFile(const std::string& filename){
   if (filename.length() <= 3)
     return false;
 
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+
   std::string suffix = filename.substr(filename.length()-3, 3);
   if (suffix== ".bt"){
     if (!m_octree->readBinary(filename)){
@@ -236,6 +444,14 @@ bool OctomapServer::openFile(const std::string& filename){
 
   ROS_INFO("Octomap file %s loaded (%zu nodes).", filename.c_str(),m_octree->size());
 
+  if (m_incrementalPublish || m_projectionCache)
+    m_octree->enableChangeDetection(true);
+  m_publishedCellsValid = false;
+  m_columnsValid = false;
+  m_specklesValid = false;
+  m_storedTiles.clear();
+  m_localMapValid = false;
+
   m_treeDepth = m_octree->getTreeDepth();
   m_maxTreeDepth = m_treeDepth;
   m_res = m_octree->getResolution();
@@ -260,41 +476,48 @@ bool OctomapServer::openFile(const std::string& filename){
 }
 
 void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud){
+  if (m_pipeline){
+    if (!m_cloudQueue->push(cloud))
+      ROS_DEBUG("Pointcloud queue full, dropped a cloud");
+    return;
+  }
+
   ros::WallTime startTime = ros::WallTime::now();
 
+  PendingScan scan;
+  if (!preprocessCloud(cloud, scan))
+    return;
 
-  //
-  // ground filtering in base frame
-  //
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    insertScan(scan.sensorOrigin, scan.ground, scan.nonground);
+    updateLocalMap(scan.baseOrigin);
+  }
+
+  double total_elapsed = (ros::WallTime::now() - startTime).toSec();
+  ROS_DEBUG("Pointcloud insertion in OctomapServer done (%zu+%zu pts (ground/nonground), %f sec)", scan.ground.size(), scan.nonground.size(), total_elapsed);
+
+  publishReadLocked(cloud->header.stamp);
+}
+
+bool OctomapServer::preprocessCloud(const sensor_msgs::PointCloud2::ConstPtr& cloud, PendingScan& scan){
   PCLPointCloud pc; // input cloud for filtering and ground-detection
   pcl::fromROSMsg(*cloud, pc);
 
+  // reconfigure waits until this cloud is done:
+  boost::shared_lock<boost::shared_mutex> filterLock(m_filterMutex);
+
   tf::StampedTransform sensorToWorldTf;
   try {
     m_tfListener.lookupTransform(m_worldFrameId, cloud->header.frame_id, cloud->header.stamp, sensorToWorldTf);
   } catch(tf::TransformException& ex){
     ROS_ERROR_STREAM( "Transform error of sensor data: " << ex.what() << ", quitting callback");
-    return;
+    return false;
   }
 
-  Eigen::Matrix4f sensorToWorld;
+  Eigen::Matrix4f sensorToWorld, sensorToBase, baseToWorld;
   pcl_ros::transformAsMatrix(sensorToWorldTf, sensorToWorld);
 
-
-  // set up filter for height range, also removes NANs:
-  pcl::PassThrough<pcl::PointXYZ> pass_x;
-  pass_x.setFilterFieldName("x");
-  pass_x.setFilterLimits(m_pointcloudMinX, m_pointcloudMaxX);
-  pcl::PassThrough<pcl::PointXYZ> pass_y;
-  pass_y.setFilterFieldName("y");
-  pass_y.setFilterLimits(m_pointcloudMinY, m_pointcloudMaxY);
-  pcl::PassThrough<pcl::PointXYZ> pass_z;
-  pass_z.setFilterFieldName("z");
-  pass_z.setFilterLimits(m_pointcloudMinZ, m_pointcloudMaxZ);
-
-  PCLPointCloud pc_ground; // segmented ground plane
-  PCLPointCloud pc_nonground; // everything else
-
   if (m_filterGroundPlane){
     tf::StampedTransform sensorToBaseTf, baseToWorldTf;
     try{
@@ -308,141 +531,459 @@ void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr
                         "You need to set the base_frame_id or disable filter_ground.");
     }
 
-
-    Eigen::Matrix4f sensorToBase, baseToWorld;
     pcl_ros::transformAsMatrix(sensorToBaseTf, sensorToBase);
     pcl_ros::transformAsMatrix(baseToWorldTf, baseToWorld);
+  }
+
+  filterCloud(pc, sensorToWorld, sensorToBase, baseToWorld, scan);
 
-    // transform pointcloud from sensor frame to fixed robot frame
-    pcl::transformPointCloud(pc, pc, sensorToBase);
-    pass_x.setInputCloud(pc.makeShared());
-    pass_x.filter(pc);
-    pass_y.setInputCloud(pc.makeShared());
-    pass_y.filter(pc);
-    pass_z.setInputCloud(pc.makeShared());
-    pass_z.filter(pc);
+  scan.sensorOrigin = sensorToWorldTf.getOrigin();
+  scan.baseOrigin = scan.sensorOrigin;
+  if (m_localMapSize > 0.0){
+    tf::StampedTransform baseToWorldTf;
+    try{
+      m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, cloud->header.stamp, baseToWorldTf);
+      scan.baseOrigin = baseToWorldTf.getOrigin();
+    }catch(tf::TransformException& ex){
+      ROS_WARN_STREAM("Transform error for local map: " << ex.what() << ", centering it at the sensor.");
+    }
+  }
+  scan.stamp = cloud->header.stamp;
+  return true;
+}
+
+void OctomapServer::filterCloud(PCLPointCloud& pc, const Eigen::Matrix4f& sensorToWorld,
+                                const Eigen::Matrix4f& sensorToBase, const Eigen::Matrix4f& baseToWorld,
+                                PendingScan& scan){
+  // one endpoint per voxel if requested:
+  KeySet* voxels = m_voxelFilter ? &m_voxelKeys : NULL;
+
+  PCLPointCloud& pc_ground = scan.ground; // segmented ground plane
+  PCLPointCloud& pc_nonground = scan.nonground; // everything else
+
+  if (m_filterGroundPlane){
+    //
+    // ground filtering in base frame
+    //
+    // transform pointcloud from sensor frame to fixed robot frame and filter height range:
+    prefilterCloud(pc, sensorToBase, true, NULL);
     filterGroundPlane(pc, pc_ground, pc_nonground);
 
     // transform clouds to world frame for insertion
-    pcl::transformPointCloud(pc_ground, pc_ground, baseToWorld);
-    pcl::transformPointCloud(pc_nonground, pc_nonground, baseToWorld);
+    prefilterCloud(pc_ground, baseToWorld, false, voxels);
+    prefilterCloud(pc_nonground, baseToWorld, false, voxels);
   } else {
-    // directly transform to map frame:
-    pcl::transformPointCloud(pc, pc, sensorToWorld);
+    // directly transform to map frame and just filter height range:
+    prefilterCloud(pc, sensorToWorld, true, voxels);
 
-    // just filter height range:
-    pass_x.setInputCloud(pc.makeShared());
-    pass_x.filter(pc);
-    pass_y.setInputCloud(pc.makeShared());
-    pass_y.filter(pc);
-    pass_z.setInputCloud(pc.makeShared());
-    pass_z.filter(pc);
+    pc_nonground.swap(pc);
+    // pc_ground is empty without ground segmentation
+    pc_ground.header = pc_nonground.header;
+  }
+}
 
-    pc_nonground = pc;
-    // pc_nonground is empty without ground segmentation
-    pc_ground.header = pc.header;
-    pc_nonground.header = pc.header;
+void OctomapServer::preprocessThread(){
+  sensor_msgs::PointCloud2::ConstPtr cloud;
+  while (m_cloudQueue->pop(cloud)){
+    PendingScanPtr scan(new PendingScan);
+    if (preprocessCloud(cloud, *scan) && !m_scanQueue->push(scan))
+      ROS_DEBUG("Scan queue full, applied drop policy");
   }
+}
 
+void OctomapServer::insertThread(){
+  PendingScanPtr scan;
+  while (m_scanQueue->pop(scan)){
+    ros::WallTime startTime = ros::WallTime::now();
+    {
+      boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+      // the update area covers all scans since the last publish:
+      OcTreeKey bbxMin = m_updateBBXMin;
+      OcTreeKey bbxMax = m_updateBBXMax;
+      insertScan(scan->sensorOrigin, scan->ground, scan->nonground);
+      updateLocalMap(scan->baseOrigin);
+      if (!m_updatePublished){
+        updateMinKey(bbxMin, m_updateBBXMin);
+        updateMaxKey(bbxMax, m_updateBBXMax);
+      }
+      m_updatePublished = false;
+    }
 
-  insertScan(sensorToWorldTf.getOrigin(), pc_ground, pc_nonground);
+    double total_elapsed = (ros::WallTime::now() - startTime).toSec();
+    ROS_DEBUG("Pointcloud insertion in OctomapServer done (%zu+%zu pts (ground/nonground), %f sec)", scan->ground.size(), scan->nonground.size(), total_elapsed);
 
-  double total_elapsed = (ros::WallTime::now() - startTime).toSec();
-  ROS_DEBUG("Pointcloud insertion in OctomapServer done (%zu+%zu pts (ground/nonground), %f sec)", pc_ground.size(), pc_nonground.size(), total_elapsed);
+    m_publishQueue->push(scan->stamp);
+    scan.reset();
+  }
+}
 
-  publishAll(cloud->header.stamp);
+void OctomapServer::publishThread(){
+  ros::Time stamp;
+  while (m_publishQueue->pop(stamp))
+    publishReadLocked(stamp);
 }
 
-void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCloud& ground, const PCLPointCloud& nonground){
-  point3d sensorOrigin = pointTfToOctomap(sensorOriginTf);
+bool OctomapServer::mergeScans(PendingScanPtr& queued, const PendingScanPtr& scan) const{
+  // the rays of the merged scan all start at the queued origin:
+  if (queued->sensorOrigin.distance(scan->sensorOrigin) > m_mergeDistance)
+    return false;
 
-  if (!m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMin)
-    || !m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMax))
-  {
-    ROS_ERROR_STREAM("Could not generate Key for origin "<<sensorOrigin);
-  }
+  queued->ground += scan->ground;
+  queued->nonground += scan->nonground;
+  queued->baseOrigin = scan->baseOrigin;
+  queued->stamp = scan->stamp;
+  return true;
+}
 
-#ifdef COLOR_OCTOMAP_SERVER
-  unsigned char* colors = new unsigned char[3];
-#endif
+void OctomapServer::publishReadLocked(const ros::Time& rostime){
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+  boost::mutex::scoped_lock publishLock(m_publishMutex);
+  publishAll(rostime);
+}
 
-  // instead of direct scan insertion, compute update to filter ground:
-  KeySet free_cells, occupied_cells;
-  // insert ground points only as free:
-  for (PCLPointCloud::const_iterator it = ground.begin(); it != ground.end(); ++it){
-    point3d point(it->x, it->y, it->z);
-    // maxrange check
-    if ((m_maxRange > 0.0) && ((point - sensorOrigin).norm() > m_maxRange) ) {
-      point = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
+void OctomapServer::updateLocalMap(const tf::Point& center){
+  if (m_localMapSize <= 0.0)
+    return;
+
+  // tiles are the nodes closest to the tile size:
+  int level = int(floor(log(m_tileSize / m_res) / log(2.0) + 0.5));
+  unsigned tileLevel = unsigned(std::min(std::max(level, 1), int(m_treeDepth) - 1));
+  unsigned tileDepth = m_treeDepth - tileLevel;
+
+  double c[3] = {center.x(), center.y(), center.z()};
+  OcTreeKey minTile, maxTile;
+  for (unsigned i = 0; i < 3; ++i){
+    minTile[i] = m_octree->coordToKey(c[i] - m_localMapSize / 2.0) >> tileLevel;
+    maxTile[i] = m_octree->coordToKey(c[i] + m_localMapSize / 2.0) >> tileLevel;
+  }
+  if (m_localMapValid && minTile == m_localMapMin && maxTile == m_localMapMax)
+    return;
+  m_localMapMin = minTile;
+  m_localMapMax = maxTile;
+  m_localMapValid = true;
+
+  // evict the tiles that left the cube...
+  std::vector<OcTreeKey> evicted;
+  for (OcTreeT::leaf_iterator it = m_octree->begin_leafs(tileDepth), end = m_octree->end_leafs(); it != end; ++it){
+    OcTreeKey corner = it.getIndexKey();
+    if (it.getDepth() == tileDepth){
+      if (!inLocalMap(corner, tileLevel))
+        evicted.push_back(corner);
+      continue;
     }
 
-    // only clear space (ground points)
-    if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
-      free_cells.insert(m_keyRay.begin(), m_keyRay.end());
+    // a pruned leaf larger than a tile, its tiles outside of the cube are evicted one by one:
+    unsigned tiles = 1 << (tileDepth - it.getDepth());
+    bool inside = true;
+    for (unsigned i = 0; i < 3; ++i){
+      unsigned first = corner[i] >> tileLevel;
+      inside = inside && first >= m_localMapMin[i] && first + tiles - 1 <= m_localMapMax[i];
     }
+    if (inside)
+      continue;
+
+    OcTreeKey tileKey;
+    for (unsigned z = 0; z < tiles; ++z)
+      for (unsigned y = 0; y < tiles; ++y)
+        for (unsigned x = 0; x < tiles; ++x){
+          tileKey[0] = corner[0] + (x << tileLevel);
+          tileKey[1] = corner[1] + (y << tileLevel);
+          tileKey[2] = corner[2] + (z << tileLevel);
+          if (!inLocalMap(tileKey, tileLevel))
+            evicted.push_back(tileKey);
+        }
+  }
+
+  for (std::vector<OcTreeKey>::const_iterator it = evicted.begin(); it != evicted.end(); ++it){
+    if (!m_tileDirectory.empty()){
+      // the binary format stores values in the parent, so the occupancy of a pruned tile comes first
+      // (search returns the larger leaf if the tile is part of one, it is stored as a uniform tile):
+      const OcTreeT::NodeType* tile = m_octree->search(*it, tileDepth);
+      std::ofstream file(tilePath(*it).c_str(), std::ios_base::out | std::ios_base::binary);
+      file.put(m_octree->isNodeOccupied(tile) ? 'o' : 'f');
+      m_octree->writeBinaryNode(file, tile);
+      if (file)
+        m_storedTiles.insert(*it);
+      else
+        ROS_WARN_STREAM("Could not write tile " << tilePath(*it) << ", dropping it");
+    }
+    m_octree->deleteNode(*it, tileDepth);
+    accumulateCube(*it, tileDepth);
+  }
+
+  // ...and load the stored ones that are inside again:
+  std::vector<OcTreeKey> loaded;
+  for (KeySet::const_iterator it = m_storedTiles.begin(); it != m_storedTiles.end(); ++it){
+    if (inLocalMap(*it, tileLevel) && loadTile(*it, tileDepth))
+      loaded.push_back(*it);
+  }
+  for (std::vector<OcTreeKey>::const_iterator it = loaded.begin(); it != loaded.end(); ++it){
+    std::remove(tilePath(*it).c_str());
+    m_storedTiles.erase(*it);
+    accumulateCube(*it, tileDepth);
+  }
+
+  if (evicted.empty() && loaded.empty())
+    return;
 
-    octomap::OcTreeKey endKey;
-    if (m_octree->coordToKeyChecked(point, endKey)){
-      updateMinKey(endKey, m_updateBBXMin);
-      updateMaxKey(endKey, m_updateBBXMax);
+  // loaded tiles are grafted onto the nodes directly, past the node count and bounds of the tree:
+  TreeBookkeeping<OcTreeT>::refresh(*m_octree);
+  m_octree->updateInnerOccupancy();
+  // not change tracked:
+  m_publishedCellsValid = false;
+  m_columnsValid = false;
+  m_specklesValid = false;
+  ROS_DEBUG("Local map moved: %zu tiles evicted, %zu loaded, %zu stored", evicted.size(), loaded.size(), m_storedTiles.size());
+}
+
+bool OctomapServer::inLocalMap(const OcTreeKey& tileKey, unsigned tileLevel) const{
+  for (unsigned i = 0; i < 3; ++i){
+    unsigned tile = tileKey[i] >> tileLevel;
+    if (tile < m_localMapMin[i] || tile > m_localMapMax[i])
+      return false;
+  }
+  return true;
+}
+
+std::string OctomapServer::tilePath(const OcTreeKey& tileKey) const{
+  std::ostringstream path;
+  path << m_tileDirectory << "/tile_" << tileKey[0] << "_" << tileKey[1] << "_" << tileKey[2] << ".bin";
+  return path.str();
+}
+
+bool OctomapServer::loadTile(const OcTreeKey& tileKey, unsigned tileDepth){
+  std::ifstream file(tilePath(tileKey).c_str(), std::ios_base::in | std::ios_base::binary);
+  if (!file.is_open()){
+    ROS_WARN_STREAM("Could not open tile " << tilePath(tileKey));
+    return false;
+  }
+
+  OcTreeT::NodeType stored;
+  bool occupied = (file.get() == 'o');
+  m_octree->readBinaryNode(file, &stored);
+  if (!file){
+    ROS_WARN_STREAM("Could not read tile " << tilePath(tileKey));
+    return false;
+  }
+  if (!stored.hasChildren())
+    stored.setLogOdds(occupied ? m_octree->getClampingThresMaxLog() : m_octree->getClampingThresMinLog());
+
+  // nothing to graft onto in an empty tree, the tile stays stored until the cube moves to other tiles
+  OcTreeT::NodeType* node = m_octree->getRoot();
+  if (!node)
+    return false;
+
+  // walk down to the tile, scans inserted outside of the cube are newer than the stored tile:
+  bool created = false;
+  for (unsigned depth = 0; depth < tileDepth; ++depth){
+    unsigned pos = childIndex(tileKey, m_treeDepth - 1 - depth);
+    if (node->childExists(pos)){
+      node = node->getChild(pos);
+    } else if (!node->hasChildren() && !created){
+      return true; // a leaf covers the whole tile
     } else{
-      ROS_ERROR_STREAM("Could not generate Key for endpoint "<<point);
+      node->createChild(pos);
+      node = node->getChild(pos);
+      created = true;
     }
   }
 
-  // all other points: free on ray, occupied on endpoint:
-  for (PCLPointCloud::const_iterator it = nonground.begin(); it != nonground.end(); ++it){
-    point3d point(it->x, it->y, it->z);
-    // maxrange check
-    if ((m_maxRange < 0.0) || ((point - sensorOrigin).norm() <= m_maxRange) ) {
+  if (created)
+    copyTile(node, &stored);
+  else
+    mergeTile(node, &stored);
+  return true;
+}
 
-      // free cells
-      if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
-        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-      }
-      // occupied endpoint
-      OcTreeKey key;
-      if (m_octree->coordToKeyChecked(point, key)){
-        occupied_cells.insert(key);
+void OctomapServer::accumulateCube(const OcTreeKey& corner, unsigned depth){
+  if (!m_accumulateChanges)
+    return;
 
-        updateMinKey(key, m_updateBBXMin);
-        updateMaxKey(key, m_updateBBXMax);
+  // a voxel is sent like the keys of the change detection:
+  if (depth == m_treeDepth)
+    m_accumulatedChanges.insert(std::make_pair(corner, false));
+  else
+    m_accumulatedCubes.push_back(std::make_pair(corner, depth));
+}
 
-#ifdef COLOR_OCTOMAP_SERVER // NB: Only read and interpret color if it's an occupied node
-        const int rgb = *reinterpret_cast<const int*>(&(it->rgb)); // TODO: there are other ways to encode color than this one
-        colors[0] = ((rgb >> 16) & 0xff);
-        colors[1] = ((rgb >> 8) & 0xff);
-        colors[2] = (rgb & 0xff);
-        m_octree->averageNodeColor(it->x, it->y, it->z, colors[0], colors[1], colors[2]);
-#endif
+void OctomapServer::writeCube(std::ostream& out, const OcTreeKey& corner, unsigned depth) const{
+  const OcTreeT::NodeType* node = m_octree->getRoot();
+  for (unsigned d = 0; node && d < depth; ++d){
+    if (!node->hasChildren()){
+      // part of a larger leaf:
+      OcTreeT::NodeType leaf;
+      leaf.setLogOdds(node->getLogOdds());
+      leaf.writeValue(out);
+      return;
+    }
+    unsigned pos = childIndex(corner, m_treeDepth - 1 - d);
+    node = node->childExists(pos) ? node->getChild(pos) : NULL;
+  }
+
+  if (node)
+    node->writeValue(out);
+}
+
+bool OctomapServer::replaceCube(std::istream& in, const OcTreeKey& corner, unsigned depth){
+  // (deleteNode() takes depth 0 for the voxels)
+  if (depth == 0)
+    m_octree->clear();
+  else
+    m_octree->deleteNode(corner, depth);
+  if (in.peek() == std::istream::traits_type::eof())
+    return true;
+
+  OcTreeT::NodeType stored;
+  stored.readValue(in);
+  if (!in)
+    return false;
+
+  // walk down to the cube, a leaf around it keeps its value outside of the cube:
+  bool created;
+  OcTreeT::NodeType* node = TreeBookkeeping<OcTreeT>::ensureRoot(*m_octree, created);
+  for (unsigned d = 0; d < depth; ++d){
+    unsigned pos = childIndex(corner, m_treeDepth - 1 - d);
+    if (!node->childExists(pos)){
+      if (!node->hasChildren() && !created){
+        node->expandNode();
+      } else{
+        node->createChild(pos);
+        created = true;
       }
-    } else {// ray longer than maxrange:;
-      point3d new_end = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
-      if (m_octree->computeRayKeys(sensorOrigin, new_end, m_keyRay)){
-        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
+    }
+    node = node->getChild(pos);
+  }
 
-        octomap::OcTreeKey endKey;
-        if (m_octree->coordToKeyChecked(new_end, endKey)){
-          updateMinKey(endKey, m_updateBBXMin);
-          updateMaxKey(endKey, m_updateBBXMax);
-        } else{
-          ROS_ERROR_STREAM("Could not generate Key for endpoint "<<new_end);
-        }
+  copyTile(node, &stored);
+  return true;
+}
 
+void OctomapServer::finishReplacedCubes(){
+  TreeBookkeeping<OcTreeT>::refresh(*m_octree);
+  m_octree->updateInnerOccupancy();
+  // not change tracked:
+  m_publishedCellsValid = false;
+  m_columnsValid = false;
+  m_specklesValid = false;
+}
 
+void OctomapServer::prefilterCloud(PCLPointCloud& pc, const Eigen::Matrix4f& transform, bool crop, KeySet* voxels){
+  if (voxels)
+    voxels->clear();
+
+  // voxel keys as OcTree::coordToKeyChecked() computes them, from m_res (which
+  // only changes before the pipeline starts) instead of m_octree, which this
+  // thread does not lock:
+  const double resFactor = 1.0 / m_res;
+  const int keyMaxVal = 1 << (m_treeDepth - 1);
+
+  // transform, crop and thin out in place, in a single pass:
+  size_t n = 0;
+  for (size_t i = 0; i < pc.points.size(); ++i){
+    PCLPoint point = pc.points[i];
+    Eigen::Vector4f p = transform * Eigen::Vector4f(point.x, point.y, point.z, 1.0f);
+    point.x = p[0];
+    point.y = p[1];
+    point.z = p[2];
+
+    // same limits as pcl::PassThrough, also removes NANs:
+    if (!pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z))
+      continue;
+    if (crop && (point.x < m_pointcloudMinX || point.x > m_pointcloudMaxX
+                 || point.y < m_pointcloudMinY || point.y > m_pointcloudMaxY
+                 || point.z < m_pointcloudMinZ || point.z > m_pointcloudMaxZ))
+      continue;
+
+    // keep the first endpoint in each voxel:
+    if (voxels){
+      OcTreeKey key;
+      bool inTree = true;
+      for (unsigned i = 0; i < 3; ++i){
+        int scaledCoord = (int) floor(resFactor * point.data[i]) + keyMaxVal;
+        if (scaledCoord < 0 || scaledCoord >= 2 * keyMaxVal)
+          inTree = false;
+        key[i] = scaledCoord;
       }
+      if (inTree && !voxels->insert(key).second)
+        continue;
     }
+
+    pc.points[n++] = point;
+  }
+
+  pc.points.resize(n);
+  pc.width = n;
+  pc.height = 1;
+  pc.is_dense = true;
+}
+
+void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCloud& ground, const PCLPointCloud& nonground){
+  point3d sensorOrigin = pointTfToOctomap(sensorOriginTf);
+
+  if (!m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMin)
+    || !m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMax))
+  {
+    ROS_ERROR_STREAM("Could not generate Key for origin "<<sensorOrigin);
   }
 
-  // mark free cells only if not seen occupied in this cloud
-  for(KeySet::iterator it = free_cells.begin(), end=free_cells.end(); it!= end; ++it){
-    if (occupied_cells.find(*it) == occupied_cells.end()){
+  // cast rays in parallel, each thread into its own key buffers:
+  size_t numPoints = ground.size() + nonground.size();
+  size_t numThreads = std::min(m_insertWorkers.size(),
+                               std::max(size_t(1), numPoints / MIN_POINTS_PER_THREAD));
+  boost::thread_group threads;
+  for (size_t i = 0; i < numThreads; ++i){
+    InsertWorker& worker = m_insertWorkers[i];
+    worker.bbxMin = m_updateBBXMin;
+    worker.bbxMax = m_updateBBXMax;
+    size_t begin = numPoints * i / numThreads;
+    size_t end = numPoints * (i+1) / numThreads;
+    if (i+1 < numThreads)
+      threads.create_thread(boost::bind(&OctomapServer::castRays, this, boost::ref(worker), sensorOrigin,
+                                        boost::cref(ground), boost::cref(nonground), begin, end));
+    else // last share in this thread
+      castRays(worker, sensorOrigin, ground, nonground, begin, end);
+  }
+  threads.join_all();
+
+  // merge into sorted, unique key lists:
+  std::vector<OcTreeKey>& free_cells = m_insertWorkers[0].freeKeys;
+  std::vector<OcTreeKey>& occupied_cells = m_insertWorkers[0].occupiedKeys;
+  for (size_t i = 0; i < numThreads; ++i){
+    const InsertWorker& worker = m_insertWorkers[i];
+    if (i > 0){
+      mergeUnique(free_cells, worker.freeKeys);
+      mergeUnique(occupied_cells, worker.occupiedKeys);
+    }
+    updateMinKey(worker.bbxMin, m_updateBBXMin);
+    updateMaxKey(worker.bbxMax, m_updateBBXMax);
+  }
+
+#ifdef COLOR_OCTOMAP_SERVER // NB: Only read and interpret color if it's an occupied node
+  // color averaging changes the tree, so it is not done by the ray casting threads
+  for (PCLPointCloud::const_iterator it = nonground.begin(); it != nonground.end(); ++it){
+    point3d point(it->x, it->y, it->z);
+    OcTreeKey key;
+    if (((m_maxRange < 0.0) || ((point - sensorOrigin).norm() <= m_maxRange))
+        && m_octree->coordToKeyChecked(point, key)){
+      const int rgb = *reinterpret_cast<const int*>(&(it->rgb)); // TODO: there are other ways to encode color than this one
+      m_octree->averageNodeColor(key, (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+    }
+  }
+#endif
+
+  // mark free cells only if not seen occupied in this cloud, both lists are in tree order:
+  std::vector<OcTreeKey>::const_iterator occupiedIt = occupied_cells.begin();
+  KeyTreeOrder keyOrder;
+  for (std::vector<OcTreeKey>::const_iterator it = free_cells.begin(), end = free_cells.end(); it != end; ++it){
+    while (occupiedIt != occupied_cells.end() && keyOrder(*occupiedIt, *it))
+      ++occupiedIt;
+    if (occupiedIt == occupied_cells.end() || !(*occupiedIt == *it)){
       m_octree->updateNode(*it, false);
     }
   }
 
   // now mark all occupied cells:
-  for (KeySet::iterator it = occupied_cells.begin(), end=occupied_cells.end(); it!= end; it++) {
+  for (std::vector<OcTreeKey>::const_iterator it = occupied_cells.begin(), end = occupied_cells.end(); it != end; ++it) {
     m_octree->updateNode(*it, true);
   }
 
@@ -473,13 +1014,95 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
   if (m_compressMap)
     m_octree->prune();
 
+  if (m_octree->isChangeDetectionEnabled())
+    collectChanges();
+  else
+    m_specklesValid = false;
 
 }
 
 
+void OctomapServer::castRays(InsertWorker& worker, const point3d& sensorOrigin,
+                             const PCLPointCloud& ground, const PCLPointCloud& nonground,
+                             size_t begin, size_t end) const {
+  worker.freeKeys.clear();
+  worker.occupiedKeys.clear();
+  // rays overlap near the sensor, drop duplicates whenever the buffer doubles:
+  size_t compactSize = std::max(MIN_COMPACT_KEYS, worker.freeKeys.capacity() / 2);
+
+  for (size_t i = begin; i < end; ++i){
+    if (worker.freeKeys.size() >= compactSize){
+      sortUnique(worker.freeKeys);
+      compactSize = std::max(compactSize, 2 * worker.freeKeys.size());
+    }
+
+    if (i < ground.size()){
+      // insert ground points only as free:
+      const PCLPoint& pt = ground[i];
+      point3d point(pt.x, pt.y, pt.z);
+      // maxrange check
+      if ((m_maxRange > 0.0) && ((point - sensorOrigin).norm() > m_maxRange) ) {
+        point = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
+      }
+
+      // only clear space (ground points)
+      if (m_octree->computeRayKeys(sensorOrigin, point, worker.keyRay)){
+        worker.freeKeys.insert(worker.freeKeys.end(), worker.keyRay.begin(), worker.keyRay.end());
+      }
+
+      octomap::OcTreeKey endKey;
+      if (m_octree->coordToKeyChecked(point, endKey)){
+        updateMinKey(endKey, worker.bbxMin);
+        updateMaxKey(endKey, worker.bbxMax);
+      } else{
+        ROS_ERROR_STREAM("Could not generate Key for endpoint "<<point);
+      }
+      continue;
+    }
+
+    // all other points: free on ray, occupied on endpoint:
+    const PCLPoint& pt = nonground[i - ground.size()];
+    point3d point(pt.x, pt.y, pt.z);
+    // maxrange check
+    if ((m_maxRange < 0.0) || ((point - sensorOrigin).norm() <= m_maxRange) ) {
+
+      // free cells
+      if (m_octree->computeRayKeys(sensorOrigin, point, worker.keyRay)){
+        worker.freeKeys.insert(worker.freeKeys.end(), worker.keyRay.begin(), worker.keyRay.end());
+      }
+      // occupied endpoint
+      OcTreeKey key;
+      if (m_octree->coordToKeyChecked(point, key)){
+        worker.occupiedKeys.push_back(key);
+
+        updateMinKey(key, worker.bbxMin);
+        updateMaxKey(key, worker.bbxMax);
+      }
+    } else {// ray longer than maxrange:;
+      point3d new_end = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
+      if (m_octree->computeRayKeys(sensorOrigin, new_end, worker.keyRay)){
+        worker.freeKeys.insert(worker.freeKeys.end(), worker.keyRay.begin(), worker.keyRay.end());
+
+        octomap::OcTreeKey endKey;
+        if (m_octree->coordToKeyChecked(new_end, endKey)){
+          updateMinKey(endKey, worker.bbxMin);
+          updateMaxKey(endKey, worker.bbxMax);
+        } else{
+          ROS_ERROR_STREAM("Could not generate Key for endpoint "<<new_end);
+        }
+      }
+    }
+  }
+
+  sortUnique(worker.freeKeys);
+  sortUnique(worker.occupiedKeys);
+}
+
+
 
 void OctomapServer::publishAll(const ros::Time& rostime){
   ros::WallTime startTime = ros::WallTime::now();
+  m_updatePublished = true;
   size_t octomapSize = m_octree->size();
   // TODO: estimate num occ. voxels for size of arrays (reserve)
   if (octomapSize <= 1){
@@ -494,6 +1117,83 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   bool publishFullMap = (m_latchedTopics || m_fullMapPub.getNumSubscribers() > 0);
   m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0);
 
+  if (m_filterSpeckles && !m_specklesValid)
+    classifySpeckles();
+
+  if (m_incrementalPublish){
+    updatePublishedCells();
+
+    // the 2D projection hooks still need all nodes, unless it is cached:
+    handlePreNodeTraversal(rostime);
+    if (m_publish2DMap && !useProjectionCache()){
+      for (OcTreeT::iterator it = m_octree->begin(m_maxTreeDepth),
+          end = m_octree->end(); it != end; ++it)
+      {
+        bool inUpdateBBX = isInUpdateBBX(it);
+        handleNode(it);
+        if (inUpdateBBX)
+          handleNodeInBBX(it);
+
+        double z = it.getZ();
+        if (z <= m_occupancyMinZ || z >= m_occupancyMaxZ)
+          continue;
+        if (m_octree->isNodeOccupied(*it)){
+          if (m_filterSpeckles && (it.getDepth() == m_treeDepth) && isSpeckleNode(it.getKey()))
+            continue;
+          handleOccupiedNode(it);
+          if (inUpdateBBX)
+            handleOccupiedNodeInBBX(it);
+        } else{
+          handleFreeNode(it);
+          if (inUpdateBBX)
+            handleFreeNodeInBBX(it);
+        }
+      }
+    }
+    handlePostNodeTraversal(rostime);
+
+    if (publishMarkerArray){
+      finishMarkers(m_occupiedCellsVis, m_color, m_useHeightMap, rostime);
+      m_markerPub.publish(m_occupiedCellsVis);
+    }
+
+    if (publishFreeMarkerArray){
+      finishMarkers(m_freeCellsVis, m_colorFree, false, rostime);
+      m_fmarkerPub.publish(m_freeCellsVis);
+    }
+
+    if (publishPointCloud){
+      size_t numPoints = 0;
+      for (unsigned i = 0; i < m_occupiedCellsVis.markers.size(); ++i)
+        numPoints += m_occupiedCellsVis.markers[i].points.size();
+
+      sensor_msgs::PointCloud2 cloud;
+      initPointCloud(cloud, numPoints);
+      for (unsigned i = 0; i < m_occupiedCellsVis.markers.size(); ++i){
+        const std::vector<geometry_msgs::Point>& points = m_occupiedCellsVis.markers[i].points;
+        for (size_t j = 0; j < points.size(); ++j){
+          PCLPoint point;
+          point.x = points[j].x;
+          point.y = points[j].y;
+          point.z = points[j].z;
+          appendPoint(cloud, point);
+        }
+      }
+      finishPointCloud(cloud, rostime);
+      m_pointCloudPub.publish(cloud);
+    }
+
+    if (publishBinaryMap)
+      publishBinaryOctoMap(rostime);
+
+    if (publishFullMap)
+      publishFullOctoMap(rostime);
+
+    double total_elapsed = (ros::WallTime::now() - startTime).toSec();
+    ROS_DEBUG("Incremental map publishing in OctomapServer took %f sec", total_elapsed);
+    return;
+  }
+
   // init markers for free space:
   visualization_msgs::MarkerArray freeNodesVis;
   // each array stores all cubes of a different size, one for each depth level:
@@ -507,8 +1207,28 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   // each array stores all cubes of a different size, one for each depth level:
   occupiedNodesVis.markers.resize(m_treeDepth+1);
 
-  // init pointcloud:
-  pcl::PointCloud<PCLPoint> pclCloud;
+  // the output is about as large as last time:
+  m_occupiedMarkerCounts.resize(m_treeDepth+1, 0);
+  m_freeMarkerCounts.resize(m_treeDepth+1, 0);
+  for (unsigned i = 0; i <= m_treeDepth; ++i){
+    if (publishMarkerArray){
+      occupiedNodesVis.markers[i].points.reserve(m_occupiedMarkerCounts[i]);
+      if (m_useHeightMap || m_useColoredMap)
+        occupiedNodesVis.markers[i].colors.reserve(m_occupiedMarkerCounts[i]);
+    }
+    if (publishFreeMarkerArray)
+      freeNodesVis.markers[i].points.reserve(m_freeMarkerCounts[i]);
+  }
+
+  // init pointcloud, its points are written directly into the message:
+  sensor_msgs::PointCloud2 cloud;
+  if (publishPointCloud)
+    initPointCloud(cloud, m_cloudCount);
+
+  // height range for the height map colors:
+  double minX, minY, minZ, maxX, maxY, maxZ;
+  m_octree->getMetricMin(minX, minY, minZ);
+  m_octree->getMetricMax(maxX, maxY, maxZ);
 
   // call pre-traversal hook:
   handlePreNodeTraversal(rostime);
@@ -538,7 +1258,7 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 #endif
 
         // Ignore speckles in the map:
-        if (m_filterSpeckles && (it.getDepth() == m_treeDepth +1) && isSpeckleNode(it.getKey())){
+        if (m_filterSpeckles && (it.getDepth() == m_treeDepth) && isSpeckleNode(it.getKey())){
           ROS_DEBUG("Ignoring single speckle at (%f,%f,%f)", x, y, z);
           continue;
         } // else: current octree node is no speckle, send it out
@@ -560,10 +1280,6 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 
           occupiedNodesVis.markers[idx].points.push_back(cubeCenter);
           if (m_useHeightMap){
-            double minX, minY, minZ, maxX, maxY, maxZ;
-            m_octree->getMetricMin(minX, minY, minZ);
-            m_octree->getMetricMax(maxX, maxY, maxZ);
-
             double h = (1.0 - std::min(std::max((cubeCenter.z-minZ)/ (maxZ - minZ), 0.0), 1.0)) *m_colorFactor;
             occupiedNodesVis.markers[idx].colors.push_back(heightMapColor(h));
           }
@@ -582,9 +1298,9 @@ void OctomapServer::publishAll(const ros::Time& rostime){
           PCLPoint _point = PCLPoint();
           _point.x = x; _point.y = y; _point.z = z;
           _point.r = r; _point.g = g; _point.b = b;
-          pclCloud.push_back(_point);
+          appendPoint(cloud, _point);
 #else
-          pclCloud.push_back(PCLPoint(x, y, z));
+          appendPoint(cloud, PCLPoint(x, y, z));
 #endif
         }
 
@@ -677,13 +1393,20 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 
   // finish pointcloud:
   if (publishPointCloud){
-    sensor_msgs::PointCloud2 cloud;
-    pcl::toROSMsg (pclCloud, cloud);
-    cloud.header.frame_id = m_worldFrameId;
-    cloud.header.stamp = rostime;
+    finishPointCloud(cloud, rostime);
     m_pointCloudPub.publish(cloud);
   }
 
+  // remember the output sizes for the next publish:
+  for (unsigned i = 0; i <= m_treeDepth; ++i){
+    if (publishMarkerArray)
+      m_occupiedMarkerCounts[i] = occupiedNodesVis.markers[i].points.size();
+    if (publishFreeMarkerArray)
+      m_freeMarkerCounts[i] = freeNodesVis.markers[i].points.size();
+  }
+  if (publishPointCloud)
+    m_cloudCount = cloud.width;
+
   if (publishBinaryMap)
     publishBinaryOctoMap(rostime);
 
@@ -697,10 +1420,240 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 }
 
 
+void OctomapServer::initPointCloud(sensor_msgs::PointCloud2& cloud, size_t capacity) const{
+  // fields and point layout as pcl::toROSMsg writes them:
+  pcl::PointCloud<PCLPoint> layout;
+  pcl::toROSMsg(layout, cloud);
+  cloud.data.resize(capacity * cloud.point_step);
+}
+
+void OctomapServer::appendPoint(sensor_msgs::PointCloud2& cloud, const PCLPoint& point){
+  size_t offset = cloud.width * cloud.point_step;
+  if (offset + cloud.point_step > cloud.data.size())
+    cloud.data.resize(std::max(2 * cloud.data.size(), offset + cloud.point_step));
+
+  memcpy(&cloud.data[offset], &point, cloud.point_step);
+  ++cloud.width;
+}
+
+void OctomapServer::finishPointCloud(sensor_msgs::PointCloud2& cloud, const ros::Time& rostime) const{
+  cloud.data.resize(cloud.width * cloud.point_step);
+  cloud.row_step = cloud.width * cloud.point_step;
+  cloud.header.frame_id = m_worldFrameId;
+  cloud.header.stamp = rostime;
+}
+
+void OctomapServer::collectChanges(){
+  // without the filter the speckles are not kept up to date:
+  if (!m_filterSpeckles)
+    m_specklesValid = false;
+
+  for (KeyBoolMap::const_iterator it = m_octree->changedKeysBegin(), end = m_octree->changedKeysEnd(); it != end; ++it){
+    if (m_incrementalPublish)
+      m_changedKeys.push_back(it->first);
+
+    if (m_specklesValid)
+      invalidateSpeckles(it->first);
+
+    // it->second: node is new, otherwise its occupancy flipped
+    if (useProjectionCache() && m_columnsValid){
+      int after = m_octree->isNodeOccupied(m_octree->search(it->first)) ? 1 : 0;
+      updateColumn(it->first, it->second ? -1 : 1 - after, after);
+    }
+
+    // merge like the tree does: a node flipped back is unchanged, a new node stays new
+    if (m_accumulateChanges){
+      KeyBoolMap::iterator change = m_accumulatedChanges.find(it->first);
+      if (change == m_accumulatedChanges.end())
+        m_accumulatedChanges.insert(*it);
+      else if (!it->second && !change->second)
+        m_accumulatedChanges.erase(change);
+    }
+  }
+  m_octree->resetChangeDetection();
+}
+
+void OctomapServer::updatePublishedCells(){
+  if (!m_publishedCellsValid){
+    ROS_DEBUG("Rebuilding published cells");
+    m_publishedCells.clear();
+    m_occupiedCellsVis.markers.assign(m_treeDepth+1, visualization_msgs::Marker());
+    m_freeCellsVis.markers.assign(m_treeDepth+1, visualization_msgs::Marker());
+    m_occupiedSlotKeys.assign(m_treeDepth+1, std::vector<OcTreeKey>());
+    m_freeSlotKeys.assign(m_treeDepth+1, std::vector<OcTreeKey>());
+
+    for (OcTreeT::iterator it = m_octree->begin(m_maxTreeDepth),
+        end = m_octree->end(); it != end; ++it)
+      addPublishedCell(it);
+
+    m_changedKeys.clear();
+    m_publishedCellsValid = true;
+    return;
+  }
+
+  // in tree order, keys in one refreshed cube are consecutive:
+  sortUnique(m_changedKeys);
+  OcTreeKey lastKey(0, 0, 0);
+  bool refreshed = false;
+  for (std::vector<OcTreeKey>::const_iterator it = m_changedKeys.begin(); it != m_changedKeys.end(); ++it){
+    if (refreshed){
+      PublishedCellMap::const_iterator last = m_publishedCells.find(lastKey);
+      if (last != m_publishedCells.end() && cubeContains(lastKey, m_treeDepth - last->second.depth, *it))
+        continue;
+    }
+
+    if (!m_filterSpeckles){
+      refreshPublishedCells(*it);
+    } else {
+      // speckles depend on their neighbors:
+      OcTreeKey key;
+      for (int dz = -1; dz <= 1; ++dz)
+        for (int dy = -1; dy <= 1; ++dy)
+          for (int dx = -1; dx <= 1; ++dx){
+            key[0] = (*it)[0] + dx;
+            key[1] = (*it)[1] + dy;
+            key[2] = (*it)[2] + dz;
+            refreshPublishedCells(key);
+          }
+    }
+
+    // remember the cube now published at the key
+    PublishedCellMap::const_iterator cell = m_publishedCells.upper_bound(*it);
+    refreshed = (cell != m_publishedCells.begin());
+    if (refreshed)
+      lastKey = (--cell)->first;
+  }
+  ROS_DEBUG("Refreshed published cells at %zu changed keys", m_changedKeys.size());
+  m_changedKeys.clear();
+}
+
+void OctomapServer::refreshPublishedCells(const OcTreeKey& key){
+  // the refreshed cube is the current leaf or the published cube at key, whichever is larger:
+  OcTreeKey corner = key;
+  unsigned level = 0;
+  OcTreeT::leaf_bbx_iterator leaf = m_octree->begin_leafs_bbx(key, key, m_maxTreeDepth);
+  if (leaf != m_octree->end_leafs_bbx()){
+    corner = leaf.getIndexKey();
+    level = m_treeDepth - leaf.getDepth();
+  }
+
+  PublishedCellMap::iterator cell = m_publishedCells.upper_bound(key);
+  if (cell != m_publishedCells.begin()){
+    --cell;
+    unsigned cellLevel = m_treeDepth - cell->second.depth;
+    if (cellLevel > level && cubeContains(cell->first, cellLevel, key)){
+      corner = cell->first;
+      level = cellLevel;
+    }
+  }
+
+  // drop everything published inside it...
+  cell = m_publishedCells.lower_bound(corner);
+  while (cell != m_publishedCells.end() && cubeContains(corner, level, cell->first))
+    removePublishedCell(cell++);
+
+  // ...and add the leaves there now:
+  OcTreeKey maxKey;
+  for (unsigned i = 0; i < 3; ++i)
+    maxKey[i] = corner[i] + ((1 << level) - 1);
+  for (OcTreeT::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(corner, maxKey, m_maxTreeDepth),
+      end = m_octree->end_leafs_bbx(); it != end; ++it)
+    addPublishedCell(it);
+}
+
+template <class IteratorT>
+void OctomapServer::addPublishedCell(const IteratorT& it){
+  bool occupied = m_octree->isNodeOccupied(*it);
+  if (!occupied && !m_publishFreeSpace)
+    return;
+
+  PublishedCell cell;
+  cell.depth = it.getDepth();
+  cell.occupied = occupied;
+  cell.slot = NOT_DRAWN;
+
+  // cubes outside the height range are tracked but not drawn, their children may be inside once split:
+  double z = it.getZ();
+  bool speckle = occupied && m_filterSpeckles && (it.getDepth() == m_treeDepth) && isSpeckleNode(it.getKey());
+  if (z > m_occupancyMinZ && z < m_occupancyMaxZ && !speckle){
+    visualization_msgs::MarkerArray& vis = occupied ? m_occupiedCellsVis : m_freeCellsVis;
+    std::vector<std::vector<OcTreeKey> >& slotKeys = occupied ? m_occupiedSlotKeys : m_freeSlotKeys;
+
+    geometry_msgs::Point cubeCenter;
+    cubeCenter.x = it.getX();
+    cubeCenter.y = it.getY();
+    cubeCenter.z = z;
+
+    cell.slot = vis.markers[cell.depth].points.size();
+    vis.markers[cell.depth].points.push_back(cubeCenter);
+    slotKeys[cell.depth].push_back(it.getIndexKey());
+  }
+
+  m_publishedCells.insert(std::make_pair(it.getIndexKey(), cell));
+}
+
+void OctomapServer::removePublishedCell(PublishedCellMap::iterator cell){
+  const PublishedCell& c = cell->second;
+  if (c.slot != NOT_DRAWN){
+    visualization_msgs::MarkerArray& vis = c.occupied ? m_occupiedCellsVis : m_freeCellsVis;
+    std::vector<std::vector<OcTreeKey> >& slotKeys = c.occupied ? m_occupiedSlotKeys : m_freeSlotKeys;
+    std::vector<geometry_msgs::Point>& points = vis.markers[c.depth].points;
+    std::vector<OcTreeKey>& keys = slotKeys[c.depth];
+
+    // move the last point into the free slot:
+    points[c.slot] = points.back();
+    points.pop_back();
+    keys[c.slot] = keys.back();
+    keys.pop_back();
+    if (c.slot < keys.size())
+      m_publishedCells.find(keys[c.slot])->second.slot = c.slot;
+  }
+  m_publishedCells.erase(cell);
+}
+
+void OctomapServer::finishMarkers(visualization_msgs::MarkerArray& vis, const std_msgs::ColorRGBA& color,
+                                  bool heightMap, const ros::Time& rostime) const{
+  double minX, minY, minZ, maxX, maxY, maxZ;
+  m_octree->getMetricMin(minX, minY, minZ);
+  m_octree->getMetricMax(maxX, maxY, maxZ);
+
+  for (unsigned i= 0; i < vis.markers.size(); ++i){
+    visualization_msgs::Marker& marker = vis.markers[i];
+    double size = m_octree->getNodeSize(i);
+
+    marker.header.frame_id = m_worldFrameId;
+    marker.header.stamp = rostime;
+    marker.ns = "map";
+    marker.id = i;
+    marker.type = visualization_msgs::Marker::CUBE_LIST;
+    marker.scale.x = size;
+    marker.scale.y = size;
+    marker.scale.z = size;
+    marker.color = color;
+
+    // the height range of the map changes, so colors are not kept:
+    marker.colors.clear();
+    if (heightMap){
+      marker.colors.reserve(marker.points.size());
+      for (size_t j = 0; j < marker.points.size(); ++j){
+        double h = (1.0 - std::min(std::max((marker.points[j].z-minZ)/ (maxZ - minZ), 0.0), 1.0)) *m_colorFactor;
+        marker.colors.push_back(heightMapColor(h));
+      }
+    }
+
+    if (marker.points.size() > 0)
+      marker.action = visualization_msgs::Marker::ADD;
+    else
+      marker.action = visualization_msgs::Marker::DELETE;
+  }
+}
+
+
 bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
 {
   ros::WallTime startTime = ros::WallTime::now();
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
   ROS_INFO("Sending binary map data on service request");
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
@@ -715,6 +1668,7 @@ bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
 bool OctomapServer::octomapFullSrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
 {
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
   ROS_INFO("Sending full map data on service request");
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
@@ -727,6 +1681,7 @@ bool OctomapServer::octomapFullSrv(OctomapSrv::Request  &req,
 }
 
 bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
   point3d min = pointMsgToOctomap(req.min);
   point3d max = pointMsgToOctomap(req.max);
 
@@ -736,9 +1691,13 @@ bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
 
     it->setLogOdds(octomap::logodds(thresMin));
     //			m_octree->updateNode(it.getKey(), -6.0f);
+    accumulateCube(it.getIndexKey(), it.getDepth());
   }
   // TODO: eval which is faster (setLogOdds+updateInner or updateNode)
   m_octree->updateInnerOccupancy();
+  m_publishedCellsValid = false; // setLogOdds is not change tracked
+  m_columnsValid = false;
+  m_specklesValid = false;
 
   publishAll(ros::Time::now());
 
@@ -746,10 +1705,16 @@ bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
 }
 
 bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp) {
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
   visualization_msgs::MarkerArray occupiedNodesVis;
   occupiedNodesVis.markers.resize(m_treeDepth +1);
   ros::Time rostime = ros::Time::now();
   m_octree->clear();
+  m_publishedCellsValid = false;
+  m_columnsValid = false;
+  m_specklesValid = false;
+  m_storedTiles.clear();
+  m_localMapValid = false;
   // clear 2D map:
   m_gridmap.data.clear();
   m_gridmap.info.height = 0.0;
@@ -821,7 +1786,9 @@ void OctomapServer::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& gr
   ground.header = pc.header;
   nonground.header = pc.header;
 
-  if (pc.size() < 50){
+  if (m_groundFilterGrid){
+    filterGroundGrid(pc, ground, nonground);
+  } else if (pc.size() < 50){
     ROS_WARN("Pointcloud in OctomapServer too small, skipping ground plane extraction");
     nonground = pc;
   } else {
@@ -926,6 +1893,51 @@ void OctomapServer::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& gr
 
 }
 
+void OctomapServer::filterGroundGrid(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const{
+  // lowest point in each cell of a 2D grid:
+  boost::unordered_map<uint64_t, float> minZ;
+  std::vector<uint64_t> cells(pc.size());
+  for (size_t i = 0; i < pc.size(); ++i){
+    int32_t cx = int32_t(floor(pc[i].x / m_groundFilterCellSize));
+    int32_t cy = int32_t(floor(pc[i].y / m_groundFilterCellSize));
+    cells[i] = (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy);
+
+    std::pair<boost::unordered_map<uint64_t, float>::iterator, bool> cell =
+      minZ.insert(std::make_pair(cells[i], pc[i].z));
+    if (!cell.second)
+      cell.first->second = std::min(cell.first->second, pc[i].z);
+  }
+
+  // ground cells are near z=0 and not much lower or higher than their neighbors
+  // (allowing for the noise of the lowest points):
+  double maxStep = m_groundFilterCellSize * tan(m_groundFilterAngle) + m_groundFilterDistance;
+  boost::unordered_map<uint64_t, bool> groundCell;
+  for (boost::unordered_map<uint64_t, float>::const_iterator it = minZ.begin(); it != minZ.end(); ++it){
+    bool isGround = std::abs(it->second) < m_groundFilterPlaneDistance;
+    int32_t cx = int32_t(it->first >> 32);
+    int32_t cy = int32_t(it->first & 0xffffffff);
+    for (int dx = -1; isGround && dx <= 1; ++dx){
+      for (int dy = -1; isGround && dy <= 1; ++dy){
+        uint64_t neighbor = (uint64_t(uint32_t(cx + dx)) << 32) | uint32_t(cy + dy);
+        boost::unordered_map<uint64_t, float>::const_iterator n = minZ.find(neighbor);
+        if (n != minZ.end() && std::abs(n->second - it->second) > maxStep)
+          isGround = false;
+      }
+    }
+    groundCell[it->first] = isGround;
+  }
+
+  // ground points are within the RANSAC distance band (+-distance) above the lowest point:
+  for (size_t i = 0; i < pc.size(); ++i){
+    if (groundCell[cells[i]] && pc[i].z - minZ[cells[i]] <= 2 * m_groundFilterDistance)
+      ground.push_back(pc[i]);
+    else
+      nonground.push_back(pc[i]);
+  }
+
+  ROS_DEBUG("Grid ground filter: %zu ground / %zu nonground points in %zu cells", ground.size(), nonground.size(), minZ.size());
+}
+
 void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
   if (m_publish2DMap){
     // init projected 2D map:
@@ -988,6 +2000,11 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
       m_gridmap.info.origin.position.y -= m_res/2.0;
     }
 
+    if (useProjectionCache()){
+      projectColumns(oldMapInfo);
+      return;
+    }
+
     // workaround for  multires. projection not working properly for inner nodes:
     // force re-building complete map
     if (m_maxTreeDepth < m_treeDepth)
@@ -1044,28 +2061,28 @@ void OctomapServer::handlePostNodeTraversal(const ros::Time& rostime){
 
 void OctomapServer::handleOccupiedNode(const OcTreeT::iterator& it){
 
-  if (m_publish2DMap && m_projectCompleteMap){
+  if (m_publish2DMap && m_projectCompleteMap && !useProjectionCache()){
     update2DMap(it, true);
   }
 }
 
 void OctomapServer::handleFreeNode(const OcTreeT::iterator& it){
 
-  if (m_publish2DMap && m_projectCompleteMap){
+  if (m_publish2DMap && m_projectCompleteMap && !useProjectionCache()){
     update2DMap(it, false);
   }
 }
 
 void OctomapServer::handleOccupiedNodeInBBX(const OcTreeT::iterator& it){
 
-  if (m_publish2DMap && !m_projectCompleteMap){
+  if (m_publish2DMap && !m_projectCompleteMap && !useProjectionCache()){
     update2DMap(it, true);
   }
 }
 
 void OctomapServer::handleFreeNodeInBBX(const OcTreeT::iterator& it){
 
-  if (m_publish2DMap && !m_projectCompleteMap){
+  if (m_publish2DMap && !m_projectCompleteMap && !useProjectionCache()){
     update2DMap(it, false);
   }
 }
@@ -1102,13 +2119,156 @@ void OctomapServer::update2DMap(const OcTreeT::iterator& it, bool occupied){
 }
 
 
+void OctomapServer::rebuildColumns(){
+  ROS_DEBUG("Counting voxels of all 2D map columns");
+  m_columns.clear();
+  m_dirtyColumns.clear();
+
+  for (OcTreeT::iterator it = m_octree->begin(), end = m_octree->end(); it != end; ++it){
+    unsigned size = 1 << (m_treeDepth - it.getDepth());
+    OcTreeKey minKey = it.getIndexKey();
+
+    // voxel layers of the leaf in the height range
+    unsigned layers = 0;
+    for (unsigned dz = 0; dz < size; ++dz){
+      double z = m_octree->keyToCoord(key_type(minKey[2] + dz));
+      if (z > m_occupancyMinZ && z < m_occupancyMaxZ)
+        ++layers;
+    }
+    if (layers == 0)
+      continue;
+
+    bool occupied = m_octree->isNodeOccupied(*it);
+    OcTreeKey key = minKey;
+    for (unsigned dx = 0; dx < size; ++dx){
+      key[0] = minKey[0] + dx;
+      for (unsigned dy = 0; dy < size; ++dy){
+        key[1] = minKey[1] + dy;
+        ColumnCounts& column = m_columns[columnKey(key)];
+        if (occupied)
+          column.occupied += layers;
+        else
+          column.free += layers;
+      }
+    }
+  }
+
+  m_columnsValid = true;
+  m_columnsProjected = false;
+}
+
+void OctomapServer::updateColumn(const OcTreeKey& key, int before, int after){
+  double z = m_octree->keyToCoord(key[2]);
+  if (!(z > m_occupancyMinZ && z < m_occupancyMaxZ) || before == after)
+    return;
+
+  ColumnCounts& column = m_columns[columnKey(key)];
+  bool wasOccupied = column.occupied > 0;
+  bool wasFree = column.free > 0;
+
+  if (before == 1)
+    --column.occupied;
+  else if (before == 0)
+    --column.free;
+  if (after == 1)
+    ++column.occupied;
+  else if (after == 0)
+    ++column.free;
+
+  if (!column.dirty && (wasOccupied != (column.occupied > 0) || wasFree != (column.free > 0))){
+    column.dirty = true;
+    m_dirtyColumns.push_back(columnKey(key));
+  }
+}
+
+void OctomapServer::projectColumns(const nav_msgs::MapMetaData& oldMapInfo){
+  if (!m_columnsValid)
+    rebuildColumns();
+
+  // a column is known (occupied overrides free) if any of its voxels is:
+  int scale = m_multires2DScale;
+  bool complete = !m_columnsProjected
+    || std::abs(oldMapInfo.resolution - m_gridmap.info.resolution) > 1e-6
+    || m_gridmap.data.size() != oldMapInfo.width * oldMapInfo.height;
+
+  if (!complete && mapChanged(oldMapInfo, m_gridmap.info)){
+    ROS_DEBUG("2D grid map size changed to %dx%d", m_gridmap.info.width, m_gridmap.info.height);
+    adjustMapData(m_gridmap, oldMapInfo);
+    complete = (m_gridmap.data.size() != m_gridmap.info.width * m_gridmap.info.height);
+  }
+
+  if (complete){
+    ROS_DEBUG("Projecting all %zu columns into the 2D map", m_columns.size());
+    m_gridmap.data.clear();
+    m_gridmap.data.resize(m_gridmap.info.width * m_gridmap.info.height, -1);
+    for (ColumnMap::const_iterator it = m_columns.begin(); it != m_columns.end(); ++it){
+      int i = (int(it->first >> 16) - int(m_paddedMinKey[0])) / scale;
+      int j = (int(it->first & 0xffff) - int(m_paddedMinKey[1])) / scale;
+      if (i < 0 || j < 0 || i >= int(m_gridmap.info.width) || j >= int(m_gridmap.info.height))
+        continue;
+
+      int8_t& cell = m_gridmap.data[mapIdx(i, j)];
+      if (it->second.occupied > 0)
+        cell = 100;
+      else if (it->second.free > 0 && cell == -1)
+        cell = 0;
+    }
+  } else {
+    ROS_DEBUG("Projecting %zu changed columns into the 2D map", m_dirtyColumns.size());
+    for (size_t n = 0; n < m_dirtyColumns.size(); ++n){
+      uint32_t x0 = m_dirtyColumns[n] >> 16;
+      uint32_t y0 = m_dirtyColumns[n] & 0xffff;
+      int i = (int(x0) - int(m_paddedMinKey[0])) / scale;
+      int j = (int(y0) - int(m_paddedMinKey[1])) / scale;
+      if (i < 0 || j < 0 || i >= int(m_gridmap.info.width) || j >= int(m_gridmap.info.height))
+        continue;
+
+      // recombine all columns of the cell
+      int8_t value = -1;
+      uint32_t minX = m_paddedMinKey[0] + i * scale;
+      uint32_t minY = m_paddedMinKey[1] + j * scale;
+      for (uint32_t x = minX; x < minX + scale && value != 100; ++x){
+        for (uint32_t y = minY; y < minY + scale; ++y){
+          ColumnMap::iterator column = m_columns.find((x << 16) | y);
+          if (column == m_columns.end())
+            continue;
+          if (column->second.occupied > 0){
+            value = 100;
+            break;
+          } else if (column->second.free > 0)
+            value = 0;
+        }
+      }
+      m_gridmap.data[mapIdx(i, j)] = value;
+    }
+  }
 
-bool OctomapServer::isSpeckleNode(const OcTreeKey&nKey) const {
+  // done with the changed columns:
+  for (size_t n = 0; n < m_dirtyColumns.size(); ++n){
+    ColumnMap::iterator column = m_columns.find(m_dirtyColumns[n]);
+    if (column != m_columns.end())
+      column->second.dirty = false;
+  }
+  m_dirtyColumns.clear();
+  m_columnsProjected = true;
+}
+
+
+
+bool OctomapServer::isSpeckleNode(const OcTreeKey&nKey) {
+  SpeckleMap::const_iterator cached = m_speckles.find(nKey);
+  if (cached != m_speckles.end())
+    return cached->second;
+
+  // not classified since a neighbor changed:
   OcTreeKey key;
   bool neighborFound = false;
-  for (key[2] = nKey[2] - 1; !neighborFound && key[2] <= nKey[2] + 1; ++key[2]){
-    for (key[1] = nKey[1] - 1; !neighborFound && key[1] <= nKey[1] + 1; ++key[1]){
-      for (key[0] = nKey[0] - 1; !neighborFound && key[0] <= nKey[0] + 1; ++key[0]){
+  for (int dz = -1; !neighborFound && dz <= 1; ++dz){
+    for (int dy = -1; !neighborFound && dy <= 1; ++dy){
+      for (int dx = -1; !neighborFound && dx <= 1; ++dx){
+        key[0] = nKey[0] + dx;
+        key[1] = nKey[1] + dy;
+        key[2] = nKey[2] + dz;
         if (key != nKey){
           OcTreeNode* node = m_octree->search(key);
           if (node && m_octree->isNodeOccupied(node)){
@@ -1120,10 +2280,78 @@ bool OctomapServer::isSpeckleNode(const OcTreeKey&nKey) const {
     }
   }
 
-  return neighborFound;
+  m_speckles[nKey] = !neighborFound;
+  return !neighborFound;
+}
+
+void OctomapServer::classifySpeckles(){
+  // occupied leaves by their smallest key, and the depths they occur at:
+  boost::unordered_map<OcTreeKey, unsigned, OcTreeKey::KeyHash> occupied;
+  std::vector<unsigned> depths;
+  for (OcTreeT::leaf_iterator it = m_octree->begin_leafs(), end = m_octree->end_leafs(); it != end; ++it){
+    if (m_octree->isNodeOccupied(*it)){
+      occupied[it.getIndexKey()] = it.getDepth();
+      if (std::find(depths.begin(), depths.end(), it.getDepth()) == depths.end())
+        depths.push_back(it.getDepth());
+    }
+  }
+
+  // a neighbor is occupied if the leaf of its depth containing it is:
+  m_speckles.clear();
+  OcTreeKey key, corner;
+  for (boost::unordered_map<OcTreeKey, unsigned, OcTreeKey::KeyHash>::const_iterator it = occupied.begin();
+      it != occupied.end(); ++it)
+  {
+    if (it->second != m_treeDepth)
+      continue;
+
+    const OcTreeKey& nKey = it->first;
+    bool neighborFound = false;
+    for (int dz = -1; !neighborFound && dz <= 1; ++dz){
+      for (int dy = -1; !neighborFound && dy <= 1; ++dy){
+        for (int dx = -1; !neighborFound && dx <= 1; ++dx){
+          key[0] = nKey[0] + dx;
+          key[1] = nKey[1] + dy;
+          key[2] = nKey[2] + dz;
+          if (key == nKey)
+            continue;
+
+          for (size_t d = 0; !neighborFound && d < depths.size(); ++d){
+            key_type mask = key_type(~((1 << (m_treeDepth - depths[d])) - 1));
+            for (unsigned i = 0; i < 3; ++i)
+              corner[i] = key[i] & mask;
+            boost::unordered_map<OcTreeKey, unsigned, OcTreeKey::KeyHash>::const_iterator leaf = occupied.find(corner);
+            neighborFound = (leaf != occupied.end() && leaf->second == depths[d]);
+          }
+        }
+      }
+    }
+    m_speckles[nKey] = !neighborFound;
+  }
+
+  ROS_DEBUG("Classified %zu voxels for the speckle filter", m_speckles.size());
+  m_specklesValid = true;
+}
+
+void OctomapServer::invalidateSpeckles(const OcTreeKey& changedKey){
+  OcTreeKey key;
+  for (int dz = -1; dz <= 1; ++dz)
+    for (int dy = -1; dy <= 1; ++dy)
+      for (int dx = -1; dx <= 1; ++dx){
+        key[0] = changedKey[0] + dx;
+        key[1] = changedKey[1] + dy;
+        key[2] = changedKey[2] + dz;
+        m_speckles.erase(key);
+      }
 }
 
 void OctomapServer::reconfigureCallback(octomap_server::OctomapServerConfig& config, uint32_t level){
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+  // depth and height filters change what is published:
+  m_publishedCellsValid = false;
+  m_columnsValid = false;
+
+  boost::unique_lock<boost::shared_mutex> filterLock(m_filterMutex);
   if (m_maxTreeDepth != unsigned(config.max_depth))
     m_maxTreeDepth = unsigned(config.max_depth);
   else{
@@ -38,6 +38,8 @@ namespace octomap_server{
 OctomapServerMultilayer::OctomapServerMultilayer(ros::NodeHandle private_nh_)
 : OctomapServer(private_nh_)
 {
+  // the layers are projected while traversing the tree
+  m_projectionCache = false;
 
   // TODO: callback for arm_navigation attached objects was removed, is
   // there a replacement functionality?
@@ -63,6 +65,8 @@ OctomapServerMultilayer::OctomapServerMultilayer(ros::NodeHandle private_nh_)
   m.z = 0.8;
   m_multiGridmap.push_back(m);
 
+  // update2DMap() keeps the layers of a cell in a uint32_t bit mask:
+  assert(m_multiGridmap.size() <= 32);
 
   for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
     ros::Publisher* pub = new ros::Publisher(m_nh.advertise<nav_msgs::OccupancyGrid>(m_multiGridmap.at(i).name, 5, m_latchedTopics));
@@ -91,10 +95,15 @@ OctomapServerMultilayer::OctomapServerMultilayer(ros::NodeHandle private_nh_)
   m_armLinks.push_back("r_wrist_flex_link");
   m_armLinkOffsets.push_back(0.05);
 
+  // link heights are looked up again only when tf has newer transforms:
+  m_armLinkHeights.resize(m_armLinks.size(), 0.0);
+  m_armLinkStamps.resize(m_armLinks.size(), ros::Time(0));
+  m_armLinkKnown.resize(m_armLinks.size(), false);
 
 }
 
 OctomapServerMultilayer::~OctomapServerMultilayer(){
+  stopPipeline();
   for (unsigned i = 0; i < m_multiMapPub.size(); ++i){
     delete m_multiMapPub[i];
   }
@@ -109,37 +118,7 @@ void OctomapServerMultilayer::handlePreNodeTraversal(const ros::Time& rostime){
   OctomapServer::handlePreNodeTraversal(rostime);
 
 
-  // recalculate height of arm layer (stub, TODO)
-  geometry_msgs::PointStamped vin;
-  vin.point.x = 0;
-  vin.point.y = 0;
-  vin.point.z = 0;
-  vin.header.stamp = rostime;
-  double link_padding = 0.03;
-
-  double minArmHeight = 2.0;
-  double maxArmHeight = 0.0;
-
-  for (unsigned i = 0; i < m_armLinks.size(); ++i){
-    vin.header.frame_id = m_armLinks[i];
-    geometry_msgs::PointStamped vout;
-    const bool found_trans =
-        m_tfListener.waitForTransform("base_footprint", m_armLinks.at(i),
-                                      ros::Time(0), ros::Duration(1.0));
-    ROS_ASSERT_MSG(found_trans, "Timed out waiting for transform to %s",
-                   m_armLinks[i].c_str());
-    m_tfListener.transformPoint("base_footprint",vin,vout);
-    maxArmHeight = std::max(maxArmHeight, vout.point.z + (m_armLinkOffsets.at(i) + link_padding));
-    minArmHeight = std::min(minArmHeight, vout.point.z - (m_armLinkOffsets.at(i) + link_padding));
-  }
-  ROS_INFO("Arm layer interval adjusted to (%f,%f)", minArmHeight, maxArmHeight);
-  m_multiGridmap.at(2).minZ = minArmHeight;
-  m_multiGridmap.at(2).maxZ = maxArmHeight;
-  m_multiGridmap.at(2).z = (maxArmHeight+minArmHeight)/2.0;
-
-
-
-
+  updateArmLayer();
 
   // TODO: also clear multilevel maps in BBX region (see OctomapServer.cpp)?
 
@@ -158,6 +137,58 @@ void OctomapServerMultilayer::handlePreNodeTraversal(const ros::Time& rostime){
       adjustMapData(it->map, gridmapInfo);
     }
   }
+
+  // layers seen in each cell during the traversal:
+  size_t numCells = m_gridmap.info.width * m_gridmap.info.height;
+  if (m_occupiedLayers.size() != numCells){
+    m_occupiedLayers.assign(numCells, 0);
+    m_freeLayers.assign(numCells, 0);
+  }
+  m_touchedCells.clear();
+}
+
+void OctomapServerMultilayer::updateArmLayer(){
+  // recalculate height of arm layer (stub, TODO)
+  double link_padding = 0.03;
+
+  double minArmHeight = 2.0;
+  double maxArmHeight = 0.0;
+  bool known = false;
+
+  for (unsigned i = 0; i < m_armLinks.size(); ++i){
+    ros::Time stamp;
+    std::string error;
+    if (m_tfListener.getLatestCommonTime("base_footprint", m_armLinks[i], stamp, &error) == tf::NO_ERROR
+        && (!m_armLinkKnown[i] || stamp != m_armLinkStamps[i]))
+    {
+      try{
+        tf::StampedTransform linkTf;
+        m_tfListener.lookupTransform("base_footprint", m_armLinks[i], stamp, linkTf);
+        m_armLinkHeights[i] = linkTf.getOrigin().z();
+        m_armLinkStamps[i] = stamp;
+        m_armLinkKnown[i] = true;
+      } catch(tf::TransformException& ex){
+        error = ex.what();
+      }
+    }
+
+    if (!m_armLinkKnown[i]){
+      ROS_WARN_THROTTLE(5.0, "No transform to %s for the arm layer: %s", m_armLinks[i].c_str(), error.c_str());
+      continue;
+    }
+    known = true;
+    maxArmHeight = std::max(maxArmHeight, m_armLinkHeights[i] + (m_armLinkOffsets.at(i) + link_padding));
+    minArmHeight = std::min(minArmHeight, m_armLinkHeights[i] - (m_armLinkOffsets.at(i) + link_padding));
+  }
+  if (!known)
+    return;
+
+  ProjectedMap& armMap = m_multiGridmap.at(2);
+  if (armMap.minZ != minArmHeight || armMap.maxZ != maxArmHeight)
+    ROS_DEBUG("Arm layer interval adjusted to (%f,%f)", minArmHeight, maxArmHeight);
+  armMap.minZ = minArmHeight;
+  armMap.maxZ = maxArmHeight;
+  armMap.z = (maxArmHeight+minArmHeight)/2.0;
 }
 
 void OctomapServerMultilayer::handlePostNodeTraversal(const ros::Time& rostime){
@@ -198,6 +229,21 @@ void OctomapServerMultilayer::handlePostNodeTraversal(const ros::Time& rostime){
 
 
 
+  // derive all layers from the cells seen in the traversal (occupied always overrides):
+  for (std::vector<unsigned>::const_iterator c = m_touchedCells.begin(); c != m_touchedCells.end(); ++c){
+    unsigned idx = *c;
+    for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
+      int8_t& cell = m_multiGridmap[i].map.data[idx];
+      if (m_occupiedLayers[idx] & (1u << i))
+        cell = 100;
+      else if ((m_freeLayers[idx] & (1u << i)) && cell == -1)
+        cell = 0;
+    }
+    m_occupiedLayers[idx] = 0;
+    m_freeLayers[idx] = 0;
+  }
+  m_touchedCells.clear();
+
   OctomapServer::handlePostNodeTraversal(rostime);
 
   for (unsigned i = 0; i < m_multiMapPub.size(); ++i){
@@ -210,56 +256,45 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
   double s2 = it.getSize()/2.0;
 
   // create a mask on which maps to update:
-  std::vector<bool> inMapLevel(m_multiGridmap.size(), false);
+  uint32_t layers = 0;
   for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
     if (z+s2 >= m_multiGridmap[i].minZ && z-s2 <= m_multiGridmap[i].maxZ){
-      inMapLevel[i] = true;
+      layers |= (1u << i);
     }
   }
 
   if (it.getDepth() == m_maxTreeDepth){
-    unsigned idx = mapIdx(it.getKey());
-    if (occupied)
-      m_gridmap.data[idx] = 100;
-    else if (m_gridmap.data[idx] == -1){
-      m_gridmap.data[idx] = 0;
-    }
-
-    for (unsigned i = 0; i < inMapLevel.size(); ++i){
-      if (inMapLevel[i]){
-        if (occupied)
-          m_multiGridmap[i].map.data[idx] = 100;
-        else if (m_multiGridmap[i].map.data[idx] == -1)
-          m_multiGridmap[i].map.data[idx] = 0;
-      }
-    }
-
+    updateCell(mapIdx(it.getKey()), occupied, layers);
   } else {
+    // each cell covered by the node once:
     int intSize = 1 << (m_treeDepth - it.getDepth());
     octomap::OcTreeKey minKey=it.getIndexKey();
-    for(int dx=0; dx < intSize; dx++){
-      int i = (minKey[0]+dx - m_paddedMinKey[0])/m_multires2DScale;
-      for(int dy=0; dy < intSize; dy++){
-        unsigned idx = mapIdx(i, (minKey[1]+dy - m_paddedMinKey[1])/m_multires2DScale);
-        if (occupied)
-          m_gridmap.data[idx] = 100;
-        else if (m_gridmap.data[idx] == -1){
-          m_gridmap.data[idx] = 0;
-        }
-
-        for (unsigned i = 0; i < inMapLevel.size(); ++i){
-          if (inMapLevel[i]){
-            if (occupied)
-              m_multiGridmap[i].map.data[idx] = 100;
-            else if (m_multiGridmap[i].map.data[idx] == -1)
-              m_multiGridmap[i].map.data[idx] = 0;
-          }
-        }
-      }
+    int minI = (minKey[0] - m_paddedMinKey[0])/m_multires2DScale;
+    int maxI = (minKey[0] + intSize - 1 - m_paddedMinKey[0])/m_multires2DScale;
+    int minJ = (minKey[1] - m_paddedMinKey[1])/m_multires2DScale;
+    int maxJ = (minKey[1] + intSize - 1 - m_paddedMinKey[1])/m_multires2DScale;
+    for (int j = minJ; j <= maxJ; ++j){
+      for (int i = minI; i <= maxI; ++i)
+        updateCell(mapIdx(i, j), occupied, layers);
     }
   }
+}
 
+void OctomapServerMultilayer::updateCell(unsigned idx, bool occupied, uint32_t layers){
+  if (occupied)
+    m_gridmap.data[idx] = 100;
+  else if (m_gridmap.data[idx] == -1){
+    m_gridmap.data[idx] = 0;
+  }
 
+  if (!layers)
+    return;
+  if (!m_occupiedLayers[idx] && !m_freeLayers[idx])
+    m_touchedCells.push_back(idx);
+  if (occupied)
+    m_occupiedLayers[idx] |= layers;
+  else
+    m_freeLayers[idx] |= layers;
 }
 
 }
@@ -28,7 +28,10 @@
  */
 
 #include <octomap_server/TrackingOctomapServer.h>
+#include <octomap_server/ChangeEncoding.h>
 #include <string>
+#include <sstream>
+#include <cmath>
 
 using namespace octomap;
 
@@ -62,6 +65,7 @@ TrackingOctomapServer::TrackingOctomapServer(const std::string& filename) :
   private_nh.param("track_changes", track_changes, false);
   private_nh.param("listen_changes", listen_changes, false);
   private_nh.param("min_change_pub", min_change_pub, 0);
+  private_nh.param("compact_changes", compact_changes, false);
 
   if (track_changes && listen_changes) {
     ROS_WARN("OctoMapServer: It might not be useful to publish changes and at the same time listen to them."
@@ -71,19 +75,29 @@ TrackingOctomapServer::TrackingOctomapServer(const std::string& filename) :
 
   if (track_changes) {
     ROS_INFO("starting server");
-    pubChangeSet = private_nh.advertise<sensor_msgs::PointCloud2>(
-        changeSetTopic, 1);
+    if (compact_changes)
+      pubChangeSet = private_nh.advertise<octomap_server::OctomapChanges>(changeSetTopic, 1);
+    else
+      pubChangeSet = private_nh.advertise<sensor_msgs::PointCloud2>(
+          changeSetTopic, 1);
     m_octree->enableChangeDetection(true);
+    // collect the changes until they are sent
+    m_accumulateChanges = true;
   }
 
   if (listen_changes) {
     ROS_INFO("starting client");
-    subChangeSet = private_nh.subscribe(changeSetTopic, 1,
-                                        &TrackingOctomapServer::trackCallback, this);
+    if (compact_changes)
+      subChangeSet = private_nh.subscribe(changeSetTopic, 1,
+                                          &TrackingOctomapServer::trackCompactCallback, this);
+    else
+      subChangeSet = private_nh.subscribe(changeSetTopic, 1,
+                                          &TrackingOctomapServer::trackCallback, this);
   }
 }
 
 TrackingOctomapServer::~TrackingOctomapServer() {
+  stopPipeline();
 }
 
 void TrackingOctomapServer::insertScan(const tf::Point & sensorOrigin, const PCLPointCloud & ground, const PCLPointCloud & nonground) {
@@ -95,15 +109,36 @@ void TrackingOctomapServer::insertScan(const tf::Point & sensorOrigin, const PCL
 }
 
 void TrackingOctomapServer::trackChanges() {
-  KeyBoolMap::const_iterator startPnt = m_octree->changedKeysBegin();
-  KeyBoolMap::const_iterator endPnt = m_octree->changedKeysEnd();
+  if (compact_changes) {
+    octomap_server::OctomapChanges changes;
+    size_t c = encodeChanges(changes);
+    if (int(c) > min_change_pub) {
+      changes.header.frame_id = change_id_frame;
+      changes.header.stamp = ros::Time().now();
+      pubChangeSet.publish(changes);
+      ROS_DEBUG("[server] sending %zu changed entries in %zu bytes", c,
+                changes.runs.size() + changes.log_odds.size() + changes.cube_data.size());
+
+      m_accumulatedChanges.clear();
+      m_accumulatedCubes.clear();
+    }
+    return;
+  }
+
+  KeyBoolMap::const_iterator startPnt = m_accumulatedChanges.begin();
+  KeyBoolMap::const_iterator endPnt = m_accumulatedChanges.end();
 
   pcl::PointCloud<pcl::PointXYZI> changedCells = pcl::PointCloud<pcl::PointXYZI>();
 
+  // cubes and deleted keys are only sent in compact change sets:
+  m_accumulatedCubes.clear();
+
   int c = 0;
   for (KeyBoolMap::const_iterator iter = startPnt; iter != endPnt; ++iter) {
     ++c;
     OcTreeNode* node = m_octree->search(iter->first);
+    if (!node)
+      continue;
 
     bool occupied = m_octree->isNodeOccupied(node);
 
@@ -133,22 +168,118 @@ void TrackingOctomapServer::trackChanges() {
     pubChangeSet.publish(changed);
     ROS_DEBUG("[server] sending %d changed entries", (int)changedCells.size());
 
-    m_octree->resetChangeDetection();
+    m_accumulatedChanges.clear();
     ROS_DEBUG("[server] octomap size after updating: %d", (int)m_octree->calcNumNodes());
   }
 }
 
+size_t TrackingOctomapServer::encodeChanges(octomap_server::OctomapChanges& changes) const {
+  std::vector<OcTreeKey> keys;
+  keys.reserve(m_accumulatedChanges.size());
+  for (KeyBoolMap::const_iterator iter = m_accumulatedChanges.begin(); iter != m_accumulatedChanges.end(); ++iter)
+    keys.push_back(iter->first);
+  std::sort(keys.begin(), keys.end(), KeyTreeOrder());
+
+  changes.resolution = m_res;
+  changes.log_odds_scale = std::max(std::abs(m_octree->getClampingThresMinLog()),
+                                    std::abs(m_octree->getClampingThresMaxLog())) / 127.0f;
+  changes.log_odds.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    // keys no longer in the tree are sent as deleted, not as p=0.5:
+    OcTreeNode* node = m_octree->search(keys[i]);
+    if (!node) {
+      changes.log_odds.push_back(octomap_server::OctomapChanges::DELETED);
+      continue;
+    }
+    int q = int(floor(node->getLogOdds() / changes.log_odds_scale + 0.5f));
+    changes.log_odds.push_back(int8_t(std::min(std::max(q, -127), 127)));
+  }
+  encodeKeyRuns(keys, changes.runs);
+
+  // cubes replaced without change detection (evicted or loaded tiles, cleared leaves larger
+  // than a voxel), each once with its current subtree:
+  std::vector<std::pair<uint64_t, unsigned> > cubes;
+  cubes.reserve(m_accumulatedCubes.size());
+  for (size_t i = 0; i < m_accumulatedCubes.size(); ++i)
+    cubes.push_back(std::make_pair(mortonCode(m_accumulatedCubes[i].first), m_accumulatedCubes[i].second));
+  std::sort(cubes.begin(), cubes.end());
+  cubes.erase(std::unique(cubes.begin(), cubes.end()), cubes.end());
+  for (size_t i = 0; i < cubes.size(); ++i) {
+    std::ostringstream subtree;
+    writeCube(subtree, mortonKey(cubes[i].first), cubes[i].second);
+    std::string data = subtree.str();
+    changes.cube_codes.push_back(cubes[i].first);
+    changes.cube_levels.push_back(m_treeDepth - cubes[i].second);
+    changes.cube_sizes.push_back(data.size());
+    changes.cube_data.insert(changes.cube_data.end(), data.begin(), data.end());
+  }
+
+  return keys.size() + cubes.size();
+}
+
+void TrackingOctomapServer::trackCompactCallback(const octomap_server::OctomapChangesConstPtr& changes) {
+  if (std::abs(changes->resolution - m_res) > 1e-6) {
+    ROS_ERROR("[client] change set resolution %f does not match the map resolution %f", changes->resolution, m_res);
+    return;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+
+  std::vector<OcTreeKey> keys;
+  if (!decodeKeyRuns(changes->runs, keys, changes->log_odds.size()) || keys.size() != changes->log_odds.size())
+    ROS_WARN("[client] truncated or invalid change set, applying %zu of %zu entries", keys.size(), changes->log_odds.size());
+
+  bool replaced = false;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (changes->log_odds[i] == octomap_server::OctomapChanges::DELETED) {
+      m_octree->deleteNode(keys[i]);
+      replaced = true;
+    } else
+      m_octree->setNodeValue(keys[i], changes->log_odds[i] * changes->log_odds_scale, true);
+  }
+
+  // cubes carry the current subtree, so they go after the keys:
+  size_t offset = 0;
+  size_t cubes = changes->cube_codes.size();
+  for (size_t i = 0; i < changes->cube_codes.size(); ++i) {
+    if (i >= changes->cube_levels.size() || i >= changes->cube_sizes.size()
+        || changes->cube_levels[i] > m_treeDepth || (changes->cube_codes[i] >> 48)
+        || changes->cube_sizes[i] > changes->cube_data.size() - offset) {
+      ROS_WARN("[client] invalid cube in change set, applying %zu of %zu cubes", i, changes->cube_codes.size());
+      cubes = i;
+      break;
+    }
+    std::istringstream subtree(std::string(changes->cube_data.begin() + offset,
+                                           changes->cube_data.begin() + offset + changes->cube_sizes[i]));
+    offset += changes->cube_sizes[i];
+    if (!replaceCube(subtree, mortonKey(changes->cube_codes[i]), m_treeDepth - changes->cube_levels[i]))
+      ROS_WARN("[client] could not read the subtree of cube %zu in change set", i);
+    replaced = true;
+  }
+  ROS_DEBUG("[client] %zu changed entries, %zu cubes", keys.size(), cubes);
+
+  if (replaced)
+    finishReplacedCubes();
+  else
+    m_octree->updateInnerOccupancy();
+  m_specklesValid = false;
+  ROS_DEBUG("[client] octomap size after updating: %d", (int)m_octree->calcNumNodes());
+}
+
 void TrackingOctomapServer::trackCallback(sensor_msgs::PointCloud2Ptr cloud) {
   pcl::PointCloud<pcl::PointXYZI> cells;
   pcl::fromROSMsg(*cloud, cells);
   ROS_DEBUG("[client] size of newly occupied cloud: %i", (int)cells.points.size());
 
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+
   for (size_t i = 0; i < cells.points.size(); i++) {
     pcl::PointXYZI& pnt = cells.points[i];
     m_octree->updateNode(m_octree->coordToKey(pnt.x, pnt.y, pnt.z), pnt.intensity, false);
   }
 
   m_octree->updateInnerOccupancy();
+  m_specklesValid = false;
   ROS_DEBUG("[client] octomap size after updating: %d", (int)m_octree->calcNumNodes());
 }
 
@@ -30,14 +30,16 @@
 #include <ros/ros.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
+#include <octomap_server/MappedOcTree.h>
 #include <fstream>
 
 #include <octomap_msgs/GetOctomap.h>
 using octomap_msgs::GetOctomap;
 
-#define USAGE "\nUSAGE: octomap_saver [-f] <mapfile.[bt|ot]>\n" \
+#define USAGE "\nUSAGE: octomap_saver [-f] <mapfile.[bt|ot|mt]>\n" \
                 "  -f: Query for the full occupancy octree, instead of just the compact binary one\n" \
-		"  mapfile.bt: filename of map to be saved (.bt: binary tree, .ot: general octree)\n"
+		"  mapfile.bt: filename of map to be saved (.bt: binary tree, .ot: general octree,\n" \
+		"              .mt: tiled octree for memory-mapping in octomap_server_static)\n"
 
 using namespace std;
 using namespace octomap;
@@ -82,8 +84,12 @@ public:
           if (!octree->write(mapname)){
             ROS_ERROR("Error writing to file %s", mapname.c_str());
           }
+        } else if (suffix == ".mt"){ // write to tiled file for mapping:
+          if (!octomap_server::MappedOcTree::write(*octree, mapname)){
+            ROS_ERROR("Error writing to file %s", mapname.c_str());
+          }
         } else{
-          ROS_ERROR("Unknown file extension, must be either .bt or .ot");
+          ROS_ERROR("Unknown file extension, must be either .bt, .ot or .mt");
         }
 
 
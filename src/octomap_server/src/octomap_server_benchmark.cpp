@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2010-2013, A. Hornung, University of Freiburg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Freiburg nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Offline benchmark of the OctomapServer insertion path.
+ *
+ * Clouds from a bag (with the transforms recorded in it) or from a synthetic
+ * spinning lidar in a room are passed directly, without topics, through the
+ * stages of insertCloudCallback(): preprocessing, filterGroundPlane(),
+ * insertScan() and publishAll(). The server is configured by the usual private
+ * parameters, e.g. _resolution:=0.1 _filter_ground:=true. Its publishers still
+ * need a roscore, latched topics (the default) make publishAll() build all
+ * outputs without subscribers.
+ *
+ * Results go to stdout as JSON: latency percentiles of each stage, rays/s and
+ * keys/s of the insertion, and the memory of the final octree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+#include <ros/ros.h>
+#include <ros/console.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <tf/tfMessage.h>
+#include <octomap_server/OctomapServer.h>
+
+#define USAGE "\nUSAGE: octomap_server_benchmark [scans | <file.bag> [topic]]\n" \
+        "  scans: number of synthetic scans to insert (default 100)\n" \
+        "  file.bag: replay the clouds of topic (default cloud_in, resolved like a subscription) in a bag\n"
+
+using namespace octomap_server;
+
+namespace {
+
+enum Stage {
+  PREPROCESS, GROUND_FILTER, INSERT, PUBLISH, TOTAL, NUM_STAGES
+};
+
+const char* STAGE_KEYS[NUM_STAGES] =
+  {"preprocess", "ground_filter", "insert", "publish", "total"};
+
+/// latency (ms) at percentile p of sorted samples, nearest rank
+double percentile(const std::vector<double>& sorted, double p){
+  if (sorted.empty())
+    return 0.0;
+  size_t rank = size_t(ceil(p * sorted.size()));
+  return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+/// an OctomapServer whose stages are timed one by one
+class BenchmarkServer : public OctomapServer {
+public:
+  BenchmarkServer()
+  : m_rays(0), m_keys(0), m_insertSeconds(0.0), m_groundFilterMs(0.0)
+  {}
+
+  virtual ~BenchmarkServer(){
+    stopPipeline();
+  }
+
+  /// run one cloud through all stages as insertCloudCallback() does, timing each of them
+  void process(const sensor_msgs::PointCloud2& cloud, const tf::Transform& sensorToWorldTf,
+               const tf::Transform& sensorToBaseTf, const tf::Transform& baseToWorldTf){
+    ros::WallTime startTime = ros::WallTime::now();
+    PendingScan scan;
+    PCLPointCloud pc;
+    pcl::fromROSMsg(cloud, pc);
+
+    Eigen::Matrix4f sensorToWorld, sensorToBase, baseToWorld;
+    pcl_ros::transformAsMatrix(sensorToWorldTf, sensorToWorld);
+    pcl_ros::transformAsMatrix(sensorToBaseTf, sensorToBase);
+    pcl_ros::transformAsMatrix(baseToWorldTf, baseToWorld);
+
+    {
+      boost::shared_lock<boost::shared_mutex> filterLock(m_filterMutex);
+      m_groundFilterMs = 0.0;
+      filterCloud(pc, sensorToWorld, sensorToBase, baseToWorld, scan);
+    }
+    // filterGroundPlane() timed itself, the rest of filterCloud() is preprocessing:
+    ros::WallTime stageTime = lap(PREPROCESS, startTime);
+    m_latencies[PREPROCESS].back() -= m_groundFilterMs;
+    if (m_filterGroundPlane)
+      m_latencies[GROUND_FILTER].push_back(m_groundFilterMs);
+
+    {
+      boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+      insertScan(sensorToWorldTf.getOrigin(), scan.ground, scan.nonground);
+      updateLocalMap(baseToWorldTf.getOrigin());
+    }
+    ros::WallTime insertTime = stageTime;
+    stageTime = lap(INSERT, stageTime);
+    m_insertSeconds += (stageTime - insertTime).toSec();
+    m_rays += scan.ground.size() + scan.nonground.size();
+    m_keys += m_insertWorkers[0].freeKeys.size() + m_insertWorkers[0].occupiedKeys.size();
+
+    publishAll(cloud.header.stamp);
+    stageTime = lap(PUBLISH, stageTime);
+    m_latencies[TOTAL].push_back(1e3 * (stageTime - startTime).toSec());
+  }
+
+  const std::string& worldFrameId() const { return m_worldFrameId; }
+  const std::string& baseFrameId() const { return m_baseFrameId; }
+  bool filtersGround() const { return m_filterGroundPlane; }
+
+  void printResults(const char* source, size_t skipped){
+    size_t scans = m_latencies[TOTAL].size();
+    size_t nodes = m_octree->size();
+    size_t memory = m_octree->memoryUsage();
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\n  \"source\": \"%s\",\n  \"scans\": %lu,\n  \"skipped\": %lu,\n"
+           "  \"resolution\": %g,\n  \"filter_ground\": %s,\n  \"latency_ms\": {",
+           source, (unsigned long) scans, (unsigned long) skipped, m_res,
+           m_filterGroundPlane ? "true" : "false");
+    for (int s = 0; s < NUM_STAGES; ++s){
+      std::vector<double>& samples = m_latencies[s];
+      std::sort(samples.begin(), samples.end());
+      double sum = 0.0;
+      for (size_t i = 0; i < samples.size(); ++i)
+        sum += samples[i];
+      printf("%s\n    \"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+             s > 0 ? "," : "", STAGE_KEYS[s], samples.empty() ? 0.0 : sum / samples.size(),
+             percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99),
+             samples.empty() ? 0.0 : samples.back());
+    }
+    printf("\n  },\n  \"insert\": {\"rays\": %lu, \"keys\": %lu, \"rays_per_s\": %.0f, \"keys_per_s\": %.0f},\n",
+           (unsigned long) m_rays, (unsigned long) m_keys,
+           m_insertSeconds > 0.0 ? m_rays / m_insertSeconds : 0.0,
+           m_insertSeconds > 0.0 ? m_keys / m_insertSeconds : 0.0);
+    printf("  \"octree\": {\"nodes\": %lu, \"leafs\": %lu, \"bytes\": %lu, \"bytes_per_node\": %.2f},\n"
+           "  \"max_rss_kb\": %ld\n}\n",
+           (unsigned long) nodes, (unsigned long) m_octree->getNumLeafNodes(), (unsigned long) memory,
+           nodes ? double(memory) / nodes : 0.0, usage.ru_maxrss);
+  }
+
+protected:
+  virtual void filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const{
+    ros::WallTime start = ros::WallTime::now();
+    OctomapServer::filterGroundPlane(pc, ground, nonground);
+    m_groundFilterMs += 1e3 * (ros::WallTime::now() - start).toSec();
+  }
+
+private:
+  /// add the time since start to stage, returns the current time
+  ros::WallTime lap(Stage stage, const ros::WallTime& start){
+    ros::WallTime now = ros::WallTime::now();
+    m_latencies[stage].push_back(1e3 * (now - start).toSec());
+    return now;
+  }
+
+  std::vector<double> m_latencies[NUM_STAGES];
+  size_t m_rays;
+  size_t m_keys;
+  double m_insertSeconds;
+  mutable double m_groundFilterMs; // of the current cloud
+};
+
+/// deterministic noise in [-1, 1]
+double noise(unsigned& state){
+  state = state * 1664525u + 1013904223u;
+  return (state >> 8) / double(1 << 23) - 1.0;
+}
+
+/**
+ * Spinning lidar scans of a square room with pillars, taken from a robot
+ * driving in a circle. Clouds are in the sensor frame, which is 1m above the
+ * base and aligned with it.
+ */
+class SyntheticScans {
+public:
+  SyntheticScans(const ros::NodeHandle& private_nh)
+  : m_state(12345)
+  {
+    private_nh.param("benchmark/beams", m_beams, 16);
+    private_nh.param("benchmark/columns", m_columns, 1800);
+    private_nh.param("benchmark/room_size", m_roomSize, 20.0);
+    private_nh.param("benchmark/max_range", m_maxRange, 30.0);
+  }
+
+  void scan(unsigned n, sensor_msgs::PointCloud2& cloud, tf::Transform& sensorToBase, tf::Transform& baseToWorld){
+    const double wallHeight = 3.0;
+    const double sensorHeight = 1.0;
+    const double half = m_roomSize / 2.0;
+    const double pillarRadius = 0.3;
+
+    // 1 m/s at 10 scans/s:
+    double radius = half / 2.0;
+    double angle = 0.1 * n / radius;
+    double yaw = angle + M_PI / 2.0;
+    sensorToBase = tf::Transform(tf::Quaternion::getIdentity(), tf::Vector3(0.0, 0.0, sensorHeight));
+    baseToWorld = tf::Transform(tf::createQuaternionFromYaw(yaw),
+                                tf::Vector3(radius * cos(angle), radius * sin(angle), 0.0));
+    tf::Vector3 origin = (baseToWorld * sensorToBase).getOrigin();
+
+    OctomapServer::PCLPointCloud pc;
+    pc.reserve(m_beams * m_columns);
+    for (int b = 0; b < m_beams; ++b){
+      // +-15 deg like a VLP-16:
+      double elevation = (m_beams > 1) ? (-15.0 + 30.0 * b / (m_beams - 1)) * M_PI / 180.0 : 0.0;
+      for (int c = 0; c < m_columns; ++c){
+        double azimuth = 2.0 * M_PI * c / m_columns;
+        // direction in the sensor frame and the world frame:
+        tf::Vector3 dir(cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation));
+        tf::Vector3 worldDir = tf::Matrix3x3(baseToWorld.getRotation()) * dir;
+
+        double range = m_maxRange;
+        if (worldDir.z() < 0.0)
+          range = std::min(range, -origin.z() / worldDir.z());
+        for (int i = 0; i < 2; ++i){
+          if (worldDir[i] != 0.0){
+            double t = ((worldDir[i] > 0.0 ? half : -half) - origin[i]) / worldDir[i];
+            if (origin.z() + t * worldDir.z() <= wallHeight)
+              range = std::min(range, t);
+          }
+        }
+        // pillars on a 5m grid:
+        for (double px = -half + 2.5; px < half; px += 5.0){
+          for (double py = -half + 2.5; py < half; py += 5.0){
+            double dx = origin.x() - px, dy = origin.y() - py;
+            double a = worldDir.x() * worldDir.x() + worldDir.y() * worldDir.y();
+            double bh = dx * worldDir.x() + dy * worldDir.y();
+            double disc = bh * bh - a * (dx * dx + dy * dy - pillarRadius * pillarRadius);
+            if (a > 0.0 && disc >= 0.0){
+              double t = (-bh - sqrt(disc)) / a;
+              if (t > 0.0 && origin.z() + t * worldDir.z() <= wallHeight)
+                range = std::min(range, t);
+            }
+          }
+        }
+
+        if (range >= m_maxRange)
+          continue; // no return
+        range += 0.01 * noise(m_state);
+        pc.push_back(OctomapServer::PCLPoint());
+        pc.back().x = range * dir.x();
+        pc.back().y = range * dir.y();
+        pc.back().z = range * dir.z();
+      }
+    }
+
+    pcl::toROSMsg(pc, cloud);
+    cloud.header.frame_id = "benchmark_sensor";
+    cloud.header.stamp = ros::Time(1.0 + 0.1 * n);
+  }
+
+private:
+  int m_beams;
+  int m_columns;
+  double m_roomSize;
+  double m_maxRange;
+  unsigned m_state;
+};
+
+/// replay the clouds of topic (a resolved name) in a bag, returns their number, skipped: clouds that could not be transformed
+size_t replayBag(BenchmarkServer& server, const std::string& filename, const std::string& topic, size_t& skipped){
+  rosbag::Bag bag(filename, rosbag::bagmode::Read);
+
+  // all transforms of the bag first, so that every cloud can be interpolated:
+  std::vector<std::string> tfTopics;
+  tfTopics.push_back("/tf");
+  tfTopics.push_back("/tf_static");
+  rosbag::View tfView(bag, rosbag::TopicQuery(tfTopics));
+  rosbag::View allView(bag);
+  ros::Time begin = allView.getBeginTime();
+  ros::Time end = allView.getEndTime();
+  tf::Transformer transformer(true, (end - begin) + ros::Duration(1.0));
+  for (rosbag::View::iterator it = tfView.begin(); it != tfView.end(); ++it){
+    tf::tfMessage::ConstPtr msg = it->instantiate<tf::tfMessage>();
+    if (!msg)
+      continue;
+    bool isStatic = (it->getTopic() == "/tf_static");
+    for (size_t i = 0; i < msg->transforms.size(); ++i){
+      tf::StampedTransform transform;
+      tf::transformStampedMsgToTF(msg->transforms[i], transform);
+      if (isStatic){
+        // valid for the whole bag:
+        transform.stamp_ = begin;
+        transformer.setTransform(transform, "bag");
+        transform.stamp_ = end;
+      }
+      transformer.setTransform(transform, "bag");
+    }
+  }
+
+  size_t clouds = 0;
+  skipped = 0;
+  rosbag::View cloudView(bag, rosbag::TopicQuery(topic));
+  for (rosbag::View::iterator it = cloudView.begin(); it != cloudView.end() && ros::ok(); ++it){
+    sensor_msgs::PointCloud2::ConstPtr cloud = it->instantiate<sensor_msgs::PointCloud2>();
+    if (!cloud)
+      continue;
+    ++clouds;
+
+    tf::StampedTransform sensorToWorldTf, sensorToBaseTf, baseToWorldTf;
+    try {
+      transformer.lookupTransform(server.worldFrameId(), cloud->header.frame_id, cloud->header.stamp, sensorToWorldTf);
+    } catch(tf::TransformException& ex){
+      ROS_WARN_STREAM_THROTTLE(1.0, "Transform error of sensor data: " << ex.what() << ", skipping cloud");
+      ++skipped;
+      continue;
+    }
+    try {
+      transformer.lookupTransform(server.baseFrameId(), cloud->header.frame_id, cloud->header.stamp, sensorToBaseTf);
+      transformer.lookupTransform(server.worldFrameId(), server.baseFrameId(), cloud->header.stamp, baseToWorldTf);
+    } catch(tf::TransformException& ex){
+      if (server.filtersGround()){
+        ROS_WARN_STREAM_THROTTLE(1.0, "Transform error for ground plane filter: " << ex.what() << ", skipping cloud");
+        ++skipped;
+        continue;
+      }
+      // the base frame only centers the local map then:
+      sensorToBaseTf.setIdentity();
+      baseToWorldTf.setData(sensorToWorldTf);
+    }
+    server.process(*cloud, sensorToWorldTf, sensorToBaseTf, baseToWorldTf);
+  }
+  return clouds;
+}
+
+}
+
+int main(int argc, char** argv){
+  ros::init(argc, argv, "octomap_server_benchmark");
+  ros::NodeHandle private_nh("~");
+
+  if (argc > 3 || (argc > 1 && std::string(argv[1]) == "-h")){
+    ROS_ERROR("%s", USAGE);
+    exit(-1);
+  }
+
+  std::string bagFilename;
+  int scans = 100;
+  if (argc > 1){
+    std::string arg(argv[1]);
+    if (arg.size() > 4 && arg.substr(arg.size() - 4) == ".bag")
+      bagFilename = arg;
+    else
+      scans = atoi(argv[1]);
+  }
+  if (scans <= 0 || (argc > 2 && bagFilename.empty())){
+    ROS_ERROR("%s", USAGE);
+    exit(-1);
+  }
+
+  if (!ros::master::check()){
+    ROS_ERROR("octomap_server_benchmark needs a roscore for the publishers of OctomapServer");
+    exit(1);
+  }
+
+  // only the JSON results go to stdout, not the info messages of the server:
+  if (ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn))
+    ros::console::notifyLoggerLevelsChanged();
+
+  BenchmarkServer server;
+  size_t skipped = 0;
+  if (!bagFilename.empty()){
+    // bags store resolved topic names, e.g. /cloud_in:
+    std::string topic = ros::names::resolve(argc > 2 ? argv[2] : "cloud_in");
+    size_t clouds = 0;
+    try {
+      clouds = replayBag(server, bagFilename, topic, skipped);
+    } catch(rosbag::BagException& ex){
+      ROS_ERROR("Could not read %s: %s", bagFilename.c_str(), ex.what());
+      exit(1);
+    }
+    if (clouds == 0){
+      ROS_ERROR("No PointCloud2 messages on %s in %s", topic.c_str(), bagFilename.c_str());
+      exit(1);
+    }
+  } else {
+    SyntheticScans synthetic(private_nh);
+    sensor_msgs::PointCloud2 cloud;
+    tf::Transform sensorToBase, baseToWorld;
+    for (int n = 0; n < scans && ros::ok(); ++n){
+      synthetic.scan(n, cloud, sensorToBase, baseToWorld);
+      server.process(cloud, baseToWorld * sensorToBase, sensorToBase, baseToWorld);
+    }
+  }
+
+  server.printResults(bagFilename.empty() ? "synthetic" : bagFilename.c_str(), skipped);
+  return 0;
+}
@@ -57,8 +57,8 @@ int main(int argc, char** argv){
     }
   }
 
-
-
+  // only after the map is loaded, openFile() replaces the octree:
+  server.startPipeline();
 
   try{
     ros::spin();
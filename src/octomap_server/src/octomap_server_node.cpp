@@ -76,6 +76,9 @@ int main(int argc, char** argv){
     }
   }
 
+  // only after the map is loaded, openFile() replaces the octree:
+  server.startPipeline();
+
   try{
     ros::spin();
   }catch(std::runtime_error& e){
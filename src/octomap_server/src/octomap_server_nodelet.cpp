@@ -58,6 +58,8 @@ public:
         NODELET_WARN("Could not open file %s", mapFilename.c_str());
       }
     }
+    // only after the map is loaded, openFile() replaces the octree:
+    server_->startPipeline();
   }
 private:
   boost::shared_ptr<OctomapServer> server_;
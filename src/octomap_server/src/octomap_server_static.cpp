@@ -30,16 +30,21 @@
 #include <ros/ros.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
+#include <octomap_server/MappedOcTree.h>
 #include <fstream>
 
 #include <octomap_msgs/GetOctomap.h>
+#include <octomap_server/QueryPoints.h>
 using octomap_msgs::GetOctomap;
+using octomap_server::QueryPoints;
 
-#define USAGE "\nUSAGE: octomap_server_static <mapfile.[bt|ot]>\n" \
-		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree)\n"
+#define USAGE "\nUSAGE: octomap_server_static <mapfile.[bt|ot|mt]>\n" \
+		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree,\n" \
+		"              .mt: memory-mapped octree written by octomap_saver, served without loading)\n"
 
 using namespace std;
 using namespace octomap;
+using octomap_server::MappedOcTree;
 
 class OctomapServerStatic{
 public:
@@ -59,8 +64,16 @@ public:
 
     std::string suffix = filename.substr(filename.length()-3, 3);
 
+    // .mt files are mapped into memory and only read on requests:
+    if (suffix == ".mt"){
+      if (!m_mappedOctree.open(filename))
+        exit(1);
+
+      ROS_INFO("Mapped octree type \"%s\" from file %s", m_mappedOctree.getTreeType().c_str(), filename.c_str());
+      ROS_INFO("Octree resolution: %f, %zu tiles", m_mappedOctree.getResolution(), m_mappedOctree.numTiles());
+    }
     // .bt files only as OcTree, all other classes need to be in .ot files:
-    if (suffix == ".bt"){
+    else if (suffix == ".bt"){
       OcTree* octree = new OcTree(filename);
 
       m_octree = octree;
@@ -78,17 +91,20 @@ public:
       exit(1);
     }
 
-    if (!m_octree ){
+    if (!m_octree && !m_mappedOctree.isOpen()){
       ROS_ERROR("Could not read right octree class in file");
       exit(1);
     }
 
-    ROS_INFO("Read octree type \"%s\" from file %s", m_octree->getTreeType().c_str(), filename.c_str());
-    ROS_INFO("Octree resultion: %f, size: %zu", m_octree->getResolution(), m_octree->size());
+    if (m_octree){
+      ROS_INFO("Read octree type \"%s\" from file %s", m_octree->getTreeType().c_str(), filename.c_str());
+      ROS_INFO("Octree resultion: %f, size: %zu", m_octree->getResolution(), m_octree->size());
+    }
 
 
     m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServerStatic::octomapBinarySrv, this);
     m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServerStatic::octomapFullSrv, this);
+    m_queryPointsService = m_nh.advertiseService("query_points", &OctomapServerStatic::queryPointsSrv, this);
 
   }
 
@@ -103,6 +119,9 @@ public:
     ROS_INFO("Sending binary map data on service request");
     res.map.header.frame_id = m_worldFrameId;
     res.map.header.stamp = ros::Time::now();
+    if (m_mappedOctree.isOpen())
+      return m_mappedOctree.binaryMapToMsg(res.map);
+
     if (!octomap_msgs::binaryMapToMsg(*m_octree, res.map))
       return false;
 
@@ -115,7 +134,8 @@ public:
     ROS_INFO("Sending full map data on service request");
     res.map.header.frame_id = m_worldFrameId;
     res.map.header.stamp = ros::Time::now();
-
+    if (m_mappedOctree.isOpen())
+      return m_mappedOctree.fullMapToMsg(res.map);
 
     if (!octomap_msgs::fullMapToMsg(*m_octree, res.map))
       return false;
@@ -123,11 +143,38 @@ public:
     return true;
   }
 
+  bool queryPointsSrv(QueryPoints::Request  &req,
+                      QueryPoints::Response &res)
+  {
+    // loaded maps can only be queried as OcTree:
+    OcTree* octree = dynamic_cast<OcTree*>(m_octree);
+    if (!m_mappedOctree.isOpen() && !octree){
+      ROS_ERROR("Points can only be queried in .mt files and OcTree maps");
+      return false;
+    }
+
+    res.occupancy.resize(req.points.size());
+    for (size_t i = 0; i < req.points.size(); ++i){
+      point3d point(req.points[i].x, req.points[i].y, req.points[i].z);
+      bool known, occupied = false;
+      if (m_mappedOctree.isOpen())
+        known = m_mappedOctree.search(point, occupied);
+      else{
+        OcTreeNode* node = octree->search(point);
+        known = (node != NULL);
+        occupied = known && octree->isNodeOccupied(node);
+      }
+      res.occupancy[i] = known ? (occupied ? 1 : 0) : -1;
+    }
+    return true;
+  }
+
 private:
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService;
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_queryPointsService;
   ros::NodeHandle m_nh;
   std::string m_worldFrameId;
   AbstractOccupancyOcTree* m_octree;
+  MappedOcTree m_mappedOctree;
 
 };
 
@@ -49,6 +49,7 @@ int main(int argc, char** argv){
 
   try{
 	  TrackingOctomapServer ms(mapFilename);
+	  ms.startPipeline();
 	  ros::spin();
   }catch(std::runtime_error& e){
 	  ROS_ERROR("octomap_server exception: %s", e.what());
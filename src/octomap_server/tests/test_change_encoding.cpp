@@ -0,0 +1,164 @@
+/*
+ * Unit tests of the Morton codes and key runs of OctomapChanges.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <octomap_server/OctomapServer.h>
+#include <octomap_server/ChangeEncoding.h>
+
+using namespace octomap;
+using namespace octomap_server;
+
+namespace {
+
+std::vector<OcTreeKey> roundTrip(const std::vector<OcTreeKey>& keys, std::vector<uint8_t>* runs = NULL){
+  std::vector<uint8_t> encoded;
+  encodeKeyRuns(keys, encoded);
+  std::vector<OcTreeKey> decoded;
+  EXPECT_TRUE(decodeKeyRuns(encoded, decoded, keys.size()));
+  if (runs)
+    *runs = encoded;
+  return decoded;
+}
+
+void sortUnique(std::vector<OcTreeKey>& keys){
+  std::sort(keys.begin(), keys.end(), KeyTreeOrder());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+}
+
+TEST(ChangeEncoding, mortonOrder){
+  // consecutive codes are in KeyTreeOrder, and codes map back to keys
+  OcTreeKey a(32767, 32768, 32768), b(32768, 32768, 32768);
+  EXPECT_TRUE(KeyTreeOrder()(a, b));
+  EXPECT_LT(mortonCode(a), mortonCode(b));
+  EXPECT_TRUE(mortonKey(mortonCode(a)) == a);
+  EXPECT_EQ(mortonCode(OcTreeKey(1, 0, 0)), 1u);
+  EXPECT_EQ(mortonCode(OcTreeKey(0, 1, 0)), 2u);
+  EXPECT_EQ(mortonCode(OcTreeKey(0, 0, 1)), 4u);
+}
+
+TEST(ChangeEncoding, empty){
+  std::vector<OcTreeKey> keys;
+  std::vector<uint8_t> runs;
+  EXPECT_TRUE(roundTrip(keys, &runs).empty());
+  EXPECT_TRUE(runs.empty());
+}
+
+TEST(ChangeEncoding, singleKey){
+  OcTreeKey corners[] = {OcTreeKey(0, 0, 0), OcTreeKey(32768, 32768, 32768),
+                         OcTreeKey(65535, 65535, 65535)};
+  for (unsigned i = 0; i < 3; ++i){
+    std::vector<OcTreeKey> keys(1, corners[i]);
+    std::vector<OcTreeKey> decoded = roundTrip(keys);
+    ASSERT_EQ(decoded.size(), 1u);
+    EXPECT_TRUE(decoded[0] == corners[i]);
+  }
+}
+
+TEST(ChangeEncoding, runBoundaries){
+  // one 2x2x2 block is a single run, a key after a gap starts another, and one far away a third
+  std::vector<OcTreeKey> keys;
+  for (unsigned code = 0; code < 8; ++code)
+    keys.push_back(mortonKey((uint64_t(1) << 40) + code));
+  keys.push_back(mortonKey((uint64_t(1) << 40) + 9));
+  keys.push_back(mortonKey((uint64_t(1) << 47) + 5));
+  std::vector<uint8_t> runs;
+  std::vector<OcTreeKey> decoded = roundTrip(keys, &runs);
+  EXPECT_TRUE(decoded == keys);
+
+  // the block alone: delta 2^40 in 6 bytes, then length 7 in one
+  std::vector<OcTreeKey> first(keys.begin(), keys.begin() + 8);
+  std::vector<uint8_t> firstRuns;
+  roundTrip(first, &firstRuns);
+  EXPECT_EQ(firstRuns.size(), 7u);
+  EXPECT_EQ(firstRuns.back(), 7u);
+}
+
+TEST(ChangeEncoding, randomSets){
+  unsigned state = 12345;
+  for (int set = 0; set < 20; ++set){
+    // clusters of neighboring keys, like the voxels along rays
+    std::vector<OcTreeKey> keys;
+    for (int i = 0; i < 500; ++i){
+      state = state * 1664525u + 1013904223u;
+      OcTreeKey key(32768 + (state >> 26), 32768 + ((state >> 20) & 63),
+                    32768 + ((state >> 14) & 15));
+      keys.push_back(key);
+      key[0] += 1;
+      keys.push_back(key);
+    }
+    sortUnique(keys);
+    EXPECT_TRUE(roundTrip(keys) == keys);
+  }
+}
+
+TEST(ChangeEncoding, truncatedInput){
+  std::vector<OcTreeKey> keys;
+  keys.push_back(OcTreeKey(32768, 32768, 32768));
+  keys.push_back(OcTreeKey(40000, 32768, 32768));
+  keys.push_back(OcTreeKey(50000, 32768, 32768));
+  sortUnique(keys);
+  std::vector<uint8_t> runs;
+  encodeKeyRuns(keys, runs);
+
+  // the keys are three runs of one key, the runs of the first n keys end at ends[n]
+  std::vector<size_t> ends;
+  for (size_t n = 0; n <= keys.size(); ++n){
+    std::vector<uint8_t> prefix;
+    encodeKeyRuns(std::vector<OcTreeKey>(keys.begin(), keys.begin() + n), prefix);
+    ends.push_back(prefix.size());
+  }
+
+  // every cut keeps only the complete runs before it
+  for (size_t size = 0; size < runs.size(); ++size){
+    std::vector<uint8_t> cut(runs.begin(), runs.begin() + size);
+    std::vector<OcTreeKey> decoded;
+    bool complete = decodeKeyRuns(cut, decoded, keys.size());
+    size_t runsBefore = std::upper_bound(ends.begin(), ends.end(), size) - ends.begin() - 1;
+    EXPECT_EQ(complete, ends[runsBefore] == size) << size;
+    ASSERT_EQ(decoded.size(), runsBefore) << size;
+    EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), keys.begin()));
+  }
+
+  // an unterminated varint
+  std::vector<uint8_t> bad(3, 0xff);
+  std::vector<OcTreeKey> decoded;
+  EXPECT_FALSE(decodeKeyRuns(bad, decoded, 100));
+  EXPECT_TRUE(decoded.empty());
+}
+
+TEST(ChangeEncoding, limits){
+  // more keys than log-odds values, or codes beyond 48 bits, are rejected
+  std::vector<OcTreeKey> keys;
+  for (unsigned code = 0; code < 10; ++code)
+    keys.push_back(mortonKey(code));
+  std::vector<uint8_t> runs;
+  encodeKeyRuns(keys, runs);
+  std::vector<OcTreeKey> decoded;
+  EXPECT_FALSE(decodeKeyRuns(runs, decoded, 5));
+  EXPECT_TRUE(decoded.empty());
+
+  std::vector<uint8_t> beyond;
+  beyond.push_back(0x80); // delta 2^48
+  beyond.push_back(0x80);
+  beyond.push_back(0x80);
+  beyond.push_back(0x80);
+  beyond.push_back(0x80);
+  beyond.push_back(0x80);
+  beyond.push_back(0x40);
+  beyond.push_back(0x00); // length 0
+  decoded.clear();
+  EXPECT_FALSE(decodeKeyRuns(beyond, decoded, 100));
+  EXPECT_TRUE(decoded.empty());
+}
+
+int main(int argc, char** argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
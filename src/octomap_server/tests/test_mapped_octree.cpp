@@ -0,0 +1,145 @@
+/*
+ * Unit tests of the memory-mapped octree files (.mt), compared with the OcTree they were written from.
+ */
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include <octomap/octomap.h>
+#include <octomap_msgs/conversions.h>
+#include <octomap_server/MappedOcTree.h>
+
+using namespace octomap;
+using octomap_server::MappedOcTree;
+
+namespace {
+
+/// deterministic tree with pruned free space and scattered occupied voxels
+void makeTree(OcTree& tree){
+  // a free block that gets pruned into large leaves
+  for (float x = -1.6f; x < 1.6f; x += 0.05f)
+    for (float y = -1.6f; y < 1.6f; y += 0.05f)
+      for (float z = 0.0f; z < 0.8f; z += 0.05f)
+        tree.updateNode(point3d(x, y, z), false);
+
+  unsigned state = 12345;
+  for (int i = 0; i < 2000; ++i){
+    float c[3];
+    for (int j = 0; j < 3; ++j){
+      state = state * 1664525u + 1013904223u;
+      c[j] = ((state >> 8) / float(1 << 24) - 0.5f) * 8.0f;
+    }
+    tree.updateNode(point3d(c[0], c[1], c[2]), true);
+  }
+  tree.updateInnerOccupancy();
+  tree.prune();
+}
+
+std::string tempFile(){
+  char name[] = "/tmp/test_mapped_octreeXXXXXX";
+  int fd = mkstemp(name);
+  if (fd >= 0)
+    close(fd);
+  return name;
+}
+
+/// compare search() with OcTree::search() on a grid around the tree
+void expectSameSearch(const OcTree& tree, const MappedOcTree& mapped){
+  double step = tree.getResolution();
+  size_t known = 0;
+  for (double x = -4.2; x < 4.2; x += 2 * step){
+    for (double y = -4.2; y < 4.2; y += 2 * step){
+      for (double z = -4.2; z < 4.2; z += 4 * step){
+        point3d point(x, y, z);
+        OcTreeNode* node = tree.search(point);
+        bool occupied = false;
+        bool found = mapped.search(point, occupied);
+        ASSERT_EQ(found, node != NULL) << point;
+        if (node){
+          ASSERT_EQ(occupied, tree.isNodeOccupied(node)) << point;
+          ++known;
+        }
+      }
+    }
+  }
+  EXPECT_GT(known, 0u);
+}
+
+}
+
+TEST(MappedOcTree, searchMatchesOctree){
+  OcTree tree(0.1);
+  makeTree(tree);
+  std::string file = tempFile();
+
+  // index down to a coarse and a fine tile depth, and none at all
+  unsigned depths[] = {0, 4, 10, 15};
+  for (unsigned i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i){
+    ASSERT_TRUE(MappedOcTree::write(tree, file, depths[i]));
+    MappedOcTree mapped;
+    ASSERT_TRUE(mapped.open(file));
+    EXPECT_EQ(mapped.getTreeType(), tree.getTreeType());
+    EXPECT_DOUBLE_EQ(mapped.getResolution(), tree.getResolution());
+    expectSameSearch(tree, mapped);
+  }
+  remove(file.c_str());
+}
+
+TEST(MappedOcTree, messagesMatchConversions){
+  OcTree tree(0.05);
+  makeTree(tree);
+  std::string file = tempFile();
+  ASSERT_TRUE(MappedOcTree::write(tree, file));
+  MappedOcTree mapped;
+  ASSERT_TRUE(mapped.open(file));
+
+  octomap_msgs::Octomap expected, msg;
+  ASSERT_TRUE(octomap_msgs::binaryMapToMsg(tree, expected));
+  ASSERT_TRUE(mapped.binaryMapToMsg(msg));
+  EXPECT_EQ(msg.id, expected.id);
+  EXPECT_EQ(msg.binary, expected.binary);
+  EXPECT_DOUBLE_EQ(msg.resolution, expected.resolution);
+  EXPECT_TRUE(msg.data == expected.data);
+
+  ASSERT_TRUE(octomap_msgs::fullMapToMsg(tree, expected));
+  ASSERT_TRUE(mapped.fullMapToMsg(msg));
+  EXPECT_EQ(msg.id, expected.id);
+  EXPECT_EQ(msg.binary, expected.binary);
+  EXPECT_TRUE(msg.data == expected.data);
+  remove(file.c_str());
+}
+
+TEST(MappedOcTree, emptyTree){
+  OcTree tree(0.1);
+  std::string file = tempFile();
+  ASSERT_TRUE(MappedOcTree::write(tree, file));
+  MappedOcTree mapped;
+  ASSERT_TRUE(mapped.open(file));
+  bool occupied = false;
+  EXPECT_FALSE(mapped.search(point3d(0, 0, 0), occupied));
+  EXPECT_EQ(mapped.numTiles(), 0u);
+  remove(file.c_str());
+}
+
+TEST(MappedOcTree, rejectsOtherFiles){
+  std::string file = tempFile();
+  FILE* f = fopen(file.c_str(), "w");
+  ASSERT_TRUE(f != NULL);
+  for (int i = 0; i < 256; ++i)
+    fputc(i, f);
+  fclose(f);
+
+  MappedOcTree mapped;
+  EXPECT_FALSE(mapped.open(file));
+  EXPECT_FALSE(mapped.isOpen());
+  remove(file.c_str());
+}
+
+int main(int argc, char** argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
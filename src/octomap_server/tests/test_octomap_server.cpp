@@ -0,0 +1,329 @@
+/*
+ * Unit tests of OctomapServer: the parallel insertion against the serial one,
+ * and the publishing caches against complete rebuilds. Needs a ROS master (rostest).
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <octomap_server/OctomapServer.h>
+
+using namespace octomap;
+using octomap_server::OctomapServer;
+
+namespace {
+
+typedef OctomapServer::PCLPoint PCLPoint;
+typedef OctomapServer::PCLPointCloud PCLPointCloud;
+
+/// makes the state of the server accessible to the tests
+class TestServer : public OctomapServer {
+public:
+  using OctomapServer::insertScan;
+  using OctomapServer::publishAll;
+  using OctomapServer::updatePublishedCells;
+  using OctomapServer::handlePreNodeTraversal;
+  using OctomapServer::isSpeckleNode;
+  using OctomapServer::m_octree;
+  using OctomapServer::m_insertWorkers;
+  using OctomapServer::m_maxRange;
+  using OctomapServer::m_treeDepth;
+  using OctomapServer::m_publishedCellsValid;
+  using OctomapServer::m_occupiedCellsVis;
+  using OctomapServer::m_freeCellsVis;
+  using OctomapServer::m_columnsValid;
+  using OctomapServer::m_gridmap;
+};
+
+/// a scan and where it was taken from
+struct Scan {
+  tf::Point origin;
+  PCLPointCloud ground;
+  PCLPointCloud nonground;
+};
+
+/**
+ * One revolution of a 16 beam scanner at origin in an 8 m x 8 m room. Rays on the floor
+ * are ground, some rays end early at scattered obstacles, which differ with seed.
+ */
+Scan makeScan(const tf::Point& origin, unsigned seed){
+  Scan scan;
+  scan.origin = origin;
+  unsigned state = seed;
+  for (int ring = 0; ring < 16; ++ring){
+    double elevation = (-15.0 + 2.0 * ring) * M_PI / 180.0;
+    for (int step = 0; step < 720; ++step){
+      double azimuth = (0.5 * step + 0.1 * seed) * M_PI / 180.0;
+      tf::Vector3 dir(cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation));
+
+      // distance to the walls at x, y = +-4 and to the floor
+      double t = std::numeric_limits<double>::max();
+      if (dir.x() != 0.0)
+        t = std::min(t, ((dir.x() > 0.0 ? 4.0 : -4.0) - origin.x()) / dir.x());
+      if (dir.y() != 0.0)
+        t = std::min(t, ((dir.y() > 0.0 ? 4.0 : -4.0) - origin.y()) / dir.y());
+      bool floor = (dir.z() < 0.0 && -origin.z() / dir.z() < t);
+      if (floor)
+        t = -origin.z() / dir.z();
+
+      state = state * 1664525u + 1013904223u;
+      bool obstacle = ((state >> 24) % 16 == 0);
+      if (obstacle)
+        t *= 0.3 + 0.6 * ((state >> 8) & 0xffff) / 65536.0;
+
+      tf::Point end = origin + dir * t;
+      PCLPoint point(end.x(), end.y(), end.z());
+      if (floor && !obstacle)
+        scan.ground.push_back(point);
+      else
+        scan.nonground.push_back(point);
+    }
+  }
+  return scan;
+}
+
+/// scans from several origins, the last one repeats the first with other obstacles
+std::vector<Scan> makeScans(){
+  std::vector<Scan> scans;
+  scans.push_back(makeScan(tf::Point(0.0, 0.0, 0.5), 1));
+  scans.push_back(makeScan(tf::Point(0.65, -0.35, 0.55), 2));
+  scans.push_back(makeScan(tf::Point(-1.2, 0.9, 0.45), 3));
+  scans.push_back(makeScan(tf::Point(0.0, 0.0, 0.5), 4));
+  return scans;
+}
+
+/// the serial insertion OctomapServer::insertScan was written as, with a hashed key set
+void insertSerial(OcTree& tree, const Scan& scan, double maxRange){
+  point3d sensorOrigin(scan.origin.x(), scan.origin.y(), scan.origin.z());
+  KeyRay keyRay;
+  KeySet free_cells, occupied_cells;
+  for (PCLPointCloud::const_iterator it = scan.ground.begin(); it != scan.ground.end(); ++it){
+    point3d point(it->x, it->y, it->z);
+    if ((maxRange > 0.0) && ((point - sensorOrigin).norm() > maxRange))
+      point = sensorOrigin + (point - sensorOrigin).normalized() * maxRange;
+    if (tree.computeRayKeys(sensorOrigin, point, keyRay))
+      free_cells.insert(keyRay.begin(), keyRay.end());
+  }
+
+  for (PCLPointCloud::const_iterator it = scan.nonground.begin(); it != scan.nonground.end(); ++it){
+    point3d point(it->x, it->y, it->z);
+    if ((maxRange < 0.0) || ((point - sensorOrigin).norm() <= maxRange)){
+      if (tree.computeRayKeys(sensorOrigin, point, keyRay))
+        free_cells.insert(keyRay.begin(), keyRay.end());
+      OcTreeKey key;
+      if (tree.coordToKeyChecked(point, key))
+        occupied_cells.insert(key);
+    } else {
+      point3d new_end = sensorOrigin + (point - sensorOrigin).normalized() * maxRange;
+      if (tree.computeRayKeys(sensorOrigin, new_end, keyRay))
+        free_cells.insert(keyRay.begin(), keyRay.end());
+    }
+  }
+
+  // mark free cells only if not seen occupied in this cloud
+  for (KeySet::iterator it = free_cells.begin(), end = free_cells.end(); it != end; ++it){
+    if (occupied_cells.find(*it) == occupied_cells.end())
+      tree.updateNode(*it, false);
+  }
+  for (KeySet::iterator it = occupied_cells.begin(), end = occupied_cells.end(); it != end; ++it)
+    tree.updateNode(*it, true);
+
+  tree.prune();
+}
+
+/// compare two trees node by node, in the order of their tree iterators
+void expectSameTree(const OcTree& expected, const OcTree& actual){
+  ASSERT_EQ(expected.size(), actual.size());
+  OcTree::tree_iterator other = actual.begin_tree();
+  for (OcTree::tree_iterator it = expected.begin_tree(), end = expected.end_tree(); it != end; ++it, ++other){
+    ASSERT_TRUE(other != actual.end_tree());
+    ASSERT_TRUE(it.getKey() == other.getKey());
+    ASSERT_EQ(it.getDepth(), other.getDepth());
+    ASSERT_EQ(it->hasChildren(), other->hasChildren());
+    ASSERT_FLOAT_EQ(it->getLogOdds(), other->getLogOdds());
+  }
+  EXPECT_TRUE(other == actual.end_tree());
+}
+
+/// the speckle test OctomapServer::isSpeckleNode was written as, 26 searches in the tree
+bool searchSpeckle(const OcTree& tree, const OcTreeKey& nKey){
+  OcTreeKey key;
+  for (int dz = -1; dz <= 1; ++dz){
+    for (int dy = -1; dy <= 1; ++dy){
+      for (int dx = -1; dx <= 1; ++dx){
+        key[0] = nKey[0] + dx;
+        key[1] = nKey[1] + dy;
+        key[2] = nKey[2] + dz;
+        if (key != nKey){
+          OcTreeNode* node = tree.search(key);
+          if (node && tree.isNodeOccupied(node))
+            return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+typedef std::pair<double, std::pair<double, double> > Center;
+
+/// cube centers of a marker, sorted
+std::vector<Center> sortedCenters(const visualization_msgs::Marker& marker){
+  std::vector<Center> centers;
+  for (size_t i = 0; i < marker.points.size(); ++i){
+    const geometry_msgs::Point& p = marker.points[i];
+    centers.push_back(std::make_pair(p.x, std::make_pair(p.y, p.z)));
+  }
+  std::sort(centers.begin(), centers.end());
+  return centers;
+}
+
+/// same cubes at each depth, in any order
+void expectSameCubes(const visualization_msgs::MarkerArray& expected, const visualization_msgs::MarkerArray& actual){
+  ASSERT_EQ(expected.markers.size(), actual.markers.size());
+  for (size_t i = 0; i < expected.markers.size(); ++i)
+    EXPECT_TRUE(sortedCenters(expected.markers[i]) == sortedCenters(actual.markers[i])) << "depth " << i;
+}
+
+void expectSameMap(const nav_msgs::OccupancyGrid& expected, const nav_msgs::OccupancyGrid& actual){
+  EXPECT_EQ(expected.info.width, actual.info.width);
+  EXPECT_EQ(expected.info.height, actual.info.height);
+  EXPECT_DOUBLE_EQ(expected.info.origin.position.x, actual.info.origin.position.x);
+  EXPECT_DOUBLE_EQ(expected.info.origin.position.y, actual.info.origin.position.y);
+  EXPECT_TRUE(expected.data == actual.data);
+}
+
+/**
+ * Set the parameters of the next TestServer. They are read from the private namespace,
+ * like the dynamic reconfigure parameters that the previous server left there.
+ */
+void setParams(int insertThreads, bool incrementalPublish, bool projectionCache, bool filterSpeckles,
+               double occupancyMinZ = -100.0, double occupancyMaxZ = 100.0){
+  ros::param::set("~resolution", 0.1);
+  ros::param::set("~sensor_model/max_range", 5.0);
+  ros::param::set("~insert_threads", insertThreads);
+  ros::param::set("~incremental_publish", incrementalPublish);
+  ros::param::set("~projection_cache", projectionCache);
+  ros::param::set("~filter_speckles", filterSpeckles);
+  ros::param::set("~publish_free_space", true);
+  ros::param::set("~occupancy_min_z", occupancyMinZ);
+  ros::param::set("~occupancy_max_z", occupancyMaxZ);
+}
+
+}
+
+TEST(OctomapServer, parallelInsertMatchesSerial){
+  std::vector<Scan> scans = makeScans();
+  for (int threads = 1; threads <= 4; threads += 3){
+    setParams(threads, false, false, false);
+    TestServer server;
+    ASSERT_EQ(size_t(threads), server.m_insertWorkers.size());
+
+    OcTree serial(server.m_octree->getResolution());
+    for (size_t i = 0; i < scans.size(); ++i){
+      server.insertScan(scans[i].origin, scans[i].ground, scans[i].nonground);
+      insertSerial(serial, scans[i], server.m_maxRange);
+      SCOPED_TRACE(testing::Message() << threads << " threads, scan " << i);
+      expectSameTree(serial, *server.m_octree);
+    }
+  }
+}
+
+TEST(OctomapServer, incrementalPublishMatchesRebuild){
+  std::vector<Scan> scans = makeScans();
+  for (int speckles = 0; speckles <= 1; ++speckles){
+    // cubes outside of the height range are tracked, but not drawn
+    setParams(4, true, false, speckles, 0.05, 1.5);
+    TestServer server;
+    for (size_t i = 0; i < scans.size(); ++i){
+      server.insertScan(scans[i].origin, scans[i].ground, scans[i].nonground);
+      server.publishAll();
+      visualization_msgs::MarkerArray occupiedCells = server.m_occupiedCellsVis;
+      visualization_msgs::MarkerArray freeCells = server.m_freeCellsVis;
+
+      server.m_publishedCellsValid = false;
+      server.updatePublishedCells();
+      SCOPED_TRACE(testing::Message() << "speckles " << speckles << ", scan " << i);
+      expectSameCubes(server.m_occupiedCellsVis, occupiedCells);
+      expectSameCubes(server.m_freeCellsVis, freeCells);
+    }
+  }
+}
+
+TEST(OctomapServer, projectionCacheMatchesTree){
+  std::vector<Scan> scans = makeScans();
+
+  // without a height range both count every voxel
+  std::vector<nav_msgs::OccupancyGrid> projected;
+  {
+    setParams(4, false, false, false);
+    TestServer server;
+    for (size_t i = 0; i < scans.size(); ++i){
+      server.insertScan(scans[i].origin, scans[i].ground, scans[i].nonground);
+      server.publishAll();
+      projected.push_back(server.m_gridmap);
+    }
+  }
+
+  setParams(4, false, true, false);
+  TestServer server;
+  for (size_t i = 0; i < scans.size(); ++i){
+    server.insertScan(scans[i].origin, scans[i].ground, scans[i].nonground);
+    server.publishAll();
+    SCOPED_TRACE(testing::Message() << "scan " << i);
+    expectSameMap(projected[i], server.m_gridmap);
+  }
+}
+
+TEST(OctomapServer, projectionCacheMatchesRecount){
+  std::vector<Scan> scans = makeScans();
+  setParams(4, false, true, false, 0.05, 1.5);
+  TestServer server;
+  for (size_t i = 0; i < scans.size(); ++i){
+    server.insertScan(scans[i].origin, scans[i].ground, scans[i].nonground);
+    server.publishAll();
+    nav_msgs::OccupancyGrid updated = server.m_gridmap;
+
+    server.m_columnsValid = false;
+    server.handlePreNodeTraversal(ros::Time::now());
+    SCOPED_TRACE(testing::Message() << "scan " << i);
+    expectSameMap(server.m_gridmap, updated);
+  }
+}
+
+TEST(OctomapServer, speckleCacheMatchesSearch){
+  std::vector<Scan> scans = makeScans();
+  // without incremental publishing the classification is redone after each scan
+  for (int incremental = 0; incremental <= 1; ++incremental){
+    setParams(4, incremental, false, true);
+    TestServer server;
+    size_t numSpeckles = 0, numVoxels = 0;
+    for (size_t i = 0; i < scans.size(); ++i){
+      server.insertScan(scans[i].origin, scans[i].ground, scans[i].nonground);
+      server.publishAll();
+
+      SCOPED_TRACE(testing::Message() << "incremental " << incremental << ", scan " << i);
+      for (OcTree::leaf_iterator it = server.m_octree->begin_leafs(), end = server.m_octree->end_leafs(); it != end; ++it){
+        if (it.getDepth() != server.m_treeDepth || !server.m_octree->isNodeOccupied(*it))
+          continue;
+        bool speckle = searchSpeckle(*server.m_octree, it.getKey());
+        ASSERT_EQ(speckle, server.isSpeckleNode(it.getKey()));
+        numSpeckles += speckle;
+        ++numVoxels;
+      }
+    }
+    EXPECT_GT(numSpeckles, 0u);
+    EXPECT_GT(numVoxels, numSpeckles);
+  }
+}
+
+int main(int argc, char** argv){
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_octomap_server");
+  ros::NodeHandle nh;
+  return RUN_ALL_TESTS();
+}
@@ -34,7 +34,10 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <vector>
 #include <pcap.h>
+#include <time.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 
 #include <ros/ros.h>
@@ -63,6 +66,25 @@ namespace velodyne_driver
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt,
                           const double time_offset) = 0;
 
+    /** @brief Read up to @a npackets Velodyne packets.
+     *
+     * The base class reads a single packet with getPacket().
+     *
+     * @param pkts points to the first of @a npackets VelodynePacket
+     *             messages, filled in order
+     *
+     * @returns number of packets read (0 if none, try again),
+     *          -1 if end of file
+     */
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int npackets, const double time_offset);
+
+    /** @brief Packets lost before they could be read.
+     *
+     * @returns cumulative count, 0 if this input cannot tell
+     */
+    virtual uint32_t droppedPackets() const { return 0; }
+
   protected:
     ros::NodeHandle private_nh_;
     uint16_t port_;
@@ -79,12 +101,35 @@ namespace velodyne_driver
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt, 
                           const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int npackets, const double time_offset);
+    virtual uint32_t droppedPackets() const { return socket_drops_; }
     void setDeviceIP( const std::string& ip );
   private:
+    int waitForInput();
+
+    /** maximum packets received by a single recvmmsg() call */
+    static const int MAX_BATCH = 64;
 
   private:
     int sockfd_;
     in_addr devip_;
+
+    /** batched receive state, used when batch_receive_ is set */
+    bool batch_receive_;                 ///< use recvmmsg()
+    bool kernel_stamps_;                 ///< SO_TIMESTAMPNS enabled
+    uint32_t socket_drops_;              ///< SO_RXQ_OVFL count
+    mmsghdr msgs_[MAX_BATCH];
+    iovec iovecs_[MAX_BATCH];
+    sockaddr_in addrs_[MAX_BATCH];
+    /** ancillary data buffer, msg_control must be cmsghdr aligned */
+    union Control
+    {
+      cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(timespec))
+               + CMSG_SPACE(sizeof(uint32_t))];
+    };
+    Control control_[MAX_BATCH];
   };
 
 
@@ -92,6 +137,11 @@ namespace velodyne_driver
    *
    * Dump files can be grabbed by libpcap, Velodyne's DSR software,
    * ethereal, wireshark, tcpdump, or the \ref vdump_command.
+   *
+   * Classic PCAP files are memory-mapped and their packets indexed
+   * once, so replay can seek by time and hand packets over in batches
+   * without per-packet library calls.  Other formats libpcap reads
+   * (pcapng, for instance) are read one packet at a time.
    */
   class InputPCAP: public Input
   {
@@ -107,18 +157,44 @@ namespace velodyne_driver
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt, 
                           const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int npackets, const double time_offset);
     void setDeviceIP( const std::string& ip );
 
+    /** @brief Continue replay from the first packet captured at least
+     *         @a offset seconds after the first one in the file.
+     *
+     * @returns false if the file is not indexed, or ends before then
+     */
+    bool seek(double offset);
+
   private:
+    bool mapFile();
+    void indexPackets();
+    double packetTime(size_t index) const;
+    ros::WallTime dueTime(size_t index) const;
+
     ros::Rate packet_rate_;
     std::string filename_;
     pcap_t *pcap_;
     bpf_program pcap_packet_filter_;
     char errbuf_[PCAP_ERRBUF_SIZE];
-    bool empty_;
+    bool empty_;                         ///< nothing read since (re)opening
     bool read_once_;
     bool read_fast_;
     double repeat_delay_;
+
+    /** memory-mapped file and its packet index, if indexed */
+    const u_char *map_;
+    size_t map_size_;
+    bool swapped_;                       ///< file byte order differs
+    double time_units_;                  ///< seconds per sub-second tick
+    std::vector<size_t> records_;        ///< offset of each packet record
+    bool monotonic_;                     ///< capture times never decrease
+    size_t next_;                        ///< next packet to return
+    double replay_rate_;                 ///< speed relative to capture, 0: packet_rate_
+    size_t replay_first_;                ///< packet due at replay_start_
+    ros::WallTime replay_start_;
   };
 
 } // velodyne_driver namespace
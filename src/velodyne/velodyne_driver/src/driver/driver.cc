@@ -14,6 +14,8 @@
 
 #include <string>
 #include <cmath>
+#include <algorithm>
+#include <math.h>
 
 #include <ros/ros.h>
 #include <tf/transform_listener.h>
@@ -25,7 +27,15 @@ namespace velodyne_driver
 {
 
 VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
-                               ros::NodeHandle private_nh)
+                               ros::NodeHandle private_nh):
+  capturing_(false),
+  end_of_file_(false),
+  ring_overruns_(0),
+  socket_drops_(0),
+  last_ring_overruns_(0),
+  last_socket_drops_(0),
+  sector_(-1),
+  sector_synced_(false)
 {
   // use private node handle to get parameters
   private_nh.param("frame_id", config_.frame_id, std::string("velodyne"));
@@ -73,7 +83,27 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
   // (fractions rounded up)
   config_.npackets = (int) ceil(packet_rate / frequency);
   private_nh.getParam("npackets", config_.npackets);
-  ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
+
+  // Optionally cut scans where the azimuth crosses cut_angle (and
+  // every sector_angle after that) instead of every npackets.
+  private_nh.param("cut_angle", config_.cut_angle, -1.0);
+  double sector_angle;
+  private_nh.param("sector_angle", sector_angle, 2.0 * M_PI);
+  config_.nsectors = 1;
+  if (config_.cut_angle >= 0.0)
+    {
+      if (sector_angle > 0.0 && sector_angle < 2.0 * M_PI)
+        config_.nsectors = std::max(1, (int) rint(2.0 * M_PI / sector_angle));
+      config_.cut_rotation =
+        ((int) rint(config_.cut_angle * 18000.0 / M_PI)) % ROTATION_UNITS;
+      ROS_INFO("cutting scans at azimuth %.3f (rad), %d sector(s) per "
+               "revolution", config_.cut_angle, config_.nsectors);
+    }
+  else
+    {
+      ROS_INFO_STREAM("publishing " << config_.npackets
+                      << " packets per scan");
+    }
 
   std::string dump_file;
   private_nh.param("pcap", dump_file, std::string(""));
@@ -91,7 +121,8 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
 
   // initialize diagnostics
   diagnostics_.setHardwareID(deviceName);
-  const double diag_freq = packet_rate/config_.npackets;
+  const double diag_freq = (config_.cut_angle >= 0.0)?
+    frequency * config_.nsectors: packet_rate/config_.npackets;
   diag_max_freq_ = diag_freq;
   diag_min_freq_ = diag_freq;
   ROS_INFO("expected frequency: %.3f (Hz)", diag_freq);
@@ -102,6 +133,7 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
                                                              &diag_max_freq_,
                                                              0.1, 10),
                                         TimeStampStatusParam()));
+  diagnostics_.add("Packet capture", this, &VelodyneDriver::captureStatus);
 
   // open Velodyne input device or file
   if (dump_file != "")                  // have PCAP file?
@@ -119,6 +151,74 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
   // raw packet output topic
   output_ =
     node.advertise<velodyne_msgs::VelodyneScan>("velodyne_packets", 10);
+
+  // Packets are read on their own thread, so a slow publish() or
+  // diagnostics update in poll() cannot let the socket buffer overflow.
+  int ring_packets = 4 * config_.npackets;
+  private_nh.param("ring_packets", ring_packets, ring_packets);
+  ring_.reset(new PacketRing(std::max(ring_packets, config_.npackets)));
+  ROS_INFO_STREAM("buffering up to " << ring_->capacity() << " packets");
+  wait_when_full_ = (dump_file != "");
+  capturing_ = true;
+  capture_thread_.reset(new boost::thread(boost::bind
+                                          (&VelodyneDriver::capture, this)));
+}
+
+VelodyneDriver::~VelodyneDriver()
+{
+  capturing_ = false;
+  if (capture_thread_)
+    capture_thread_->join();
+}
+
+/** capture thread main loop: read packets into the ring
+ *
+ *  When poll() falls behind and the ring fills up, live packets are
+ *  still read from the socket, but discarded and counted.
+ */
+void VelodyneDriver::capture(void)
+{
+  while (capturing_)
+    {
+      velodyne_msgs::VelodynePacket *slot;
+      int nfree = ring_->writable(&slot);
+      bool overrun = (nfree == 0);
+      if (overrun)
+        {
+          if (wait_when_full_)
+            {
+              boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+              continue;
+            }
+          slot = &overrun_packet_;
+          nfree = 1;
+        }
+
+      double time_offset;
+      {
+        boost::mutex::scoped_lock lock(config_lock_);
+        time_offset = config_.time_offset;
+      }
+      int rc = input_->getPackets(slot, nfree, time_offset);
+      socket_drops_ = input_->droppedPackets();
+      if (rc < 0)                       // end of file reached?
+        break;
+      if (rc == 0)
+        continue;
+
+      if (overrun)
+        {
+          ring_overruns_ += rc;
+          continue;
+        }
+      ring_->commit(rc);
+      boost::mutex::scoped_lock lock(ready_lock_);
+      packets_ready_.notify_one();
+    }
+
+  boost::mutex::scoped_lock lock(ready_lock_);
+  end_of_file_ = true;
+  packets_ready_.notify_one();
 }
 
 /** poll the device
@@ -129,24 +229,33 @@ bool VelodyneDriver::poll(void)
 {
   // Allocate a new shared pointer for zero-copy sharing with other nodelets.
   velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
-  scan->packets.resize(config_.npackets);
 
-  // Since the velodyne delivers data at a very high rate, keep
-  // reading and publishing scans as fast as possible.
-  for (int i = 0; i < config_.npackets; ++i)
+  if (config_.cut_angle >= 0.0)
     {
-      while (true)
+      if (!assembleSector(*scan))
+        return false;
+    }
+  else
+    {
+      // Assemble the scan from packets read by the capture thread,
+      // waiting for more as needed.
+      scan->packets.resize(config_.npackets);
+      for (int i = 0; i < config_.npackets; )
         {
-          // keep reading until full packet received
-          int rc = input_->getPacket(&scan->packets[i], config_.time_offset);
-          if (rc == 0) break;       // got a full packet?
-          if (rc < 0) return false; // end of file reached?
+          const velodyne_msgs::VelodynePacket *slot;
+          int n;
+          if (!waitForPackets(&slot, &n))
+            return false;
+          n = std::min(n, config_.npackets - i);
+          std::copy(slot, slot + n, scan->packets.begin() + i);
+          ring_->consume(n);
+          i += n;
         }
     }
 
   // publish message using time of last packet read
   ROS_DEBUG("Publishing a full Velodyne scan.");
-  scan->header.stamp = scan->packets[config_.npackets - 1].stamp;
+  scan->header.stamp = scan->packets.back().stamp;
   scan->header.frame_id = config_.frame_id;
   output_.publish(scan);
 
@@ -158,10 +267,120 @@ bool VelodyneDriver::poll(void)
   return true;
 }
 
+/** wait for packets from the capture thread
+ *
+ *  @param slot set to the oldest waiting packet
+ *  @param n set to the number of contiguous packets waiting (> 0)
+ *  @returns false at end of file or shutdown
+ */
+bool VelodyneDriver::waitForPackets(const velodyne_msgs::VelodynePacket **slot,
+                                    int *n)
+{
+  while (true)
+    {
+      bool end_of_file = end_of_file_;
+      *n = ring_->readable(slot);
+      if (*n > 0)
+        return true;
+      if (end_of_file)                  // nothing more coming?
+        return false;
+
+      boost::mutex::scoped_lock lock(ready_lock_);
+      if (ring_->size() == 0 && !end_of_file_)
+        packets_ready_.timed_wait(lock, boost::posix_time::milliseconds(100));
+      if (!ros::ok())
+        return false;
+    }
+}
+
+/** @returns azimuth sector of a packet, from its first block */
+int VelodyneDriver::packetSector(const velodyne_msgs::VelodynePacket &pkt)
+{
+  // blocks start with a 16-bit header, then 16-bit rotation in
+  // hundredths of a degree, both little-endian
+  int rotation = pkt.data[2] | (pkt.data[3] << 8);
+  int offset = (rotation - config_.cut_rotation + ROTATION_UNITS)
+    % ROTATION_UNITS;
+  return offset * config_.nsectors / ROTATION_UNITS;
+}
+
+/** assemble one azimuth-aligned sector of packets
+ *
+ *  Scans start with the first packet past a sector boundary, so the
+ *  seam always falls within one packet of the same azimuth.  Packets
+ *  read before the first boundary are discarded, and a scan is cut
+ *  anyway after two revolutions' worth of packets, in case the
+ *  device stops rotating.
+ *
+ *  @returns false at end of file or shutdown
+ */
+bool VelodyneDriver::assembleSector(velodyne_msgs::VelodyneScan &scan)
+{
+  const size_t max_packets = 2 * config_.npackets;
+  scan.packets.reserve(config_.npackets / config_.nsectors + 1);
+
+  while (true)
+    {
+      const velodyne_msgs::VelodynePacket *slot;
+      int n;
+      if (!waitForPackets(&slot, &n))
+        return false;
+
+      int used = 0;
+      for (; used < n; ++used)
+        {
+          int sector = packetSector(slot[used]);
+          if (sector != sector_)
+            {
+              sector_synced_ = (sector_ >= 0);
+              sector_ = sector;
+              if (!scan.packets.empty())
+                break;                  // starts the next scan
+            }
+          if (sector_synced_)
+            scan.packets.push_back(slot[used]);
+          if (scan.packets.size() >= max_packets)
+            {
+              ++used;
+              break;
+            }
+        }
+      ring_->consume(used);
+
+      if (used < n || scan.packets.size() >= max_packets)
+        return true;
+    }
+}
+
+/** diagnostic task: report packets lost since the last update */
+void VelodyneDriver::captureStatus(diagnostic_updater::DiagnosticStatusWrapper
+                                   &stat)
+{
+  uint64_t ring_overruns = ring_overruns_;
+  uint32_t socket_drops = socket_drops_;
+  uint64_t lost = (ring_overruns - last_ring_overruns_)
+    + (uint32_t) (socket_drops - last_socket_drops_);
+  last_ring_overruns_ = ring_overruns;
+  last_socket_drops_ = socket_drops;
+
+  if (lost > 0)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                  "%lu packets lost since last update",
+                  (unsigned long) lost);
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "No packets lost");
+
+  stat.add("Ring capacity", ring_->capacity());
+  stat.add("Ring packets waiting", ring_->size());
+  stat.add("Ring overruns", ring_overruns);
+  stat.add("Socket drops", socket_drops);
+}
+
 void VelodyneDriver::callback(velodyne_driver::VelodyneNodeConfig &config,
               uint32_t level)
 {
   ROS_INFO("Reconfigure Request");
+  boost::mutex::scoped_lock lock(config_lock_);
   config_.time_offset = config.time_offset;
 }
 
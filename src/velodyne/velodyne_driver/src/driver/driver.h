@@ -16,14 +16,19 @@
 #define _VELODYNE_DRIVER_H_ 1
 
 #include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
 #include <ros/ros.h>
 #include <diagnostic_updater/diagnostic_updater.h>
 #include <diagnostic_updater/publisher.h>
+#include <velodyne_msgs/VelodyneScan.h>
 #include <dynamic_reconfigure/server.h>
 
 #include <velodyne_driver/input.h>
 #include <velodyne_driver/VelodyneNodeConfig.h>
 
+#include "packet_ring.h"
+
 namespace velodyne_driver
 {
 
@@ -33,12 +38,22 @@ public:
 
   VelodyneDriver(ros::NodeHandle node,
                  ros::NodeHandle private_nh);
-  ~VelodyneDriver() {}
+  ~VelodyneDriver();
 
   bool poll(void);
 
 private:
 
+  /// Capture thread: read packets from input_ into ring_
+  void capture(void);
+
+  bool waitForPackets(const velodyne_msgs::VelodynePacket **slot, int *n);
+  int packetSector(const velodyne_msgs::VelodynePacket &pkt);
+  bool assembleSector(velodyne_msgs::VelodyneScan &scan);
+
+  /// Report packet losses through the diagnostic updater
+  void captureStatus(diagnostic_updater::DiagnosticStatusWrapper &stat);
+
   ///Callback for dynamic reconfigure
   void callback(velodyne_driver::VelodyneNodeConfig &config,
               uint32_t level);
@@ -55,11 +70,38 @@ private:
     int    npackets;                 ///< number of packets to collect
     double rpm;                      ///< device rotation rate (RPMs)
     double time_offset;              ///< time in seconds added to each velodyne time stamp
+    double cut_angle;                ///< azimuth where scans start (rad), < 0 to use npackets
+    int cut_rotation;                ///< cut_angle in packet rotation units
+    int nsectors;                    ///< scans per revolution when cutting by azimuth
   } config_;
+  boost::mutex config_lock_;            ///< time_offset is reconfigured while capturing
+
+  /** packet rotation units per revolution (hundredths of a degree) */
+  static const int ROTATION_UNITS = 36000;
 
   boost::shared_ptr<Input> input_;
   ros::Publisher output_;
 
+  /** packets read by the capture thread, waiting for poll() */
+  boost::shared_ptr<PacketRing> ring_;
+  boost::shared_ptr<boost::thread> capture_thread_;
+  boost::atomic<bool> capturing_;       ///< capture thread should run
+  boost::atomic<bool> end_of_file_;     ///< input has no more packets
+  bool wait_when_full_;                 ///< PCAP input: never drop packets
+  boost::mutex ready_lock_;
+  boost::condition_variable packets_ready_;
+  velodyne_msgs::VelodynePacket overrun_packet_; ///< discarded when full
+
+  /** packet loss counters */
+  boost::atomic<uint64_t> ring_overruns_; ///< packets dropped, ring full
+  boost::atomic<uint32_t> socket_drops_;  ///< packets dropped by the kernel
+  uint64_t last_ring_overruns_;
+  uint32_t last_socket_drops_;
+
+  /** azimuth-aligned scan assembly state */
+  int sector_;                          ///< azimuth sector being assembled
+  bool sector_synced_;                  ///< a sector boundary has been seen
+
   /** diagnostics updater */
   diagnostic_updater::Updater diagnostics_;
   double diag_min_freq_;
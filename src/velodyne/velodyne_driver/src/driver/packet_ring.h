@@ -0,0 +1,107 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Lock-free packet ring between the driver capture and assembler
+ *  threads.
+ */
+
+#ifndef _VELODYNE_PACKET_RING_H_
+#define _VELODYNE_PACKET_RING_H_ 1
+
+#include <vector>
+#include <algorithm>
+#include <boost/atomic.hpp>
+
+#include <velodyne_msgs/VelodynePacket.h>
+
+namespace velodyne_driver
+{
+
+/** \brief Single-producer, single-consumer ring of Velodyne packets.
+ *
+ *  All slots are allocated up front.  The producer receives directly
+ *  into free slots and the consumer reads them in place, so packets
+ *  are never copied or allocated on the way through.  Exactly one
+ *  thread may call writable() and commit(), and exactly one other
+ *  thread readable() and consume().
+ */
+class PacketRing
+{
+public:
+
+  PacketRing(size_t capacity):
+    slots_(std::max(capacity, (size_t) 1)),
+    head_(0),
+    tail_(0)
+  {}
+
+  /** @returns capacity in packets */
+  size_t capacity() const { return slots_.size(); }
+
+  /** @returns number of packets waiting to be consumed */
+  size_t size() const
+  {
+    return head_.load(boost::memory_order_acquire)
+      - tail_.load(boost::memory_order_acquire);
+  }
+
+  /** \brief Producer: find free slots.
+   *
+   *  @param slot set to the first free slot
+   *  @returns number of contiguous free slots (0 if the ring is full)
+   */
+  size_t writable(velodyne_msgs::VelodynePacket **slot)
+  {
+    size_t head = head_.load(boost::memory_order_relaxed);
+    size_t tail = tail_.load(boost::memory_order_acquire);
+    size_t index = head % slots_.size();
+    *slot = &slots_[index];
+    return std::min(slots_.size() - (head - tail), slots_.size() - index);
+  }
+
+  /** \brief Producer: publish @a n packets written by writable(). */
+  void commit(size_t n)
+  {
+    head_.store(head_.load(boost::memory_order_relaxed) + n,
+                boost::memory_order_release);
+  }
+
+  /** \brief Consumer: find waiting packets.
+   *
+   *  @param slot set to the oldest waiting packet
+   *  @returns number of contiguous waiting packets (0 if empty)
+   */
+  size_t readable(const velodyne_msgs::VelodynePacket **slot)
+  {
+    size_t tail = tail_.load(boost::memory_order_relaxed);
+    size_t head = head_.load(boost::memory_order_acquire);
+    size_t index = tail % slots_.size();
+    *slot = &slots_[index];
+    return std::min(head - tail, slots_.size() - index);
+  }
+
+  /** \brief Consumer: release @a n packets found by readable(). */
+  void consume(size_t n)
+  {
+    tail_.store(tail_.load(boost::memory_order_relaxed) + n,
+                boost::memory_order_release);
+  }
+
+private:
+
+  std::vector<velodyne_msgs::VelodynePacket> slots_;
+  boost::atomic<size_t> head_;          ///< packets ever committed
+  boost::atomic<size_t> tail_;          ///< packets ever consumed
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_PACKET_RING_H_
@@ -31,6 +31,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include <velodyne_driver/input.h>
 
 namespace velodyne_driver
@@ -38,6 +41,18 @@ namespace velodyne_driver
   static const size_t packet_size =
     sizeof(velodyne_msgs::VelodynePacket().data);
 
+  /** Velodyne data offset in a captured Ethernet frame */
+  static const size_t PACKET_DATA_OFFSET = 42;
+
+  /** packet record header, as stored in a classic PCAP file */
+  struct pcap_record
+  {
+    uint32_t ts_sec;
+    uint32_t ts_subsec;                 ///< microseconds or nanoseconds
+    uint32_t caplen;
+    uint32_t len;
+  };
+
   ////////////////////////////////////////////////////////////////////////
   // Input base class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -57,6 +72,16 @@ namespace velodyne_driver
                       << devip_str_);
   }
 
+  /** @brief Read up to npackets Velodyne packets, one at a time. */
+  int Input::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                        int npackets, const double time_offset)
+  {
+    int rc = getPacket(pkts, time_offset);
+    if (rc < 0)                         // end of file reached?
+      return -1;
+    return (rc == 0)? 1: 0;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputSocket class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -67,9 +92,23 @@ namespace velodyne_driver
    *  @param port UDP port number
    */
   InputSocket::InputSocket(ros::NodeHandle private_nh, uint16_t port):
-    Input(private_nh, port)
+    Input(private_nh, port),
+    kernel_stamps_(false),
+    socket_drops_(0)
   {
     sockfd_ = -1;
+    private_nh.param("batch_receive", batch_receive_, true);
+
+    // Batched receive buffers: everything but the packet data
+    // addresses stays the same from one call to the next.
+    memset(msgs_, 0, sizeof(msgs_));
+    for (int i = 0; i < MAX_BATCH; ++i)
+      {
+        iovecs_[i].iov_len = packet_size;
+        msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+        msgs_[i].msg_hdr.msg_name = &addrs_[i];
+      }
     
     if (!devip_str_.empty()) {
       inet_aton(devip_str_.c_str(),&devip_);
@@ -102,6 +141,28 @@ namespace velodyne_driver
         return;
       }
 
+    // Ask the kernel to time stamp each datagram on arrival.  The
+    // stamps are wall-clock time, so not useful with simulated time.
+    int on = 1;
+    if (batch_receive_ && !ros::Time::isSimTime())
+      {
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS,
+                       &on, sizeof(on)) == 0)
+          kernel_stamps_ = true;
+        else
+          ROS_WARN("SO_TIMESTAMPNS not supported: %s", strerror(errno));
+      }
+
+    // Also ask for the count of datagrams dropped because the socket
+    // receive buffer was full.
+    if (batch_receive_
+        && setsockopt(sockfd_, SOL_SOCKET, SO_RXQ_OVFL,
+                      &on, sizeof(on)) != 0)
+      ROS_WARN("SO_RXQ_OVFL not supported: %s", strerror(errno));
+
+    if (batch_receive_)
+      ROS_INFO("Receiving up to %d packets per system call%s", MAX_BATCH,
+               kernel_stamps_? ", with kernel time stamps": "");
     ROS_DEBUG("Velodyne socket fd is %d\n", sockfd_);
   }
 
@@ -116,11 +177,6 @@ namespace velodyne_driver
   {
     double time1 = ros::Time::now().toSec();
 
-    struct pollfd fds[1];
-    fds[0].fd = sockfd_;
-    fds[0].events = POLLIN;
-    static const int POLL_TIMEOUT = 1000; // one second (in msec)
-
     sockaddr_in sender_address;
     socklen_t sender_address_len = sizeof(sender_address);
 
@@ -144,28 +200,9 @@ namespace velodyne_driver
         //   block.
 
         // poll() until input available
-        do
-          {
-            int retval = poll(fds, 1, POLL_TIMEOUT);
-            if (retval < 0)             // poll() error?
-              {
-                if (errno != EINTR)
-                  ROS_ERROR("poll() error: %s", strerror(errno));
-                return 1;
-              }
-            if (retval == 0)            // poll() timeout?
-              {
-                ROS_WARN("Velodyne poll() timeout");
-                return 1;
-              }
-            if ((fds[0].revents & POLLERR)
-                || (fds[0].revents & POLLHUP)
-                || (fds[0].revents & POLLNVAL)) // device error?
-              {
-                ROS_ERROR("poll() reports Velodyne error");
-                return 1;
-              }
-          } while ((fds[0].revents & POLLIN) == 0);
+        int rc = waitForInput();
+        if (rc != 0)
+          return rc;
 
         // Receive packets that should now be available from the
         // socket using a blocking read.
@@ -207,6 +244,131 @@ namespace velodyne_driver
     return 0;
   }
 
+  /** @brief Wait until the socket has data to read.
+   *
+   *  @returns 0 if input available, 1 on timeout or error
+   */
+  int InputSocket::waitForInput()
+  {
+    struct pollfd fds[1];
+    fds[0].fd = sockfd_;
+    fds[0].events = POLLIN;
+    static const int POLL_TIMEOUT = 1000; // one second (in msec)
+
+    do
+      {
+        int retval = poll(fds, 1, POLL_TIMEOUT);
+        if (retval < 0)             // poll() error?
+          {
+            if (errno != EINTR)
+              ROS_ERROR("poll() error: %s", strerror(errno));
+            return 1;
+          }
+        if (retval == 0)            // poll() timeout?
+          {
+            ROS_WARN("Velodyne poll() timeout");
+            return 1;
+          }
+        if ((fds[0].revents & POLLERR)
+            || (fds[0].revents & POLLHUP)
+            || (fds[0].revents & POLLNVAL)) // device error?
+          {
+            ROS_ERROR("poll() reports Velodyne error");
+            return 1;
+          }
+      } while ((fds[0].revents & POLLIN) == 0);
+    return 0;
+  }
+
+  /** @brief Get up to npackets velodyne packets with one system call.
+   *
+   *  Uses recvmmsg() to read all datagrams already queued on the
+   *  socket (up to MAX_BATCH) directly into the packet messages.
+   *  Falls back to getPacket() when batching is disabled or the
+   *  kernel does not provide recvmmsg().
+   */
+  int InputSocket::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                              int npackets, const double time_offset)
+  {
+    if (!batch_receive_)
+      return Input::getPackets(pkts, npackets, time_offset);
+
+    double time1 = ros::Time::now().toSec();
+
+    // see getPacket() about why poll() comes first
+    if (waitForInput() != 0)
+      return 0;
+
+    int nmsgs = std::min(npackets, (int) MAX_BATCH);
+    for (int i = 0; i < nmsgs; ++i)
+      {
+        iovecs_[i].iov_base = &pkts[i].data[0];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(addrs_[i]);
+        msgs_[i].msg_hdr.msg_control = control_[i].buf;
+        msgs_[i].msg_hdr.msg_controllen = sizeof(control_[i].buf);
+        msgs_[i].msg_hdr.msg_flags = 0;
+      }
+
+    int nrecv = recvmmsg(sockfd_, msgs_, nmsgs, MSG_DONTWAIT, NULL);
+    if (nrecv < 0)
+      {
+        if (errno == ENOSYS)
+          {
+            ROS_WARN("recvmmsg() not available, receiving one packet "
+                     "per system call");
+            batch_receive_ = false;
+          }
+        else if (errno != EWOULDBLOCK && errno != EINTR)
+          ROS_ERROR("recvmmsg() error: %s", strerror(errno));
+        return 0;
+      }
+
+    // stamp packets without a kernel time stamp like getPacket(), in
+    // the middle of waiting and reading
+    double time2 = ros::Time::now().toSec();
+    ros::Time now((time2 + time1) / 2.0);
+    ros::Duration offset(time_offset);
+
+    // keep complete packets from the selected device, in arrival order
+    int npkts = 0;
+    for (int i = 0; i < nrecv; ++i)
+      {
+        ros::Time stamp = now;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs_[i].msg_hdr);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msgs_[i].msg_hdr, cmsg))
+          {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+              continue;
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+              {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                stamp = ros::Time(ts.tv_sec, ts.tv_nsec);
+              }
+            else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+              memcpy(&socket_drops_, CMSG_DATA(cmsg), sizeof(uint32_t));
+          }
+
+        if (msgs_[i].msg_len != packet_size)
+          {
+            ROS_DEBUG_STREAM("incomplete Velodyne packet read: "
+                             << msgs_[i].msg_len << " bytes");
+            continue;
+          }
+        if (devip_str_ != ""
+            && addrs_[i].sin_addr.s_addr != devip_.s_addr)
+          continue;
+
+        if (npkts != i)
+          pkts[npkts].data = pkts[i].data;
+        pkts[npkts].stamp = stamp + offset;
+        ++npkts;
+      }
+
+    return npkts;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputPCAP class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -223,7 +385,14 @@ namespace velodyne_driver
                        bool read_once, bool read_fast, double repeat_delay):
     Input(private_nh, port),
     packet_rate_(packet_rate),
-    filename_(filename)
+    filename_(filename),
+    map_(NULL),
+    map_size_(0),
+    swapped_(false),
+    time_units_(1e-6),
+    monotonic_(true),
+    next_(0),
+    replay_first_(0)
   {
     pcap_ = NULL;  
     empty_ = true;
@@ -232,6 +401,10 @@ namespace velodyne_driver
     private_nh.param("read_once", read_once_, false);
     private_nh.param("read_fast", read_fast_, false);
     private_nh.param("repeat_delay", repeat_delay_, 0.0);
+    // unset: pace at the device's packet rate, like unindexed files
+    private_nh.param("replay_rate", replay_rate_, 0.0);
+    double start_time;
+    private_nh.param("start_time", start_time, 0.0);
 
     if (read_once_)
       ROS_INFO("Read input file only once.");
@@ -243,7 +416,15 @@ namespace velodyne_driver
 
     // Open the PCAP dump file
     ROS_INFO("Opening PCAP file \"%s\"", filename_.c_str());
-    if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
+    if (mapFile())
+      {
+        // only used for the packet filter
+        const pcap_file_header *file = (const pcap_file_header *) map_;
+        int linktype = swapped_? __builtin_bswap32(file->linktype):
+          file->linktype;
+        pcap_ = pcap_open_dead(linktype, 65535);
+      }
+    else if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
       {
         ROS_FATAL("Error opening Velodyne socket dump file.");
         return;
@@ -257,17 +438,278 @@ namespace velodyne_driver
     filter << "udp dst port " << port;
     pcap_compile(pcap_, &pcap_packet_filter_,
                  filter.str().c_str(), 1, PCAP_NETMASK_UNKNOWN);
+
+    if (map_)
+      {
+        indexPackets();
+        if (!read_fast_ && replay_rate_ > 0.0)
+          ROS_INFO("Replay at %.3g times the capture rate.", replay_rate_);
+        else if (!read_fast_)
+          ROS_INFO("Replay at %.1f packets per second.",
+                   1.0 / packet_rate_.expectedCycleTime().toSec());
+        if (start_time > 0.0 && !seek(start_time))
+          ROS_WARN("PCAP file ends before start time %.3f", start_time);
+      }
   }
 
   /** destructor */
   InputPCAP::~InputPCAP(void)
   {
-    pcap_close(pcap_);
+    if (pcap_)
+      pcap_close(pcap_);
+    if (map_)
+      munmap((void *) map_, map_size_);
+  }
+
+  /** @brief Memory-map the dump file, if it is a classic PCAP file.
+   *
+   *  @returns true if mapped
+   */
+  bool InputPCAP::mapFile()
+  {
+    int fd = open(filename_.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(pcap_file_header))
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);                   // the mapping stays valid
+    if (map == MAP_FAILED)
+      return false;
+
+    // the magic number tells byte order and time stamp resolution
+    uint32_t magic = ((const pcap_file_header *) map)->magic;
+    if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1)
+      time_units_ = 1e-6;
+    else if (magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+      time_units_ = 1e-9;
+    else
+      {
+        munmap(map, st.st_size);
+        return false;
+      }
+    swapped_ = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    map_ = (const u_char *) map;
+    map_size_ = st.st_size;
+    return true;
+  }
+
+  /** @brief Index every Velodyne packet in the mapped file.
+   *
+   *  Applies the same selection as reading the file with libpcap:
+   *  when a device IP is set, only packets passing the filter.
+   */
+  void InputPCAP::indexPackets()
+  {
+    size_t offset = sizeof(pcap_file_header);
+    while (offset + sizeof(pcap_record) <= map_size_)
+      {
+        pcap_record rec;
+        memcpy(&rec, map_ + offset, sizeof(rec));
+        if (swapped_)
+          {
+            rec.ts_sec = __builtin_bswap32(rec.ts_sec);
+            rec.ts_subsec = __builtin_bswap32(rec.ts_subsec);
+            rec.caplen = __builtin_bswap32(rec.caplen);
+            rec.len = __builtin_bswap32(rec.len);
+          }
+        const u_char *data = map_ + offset + sizeof(rec);
+        if (data + rec.caplen > map_ + map_size_)
+          break;                        // truncated at the end
+
+        bool keep = (rec.caplen >= PACKET_DATA_OFFSET + packet_size);
+        if (keep && !devip_str_.empty())
+          {
+            pcap_pkthdr header;
+            header.ts.tv_sec = rec.ts_sec;
+            header.ts.tv_usec = rec.ts_subsec;
+            header.caplen = rec.caplen;
+            header.len = rec.len;
+            keep = (0 != pcap_offline_filter(&pcap_packet_filter_,
+                                             &header, data));
+          }
+        if (keep)
+          {
+            if (!records_.empty()
+                && rec.ts_sec + rec.ts_subsec * time_units_
+                   < packetTime(records_.size() - 1))
+              monotonic_ = false;
+            records_.push_back(offset);
+          }
+        offset += sizeof(rec) + rec.caplen;
+      }
+    if (!monotonic_)
+      ROS_WARN("Capture times in %s go backwards, seeking linearly",
+               filename_.c_str());
+
+    ROS_INFO("Indexed %lu Velodyne packets, %.3f seconds",
+             (unsigned long) records_.size(),
+             records_.empty()? 0.0:
+             packetTime(records_.size() - 1) - packetTime(0));
+  }
+
+  /** @returns capture time of an indexed packet (seconds) */
+  double InputPCAP::packetTime(size_t index) const
+  {
+    pcap_record rec;
+    memcpy(&rec, map_ + records_[index], sizeof(rec));
+    if (swapped_)
+      {
+        rec.ts_sec = __builtin_bswap32(rec.ts_sec);
+        rec.ts_subsec = __builtin_bswap32(rec.ts_subsec);
+      }
+    return rec.ts_sec + rec.ts_subsec * time_units_;
+  }
+
+  /** @returns wall time when an indexed packet should be replayed */
+  ros::WallTime InputPCAP::dueTime(size_t index) const
+  {
+    if (replay_rate_ <= 0.0)            // at the device's packet rate
+      return replay_start_
+        + ros::WallDuration((index - replay_first_)
+                            * packet_rate_.expectedCycleTime().toSec());
+
+    return replay_start_
+      + ros::WallDuration((packetTime(index) - packetTime(replay_first_))
+                          / replay_rate_);
+  }
+
+  /** @brief Continue replay from a time offset into the file. */
+  bool InputPCAP::seek(double offset)
+  {
+    if (records_.empty())
+      return false;
+
+    // binary search, unless capture times were found to go backwards
+    double target = packetTime(0) + offset;
+    size_t lo = 0, hi = records_.size();
+    if (monotonic_)
+      {
+        while (lo < hi)
+          {
+            size_t mid = lo + (hi - lo) / 2;
+            if (packetTime(mid) < target)
+              lo = mid + 1;
+            else
+              hi = mid;
+          }
+      }
+    else
+      {
+        while (lo < hi && packetTime(lo) < target)
+          ++lo;
+      }
+    if (lo == records_.size())
+      return false;
+
+    next_ = lo;
+    replay_first_ = lo;
+    replay_start_ = ros::WallTime();    // restart the replay clock
+    return true;
+  }
+
+  /** @brief Get up to npackets velodyne packets from the indexed file.
+   *
+   *  Returns every packet already due at the replay rate, or at the
+   *  device's packet rate if no replay rate is set (or as many as
+   *  requested, when reading fast), copied straight from the
+   *  mapping.  Each packet is stamped with the time it was due.
+   */
+  int InputPCAP::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                            int npackets, const double time_offset)
+  {
+    if (!map_)
+      return Input::getPackets(pkts, npackets, time_offset);
+
+    if (next_ >= records_.size())
+      {
+        if (records_.empty())           // no data in file?
+          {
+            ROS_WARN("No Velodyne packets in %s", filename_.c_str());
+            return -1;
+          }
+
+        if (read_once_)
+          {
+            ROS_INFO("end of file reached -- done reading.");
+            return -1;
+          }
+
+        if (repeat_delay_ > 0.0)
+          {
+            ROS_INFO("end of file reached -- delaying %.3f seconds.",
+                     repeat_delay_);
+            usleep(rint(repeat_delay_ * 1000000.0));
+          }
+
+        ROS_DEBUG("replaying Velodyne dump file");
+        seek(0.0);
+      }
+
+    int n = std::min((size_t) npackets, records_.size() - next_);
+    ros::Time now = ros::Time::now();
+    bool paced = !read_fast_;
+    if (paced)
+      {
+        ros::WallTime wall_now = ros::WallTime::now();
+        if (replay_start_.isZero())
+          replay_start_ = wall_now;
+
+        // wait for the next packet, but not so long the caller
+        // cannot shut down during a gap in the capture
+        ros::WallDuration wait = dueTime(next_) - wall_now;
+        if (wait > ros::WallDuration(0.1))
+          {
+            ros::WallDuration(0.1).sleep();
+            return 0;
+          }
+        if (wait > ros::WallDuration(0.0))
+          {
+            wait.sleep();
+            wall_now = ros::WallTime::now();
+            now = ros::Time::now();
+          }
+
+        // then take every packet that is already due
+        int ready = 1;
+        while (ready < n && dueTime(next_ + ready) <= wall_now)
+          ++ready;
+        n = ready;
+
+        for (int i = 0; i < n; ++i)
+          pkts[i].stamp = now - ros::Duration((wall_now
+                                               - dueTime(next_ + i)).toSec());
+      }
+
+    for (int i = 0; i < n; ++i)
+      {
+        memcpy(&pkts[i].data[0],
+               map_ + records_[next_ + i] + sizeof(pcap_record)
+               + PACKET_DATA_OFFSET,
+               packet_size);
+        if (!paced)
+          pkts[i].stamp = now;
+        // time_offset not considered here, as no synchronization required
+      }
+    next_ += n;
+    return n;
   }
 
   /** @brief Get one velodyne packet. */
   int InputPCAP::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
   {
+    if (map_)
+      {
+        int rc;
+        while ((rc = getPackets(pkt, 1, time_offset)) == 0)
+          continue;
+        return (rc < 0)? -1: 0;
+      }
+
     struct pcap_pkthdr *header;
     const u_char *pkt_data;
 
@@ -14,6 +14,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace velodyne_pointcloud {
 
@@ -51,12 +52,52 @@ namespace velodyne_pointcloud {
     int laser_ring;                        ///< ring number for this laser
   };
 
+  /** \brief Per-laser constants used while unpacking packets.
+   *
+   * Derived from the LaserCorrection values when the calibration file
+   * is read, so the unpack code does no per-return divisions,
+   * branches or map lookups.  Lasers without two-point correction
+   * have zero slopes and offsets, which multiplies the correction out.
+   */
+  struct LaserCoefficients {
+
+    float dist_correction;
+    float cos_vert_correction;
+    float sin_vert_correction;
+    float cos_rot_correction;
+    float sin_rot_correction;
+    float horiz_offset_correction;
+    float xy_offset;                    ///< vert_offset * sin(vert)
+    float z_offset;                     ///< vert_offset * cos(vert)
+
+    /** two-point correction: distance_corr_x = slope_x * |x| + offset_x */
+    float two_pt_slope_x;
+    float two_pt_offset_x;
+    float two_pt_slope_y;
+    float two_pt_offset_y;
+
+    /** intensity: focal_slope * |focal_offset - 256 * (1 - raw/65535)^2| */
+    float focal_offset;
+    float focal_slope;
+    float min_intensity;
+    float max_intensity;
+
+    int laser_ring;                        ///< ring number for this laser
+  };
+
   /** \brief Calibration information for the entire device. */
   class Calibration {
 
   public:
 
     std::map<int, LaserCorrection> laser_corrections;
+
+    /** packed constants indexed by hardware laser number, with at
+     *  least MIN_LASER_COEFFICIENTS entries; lasers missing from the
+     *  file are all zero */
+    std::vector<LaserCoefficients> laser_coefficients;
+    static const int MIN_LASER_COEFFICIENTS = 64;
+
     int num_lasers;
     bool initialized;
     bool ros_info;
@@ -0,0 +1,102 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Recycled point cloud buffers for publishing converted scans.
+ *
+ *  A published cloud is shared with its subscribers (directly, for
+ *  nodelets in the same manager), so it cannot simply be reused for
+ *  the next scan.  The pool keeps a few clouds and hands one out again
+ *  once nobody but the pool holds it, so its point storage and shared
+ *  pointer control block are reused instead of allocated per scan.
+ */
+
+#ifndef __VELODYNE_POINTCLOUD_CLOUD_POOL_H
+#define __VELODYNE_POINTCLOUD_CLOUD_POOL_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace velodyne_pointcloud
+{
+  /** \brief Pool of point clouds, reused once subscribers release them.
+   *
+   *  @param CloudT a pcl::PointCloud type
+   */
+  template <class CloudT>
+  class CloudPool
+  {
+  public:
+
+    typedef boost::shared_ptr<CloudT> CloudPtr;
+
+    /** @param max_clouds number of clouds kept for reuse */
+    CloudPool(size_t max_clouds = 4):
+      max_clouds_(max_clouds)
+    {}
+
+    /** \brief Get an empty cloud with room for @a npoints points.
+     *
+     *  Returns a recycled cloud when one is free, otherwise a new one
+     *  (kept for reuse while the pool has fewer than max_clouds).
+     *  The cloud has no points, width 0 and height 1; its header is
+     *  left for the caller to fill in.
+     */
+    CloudPtr allocate(size_t npoints)
+    {
+      CloudPtr cloud;
+      {
+        boost::mutex::scoped_lock lock(lock_);
+
+        // only the pool holds a cloud once its subscribers are done,
+        // and nothing else can take a new reference to it
+        for (size_t i = 0; i < clouds_.size(); ++i)
+          {
+            if (clouds_[i].unique())
+              {
+                cloud = clouds_[i];
+                break;
+              }
+          }
+
+        if (!cloud)
+          {
+            cloud.reset(new CloudT());
+            if (clouds_.size() < max_clouds_)
+              clouds_.push_back(cloud);
+          }
+      }
+
+      cloud->points.clear();            // keeps the capacity
+      cloud->points.reserve(npoints);
+      cloud->width = 0;
+      cloud->height = 1;
+      cloud->is_dense = true;
+      return cloud;
+    }
+
+    /** @returns number of clouds currently kept for reuse */
+    size_t size()
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      return clouds_.size();
+    }
+
+  private:
+
+    boost::mutex lock_;                 ///< protects clouds_
+    std::vector<CloudPtr> clouds_;
+    size_t max_clouds_;
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // __VELODYNE_POINTCLOUD_CLOUD_POOL_H
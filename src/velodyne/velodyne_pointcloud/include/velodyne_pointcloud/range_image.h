@@ -0,0 +1,74 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Organized range images of Velodyne scans.
+ *
+ *  A velodyne_msgs/VelodyneRangeImage holds one cell per laser ring
+ *  and azimuth bin, with a 16-bit quantized range and 8-bit
+ *  intensity: about three bytes per return instead of the 32 of a
+ *  PointXYZIR, and neighbouring returns are neighbouring cells.
+ *  RawData::setupRangeImage() and RawData::unpack() fill one in; the
+ *  functions here add existing points to one, and convert it back to
+ *  an organized VPointCloud.
+ */
+
+#ifndef __VELODYNE_POINTCLOUD_RANGE_IMAGE_H
+#define __VELODYNE_POINTCLOUD_RANGE_IMAGE_H
+
+#include <math.h>
+#include <velodyne_msgs/VelodyneRangeImage.h>
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_rawdata
+{
+  /** \brief Range image column of a point's azimuth.
+   *
+   *  @param x, y point position in the image's frame
+   *  @param columns number of columns in the image
+   */
+  inline int rangeImageColumn(float x, float y, int columns)
+  {
+    int column = (int) ((atan2f(y, x) + (float) M_PI)
+                        * (columns / (2.0f * (float) M_PI)));
+    if (column >= columns)              // azimuth of exactly pi
+      return columns - 1;
+    return (column < 0)? 0: column;
+  }
+
+  /** \brief Add points to a range image.
+   *
+   *  Where several points fall in the same cell, the nearest is kept.
+   *  Points beyond the largest range the image can hold are dropped.
+   *
+   *  @param points points in the image's frame
+   *  @param npoints number of points
+   *  @param image range image with its size and elevations set up
+   */
+  void addToRangeImage(const VPoint *points, int npoints,
+                       velodyne_msgs::VelodyneRangeImage &image);
+
+  /** \brief Derive an organized point cloud from a range image.
+   *
+   *  The cloud has one row per ring and one column per azimuth bin.
+   *  Each point lies at the centre of its cell's azimuth bin and at
+   *  its ring's elevation, without the per-laser offsets, so the view
+   *  is lossy: positions are only as precise as the image.  Empty
+   *  cells are NaN.
+   *
+   *  @param image range image to convert
+   *  @param pc output cloud, header left unchanged
+   */
+  void rangeImageToCloud(const velodyne_msgs::VelodyneRangeImage &image,
+                         VPointCloud &pc);
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_POINTCLOUD_RANGE_IMAGE_H
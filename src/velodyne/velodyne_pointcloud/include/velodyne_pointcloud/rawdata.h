@@ -29,6 +29,7 @@
 #include <ros/ros.h>
 #include <pcl_ros/point_cloud.h>
 #include <velodyne_msgs/VelodyneScan.h>
+#include <velodyne_msgs/VelodyneRangeImage.h>
 #include <velodyne_pointcloud/point_types.h>
 #include <velodyne_pointcloud/calibration.h>
 
@@ -61,6 +62,10 @@ namespace velodyne_rawdata
   static const float  VLP16_BLOCK_TDURATION   = 110.592f;   // [µs]
   static const float  VLP16_DSR_TOFFSET       =   2.304f;   // [µs]
   static const float  VLP16_FIRING_TOFFSET    =  55.296f;   // [µs]
+
+  /** HDL-32E firing timing, for per-point time stamps **/
+  static const float  HDL32E_BLOCK_TDURATION  =  46.080f;   // [µs]
+  static const float  HDL32E_DSR_TOFFSET      =   1.152f;   // [µs]
   
 
   /** \brief Raw Velodyne data block.
@@ -92,6 +97,7 @@ namespace velodyne_rawdata
   static const int BLOCKS_PER_PACKET = 12;
   static const int PACKET_STATUS_SIZE = 4;
   static const int SCANS_PER_PACKET = (SCANS_PER_BLOCK * BLOCKS_PER_PACKET);
+  static const int LASERS_PER_BANK = SCANS_PER_BLOCK;
 
   /** \brief Raw Velodyne packet.
    *
@@ -112,6 +118,59 @@ namespace velodyne_rawdata
     uint8_t status[PACKET_STATUS_SIZE]; 
   } raw_packet_t;
 
+  /** \brief Block unpack implementations.
+   *
+   *  The block engines convert all 32 returns of a raw_block_t at
+   *  once from structure-of-arrays copies of the laser corrections.
+   *  They produce the same points as the original per-return code,
+   *  within float rounding.
+   */
+  enum UnpackEngine
+  {
+    UNPACK_PER_RETURN = 0,              ///< original per-return code path
+    UNPACK_BLOCK_SCALAR,                ///< portable block engine
+    UNPACK_BLOCK_SSE2,                  ///< SSE2 block engine
+    UNPACK_BLOCK_AVX2,                  ///< AVX2 block engine
+    UNPACK_AUTO                         ///< fastest engine this CPU runs
+  };
+
+  /** \brief Corrections for one 32-laser bank, structure-of-arrays.
+   *
+   *  Transposed from calibration_.laser_coefficients in setup(), so
+   *  the block engines can load the same coefficient for several
+   *  lasers with a single vector instruction.
+   */
+  struct BankCorrections
+  {
+    float dist_correction[LASERS_PER_BANK];
+    float cos_vert_correction[LASERS_PER_BANK];
+    float sin_vert_correction[LASERS_PER_BANK];
+    float cos_rot_correction[LASERS_PER_BANK];
+    float sin_rot_correction[LASERS_PER_BANK];
+    float horiz_offset_correction[LASERS_PER_BANK];
+    float xy_offset[LASERS_PER_BANK];
+    float z_offset[LASERS_PER_BANK];
+    float two_pt_slope_x[LASERS_PER_BANK];
+    float two_pt_offset_x[LASERS_PER_BANK];
+    float two_pt_slope_y[LASERS_PER_BANK];
+    float two_pt_offset_y[LASERS_PER_BANK];
+    float focal_offset[LASERS_PER_BANK];
+    float focal_slope[LASERS_PER_BANK];
+    float min_intensity[LASERS_PER_BANK];
+    float max_intensity[LASERS_PER_BANK];
+    uint16_t laser_ring[LASERS_PER_BANK];
+  };
+
+  /** \brief Converted returns of one block, before range filtering. */
+  struct BlockPoints
+  {
+    float x[LASERS_PER_BANK];
+    float y[LASERS_PER_BANK];
+    float z[LASERS_PER_BANK];
+    float intensity[LASERS_PER_BANK];
+    float distance[LASERS_PER_BANK];    ///< corrected range, for pointInRange()
+  };
+
   /** \brief Velodyne data conversion class */
   class RawData
   {
@@ -146,11 +205,54 @@ namespace velodyne_rawdata
      */
     int setupOffline(std::string calibration_file, double max_range_, double min_range_);
 
-    void unpack(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+    void unpack(const velodyne_msgs::VelodynePacket &pkt,
+                VPointCloud &pc) const;
+
+    /** \brief Unpack one packet into a caller-provided buffer.
+     *
+     *  Does not modify the RawData object, so several threads may
+     *  unpack different packets at once.
+     *
+     *  @param pkt raw packet to unpack
+     *  @param points room for at least SCANS_PER_PACKET points
+     *  @param times if not NULL, room for at least SCANS_PER_PACKET
+     *         firing times, one per point stored [s], relative to the
+     *         packet time stamp (taken as the end of its last firing)
+     *  @returns number of points stored
+     */
+    int unpack(const velodyne_msgs::VelodynePacket &pkt,
+               VPoint *points, float *times = NULL) const;
+
+    /** \brief Set up an empty range image of this device's rings.
+     *
+     *  @param columns number of azimuth bins per revolution
+     *  @param image range image to size and clear
+     */
+    void setupRangeImage(int columns,
+                         velodyne_msgs::VelodyneRangeImage &image) const;
+
+    /** \brief Unpack one packet into a range image.
+     *
+     *  @param pkt raw packet to unpack
+     *  @param image range image from setupRangeImage()
+     */
+    void unpack(const velodyne_msgs::VelodynePacket &pkt,
+                velodyne_msgs::VelodyneRangeImage &image) const;
     
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width);
 
+    /** \brief Select the implementation used by unpack().
+     *
+     *  UNPACK_AUTO picks the fastest block engine the running CPU
+     *  supports.  Requests for an engine that was not compiled in, or
+     *  that this CPU cannot run, fall back to UNPACK_BLOCK_SCALAR.
+     *
+     *  @returns the engine actually selected
+     */
+    UnpackEngine setUnpackEngine(UnpackEngine engine);
+    UnpackEngine getUnpackEngine() const { return engine_; }
+
   private:
 
     /** configuration parameters */
@@ -172,12 +274,40 @@ namespace velodyne_rawdata
     velodyne_pointcloud::Calibration calibration_;
     float sin_rot_table_[ROTATION_MAX_UNITS];
     float cos_rot_table_[ROTATION_MAX_UNITS];
+
+    /** per-bank structure-of-arrays corrections: upper [0], lower [1] */
+    BankCorrections banks_[2];
+
+    /** firing time of each block and each return within a block,
+     *  which add up to a point's time relative to the packet stamp */
+    float block_time_[BLOCKS_PER_PACKET];
+    float return_time_[SCANS_PER_BLOCK];
+    UnpackEngine engine_;
+    void (*unpack_block_)(const BankCorrections &bank,
+                          const raw_block_t &block,
+                          float cos_rot, float sin_rot,
+                          BlockPoints &out);
+
+    void setupBanks();
+    void setupTiming();
+    int unpack_blocks(const raw_packet_t *raw, VPoint *points,
+                      float *times) const;
+    bool angleInRange(int rotation) const
+    {
+      return ((rotation >= config_.min_angle
+               && rotation <= config_.max_angle
+               && config_.min_angle < config_.max_angle)
+              || (config_.min_angle > config_.max_angle
+                  && (rotation <= config_.max_angle
+                      || rotation >= config_.min_angle)));
+    }
     
     /** add private function to handle the VLP16 **/ 
-    void unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+    int unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
+                     VPoint *points, float *times) const;
 
     /** in-line test whether a point is in range */
-    bool pointInRange(float range)
+    bool pointInRange(float range) const
     {
       return (range >= config_.min_range
               && range <= config_.max_range);
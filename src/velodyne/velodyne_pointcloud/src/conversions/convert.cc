@@ -11,24 +11,76 @@
 
     This class converts raw Velodyne 3D LIDAR packets to PointCloud2.
 
+    With ~sector_packets or ~sector_angle set, it instead streams each
+    part of a revolution as soon as its packets arrive, publishing
+    velodyne_msgs/VelodyneSector on velodyne_sectors.  velodyne_points
+    is then not published here; the sector assembler turns the sectors
+    back into full velodyne_points clouds.
+
+    With ~range_image_columns set, each scan is also published as an
+    organized velodyne_msgs/VelodyneRangeImage on velodyne_range_image.
+
 */
 
 #include "convert.h"
 
+#include <math.h>
+#include <algorithm>
+#include <angles/angles.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <velodyne_pointcloud/range_image.h>
 
 namespace velodyne_pointcloud
 {
   /** @brief Constructor. */
   Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh):
-    data_(new velodyne_rawdata::RawData())
+    data_(new velodyne_rawdata::RawData()),
+    workers_(data_),
+    sector_npackets_(0),
+    last_rotation_(0)
   {
     data_->setup(private_nh);
 
+    // stream sectors of this many packets, or of this azimuth width
+    private_nh.param("sector_packets", config_.sector_packets, 0);
+    double sector_angle;
+    private_nh.param("sector_angle", sector_angle, 0.0);
+    config_.nsectors = 0;
+    if (sector_angle > 0.0)
+      {
+        config_.nsectors = std::max(1, (int) round(2.0 * M_PI / sector_angle));
+        config_.sector_packets = 0;     // azimuth takes precedence
+        ROS_INFO_STREAM("streaming " << config_.nsectors
+                        << " sectors per revolution");
+      }
+    else if (config_.sector_packets > 0)
+      {
+        ROS_INFO_STREAM("streaming sectors of " << config_.sector_packets
+                        << " packets");
+      }
 
     // advertise output point cloud (before subscribing to input data)
-    output_ =
-      node.advertise<sensor_msgs::PointCloud2>("velodyne_points", 10);
+    if (config_.nsectors > 0 || config_.sector_packets > 0)
+      {
+        sector_output_ =
+          node.advertise<velodyne_msgs::VelodyneSector>("velodyne_sectors", 10);
+        sector_.sector = 0;
+        sector_.revolution = 0;
+        sector_.nsectors = config_.nsectors;
+        ROS_WARN_STREAM("streaming sectors, velodyne_points is only "
+                        "published by a sector assembler");
+      }
+    else
+      {
+        output_ =
+          node.advertise<sensor_msgs::PointCloud2>("velodyne_points", 10);
+      }
+
+    // optionally publish organized range images, too
+    private_nh.param("range_image_columns", config_.range_image_columns, 0);
+    if (config_.range_image_columns > 0)
+      range_image_output_ = node.advertise<velodyne_msgs::VelodyneRangeImage>
+        ("velodyne_range_image", 10);
       
     srv_ = boost::make_shared <dynamic_reconfigure::Server<velodyne_pointcloud::
       CloudNodeConfig> > (private_nh);
@@ -50,27 +102,47 @@ namespace velodyne_pointcloud
   ROS_INFO("Reconfigure Request");
   data_->setParameters(config.min_range, config.max_range, config.view_direction,
                        config.view_width);
+  workers_.setWorkers(config.workers);
   }
 
   /** @brief Callback for raw scan messages. */
   void Convert::processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
   {
-    if (output_.getNumSubscribers() == 0)         // no one listening?
+    if (sector_output_)
+      processSectors(scanMsg);
+
+    // velodyne_points is not advertised while streaming sectors
+    bool want_points = (output_ && output_.getNumSubscribers() > 0);
+    bool want_image = (range_image_output_
+                       && range_image_output_.getNumSubscribers() > 0);
+    if (!want_points && !want_image)              // no one listening?
       return;                                     // avoid much work
 
-    // allocate a point cloud with same time and frame ID as raw data
-    velodyne_rawdata::VPointCloud::Ptr
-      outMsg(new velodyne_rawdata::VPointCloud());
+    // get a point cloud with room for every return in the scan, and
+    // the same time and frame ID as raw data
+    velodyne_rawdata::VPointCloud::Ptr outMsg =
+      cloud_pool_.allocate(scanMsg->packets.size()
+                           * velodyne_rawdata::SCANS_PER_PACKET);
     // outMsg's header is a pcl::PCLHeader, convert it before stamp assignment
     outMsg->header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
     outMsg->header.frame_id = scanMsg->header.frame_id;
-    outMsg->height = 1;
 
     // process each packet provided by the driver
-    for (size_t i = 0; i < scanMsg->packets.size(); ++i)
+    workers_.unpack(*scanMsg, *outMsg);
+
+    if (want_image)
       {
-        data_->unpack(scanMsg->packets[i], *outMsg);
+        velodyne_msgs::VelodyneRangeImagePtr image
+          (new velodyne_msgs::VelodyneRangeImage);
+        image->header = scanMsg->header;
+        data_->setupRangeImage(config_.range_image_columns, *image);
+        if (!outMsg->points.empty())
+          velodyne_rawdata::addToRangeImage(&outMsg->points[0],
+                                            outMsg->points.size(), *image);
+        range_image_output_.publish(image);
       }
+    if (!want_points)
+      return;
 
     // publish the accumulated cloud message
     ROS_DEBUG_STREAM("Publishing " << outMsg->height * outMsg->width
@@ -78,4 +150,115 @@ namespace velodyne_pointcloud
     output_.publish(outMsg);
   }
 
+  /** @brief Stream a scan's packets out as sectors.
+   *
+   *  Packets are unpacked into the open sector as they arrive.  It is
+   *  published as soon as it is full: after ~sector_packets packets,
+   *  or when the azimuth of the next packet (predicted from the step
+   *  since the previous one) is in the next sector.  Sectors therefore
+   *  do not depend on how the driver groups packets into scans, and
+   *  the last one of a scan is not held back until the next scan.  A
+   *  packet that still belongs to a sector already published (if the
+   *  prediction was off) is sent as a separate part of that sector.
+   */
+  void Convert::processSectors(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
+  {
+    if (sector_output_.getNumSubscribers() == 0) // no one listening?
+      {
+        sector_cloud_.points.clear();             // drop the open sector
+        sector_cloud_.width = 0;
+        sector_npackets_ = 0;
+        return;
+      }
+
+    for (size_t i = 0; i < scanMsg->packets.size(); ++i)
+      {
+        const velodyne_msgs::VelodynePacket &pkt = scanMsg->packets[i];
+        const velodyne_rawdata::raw_packet_t *raw =
+          (const velodyne_rawdata::raw_packet_t *) &pkt.data[0];
+        int rotation = raw->blocks[0].rotation;
+
+        // azimuth falls back by about a turn when passing zero
+        bool wrapped = (rotation + velodyne_rawdata::ROTATION_MAX_UNITS / 2
+                        < last_rotation_);
+        int step = (rotation - last_rotation_
+                    + velodyne_rawdata::ROTATION_MAX_UNITS)
+          % velodyne_rawdata::ROTATION_MAX_UNITS;
+        last_rotation_ = rotation;
+
+        // find this packet's sector
+        uint16_t sector;
+        if (config_.nsectors > 0)
+          {
+            sector = rotation * config_.nsectors
+              / velodyne_rawdata::ROTATION_MAX_UNITS;
+          }
+        else if (wrapped)
+          sector = 0;
+        else if (sector_npackets_ == 0)
+          sector = sector_.sector + 1;  // the previous one is out
+        else
+          sector = sector_.sector;
+
+        if (sector_npackets_ > 0 && (wrapped || sector != sector_.sector))
+          publishSector();
+
+        if (sector_npackets_ == 0)
+          {
+            // open a new sector
+            if (wrapped)
+              ++sector_.revolution;
+            sector_.sector = sector;
+            sector_.header.frame_id = scanMsg->header.frame_id;
+            sector_.start_angle = angles::from_degrees(rotation / 100.0f);
+          }
+
+        data_->unpack(pkt, sector_cloud_);
+        sector_.header.stamp = pkt.stamp;
+        sector_.end_angle = angles::from_degrees(rotation / 100.0f);
+        ++sector_npackets_;
+
+        // publish now if the next packet starts another sector
+        bool full;
+        if (config_.nsectors > 0)
+          {
+            // a step over a quarter turn means packets were lost
+            int next = rotation + step;
+            full = (step > 0 && step < velodyne_rawdata::ROTATION_MAX_UNITS / 4
+                    && (next >= velodyne_rawdata::ROTATION_MAX_UNITS
+                        || next * config_.nsectors
+                           / velodyne_rawdata::ROTATION_MAX_UNITS != sector));
+          }
+        else
+          full = (sector_npackets_ >= config_.sector_packets);
+        if (full)
+          publishSector();
+      }
+  }
+
+  /** @brief Publish the open sector, leaving none open. */
+  void Convert::publishSector(void)
+  {
+    velodyne_msgs::VelodyneSectorPtr msg(new velodyne_msgs::VelodyneSector);
+    msg->header = sector_.header;
+    msg->revolution = sector_.revolution;
+    msg->sector = sector_.sector;
+    msg->nsectors = sector_.nsectors;
+    msg->start_angle = sector_.start_angle;
+    msg->end_angle = sector_.end_angle;
+
+    sector_cloud_.height = 1;
+    pcl::toROSMsg(sector_cloud_, msg->cloud);
+    msg->cloud.header = sector_.header;
+
+    ROS_DEBUG_STREAM("Publishing sector " << msg->sector << " of revolution "
+                     << msg->revolution << ", " << msg->cloud.width
+                     << " points");
+    sector_output_.publish(msg);
+
+    sector_cloud_.points.clear();                 // keeps the capacity
+    sector_cloud_.width = 0;
+    sector_npackets_ = 0;
+  }
+
 } // namespace velodyne_pointcloud
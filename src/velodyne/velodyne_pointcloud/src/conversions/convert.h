@@ -20,7 +20,11 @@
 #include <ros/ros.h>
 
 #include <sensor_msgs/PointCloud2.h>
+#include <velodyne_msgs/VelodyneSector.h>
+#include <velodyne_msgs/VelodyneRangeImage.h>
 #include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/cloud_pool.h>
+#include "unpack_workers.h"
 
 #include <dynamic_reconfigure/server.h>
 #include <velodyne_pointcloud/CloudNodeConfig.h>
@@ -39,20 +43,37 @@ namespace velodyne_pointcloud
     void callback(velodyne_pointcloud::CloudNodeConfig &config,
                 uint32_t level);
     void processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg);
+    void processSectors(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg);
+    void publishSector(void);
 
     ///Pointer to dynamic reconfigure service srv_
     boost::shared_ptr<dynamic_reconfigure::Server<velodyne_pointcloud::
       CloudNodeConfig> > srv_;
     
     boost::shared_ptr<velodyne_rawdata::RawData> data_;
+    UnpackWorkers workers_;
     ros::Subscriber velodyne_scan_;
     ros::Publisher output_;
+    ros::Publisher sector_output_;
+    ros::Publisher range_image_output_;
+
+    /// output clouds, reused once subscribers release them
+    CloudPool<velodyne_rawdata::VPointCloud> cloud_pool_;
 
     /// configuration parameters
     typedef struct {
       int npackets;                    ///< number of packets to combine
+      int sector_packets;              ///< packets per streamed sector
+      int nsectors;                    ///< streamed sectors per revolution
+      int range_image_columns;         ///< range image azimuth bins
     } Config;
     Config config_;
+
+    /// sector streaming state, only used when streaming is enabled
+    velodyne_rawdata::VPointCloud sector_cloud_; ///< points of open sector
+    velodyne_msgs::VelodyneSector sector_;       ///< its metadata, no cloud
+    int sector_npackets_;              ///< packets in open sector
+    int last_rotation_;                ///< azimuth of previous packet
   };
 
 } // namespace velodyne_pointcloud
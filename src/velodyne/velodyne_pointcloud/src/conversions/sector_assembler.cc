@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class assembles streamed Velodyne sectors into full
+    revolution PointCloud2 messages, so consumers of velodyne_points
+    work unchanged when the conversion nodelet streams sectors.
+
+    Sectors of one revolution share its counter.  A revolution is
+    published after its last sector when the number of sectors is
+    known, otherwise when the first sector of the next one arrives.
+    Revolutions missing their first sector are dropped, which only
+    happens at start up.
+
+*/
+
+#include "sector_assembler.h"
+
+namespace velodyne_pointcloud
+{
+  /** @brief Constructor. */
+  SectorAssembler::SectorAssembler(ros::NodeHandle node,
+                                   ros::NodeHandle private_nh):
+    revolution_(0),
+    complete_(false)
+  {
+    // advertise output point cloud (before subscribing to input data)
+    output_ =
+      node.advertise<sensor_msgs::PointCloud2>("velodyne_points", 10);
+
+    // subscribe to VelodyneSector messages
+    input_ =
+      node.subscribe("velodyne_sectors", 10,
+                     &SectorAssembler::processSector, this,
+                     ros::TransportHints().tcpNoDelay(true));
+  }
+
+  /** @brief Callback for streamed sectors. */
+  void SectorAssembler::processSector(const velodyne_msgs::VelodyneSector::ConstPtr &sectorMsg)
+  {
+    if (cloud_ && sectorMsg->revolution != revolution_)
+      publishRevolution();
+
+    const sensor_msgs::PointCloud2 &in = sectorMsg->cloud;
+    if (!cloud_)
+      {
+        // start a revolution, with the sectors' point layout
+        cloud_.reset(new sensor_msgs::PointCloud2);
+        cloud_->header.frame_id = in.header.frame_id;
+        cloud_->height = 1;
+        cloud_->width = 0;
+        cloud_->fields = in.fields;
+        cloud_->is_bigendian = in.is_bigendian;
+        cloud_->point_step = in.point_step;
+        cloud_->is_dense = true;
+        revolution_ = sectorMsg->revolution;
+        complete_ = (sectorMsg->sector == 0);
+      }
+
+    if (in.point_step != cloud_->point_step)
+      {
+        ROS_WARN_STREAM_THROTTLE(10, "sector point layout changed, "
+                                 "dropping revolution " << revolution_);
+        complete_ = false;
+      }
+    else
+      {
+        // sectors are unorganized, so their rows concatenate
+        cloud_->data.insert(cloud_->data.end(), in.data.begin(), in.data.end());
+        cloud_->width += in.width * in.height;
+        cloud_->is_dense = cloud_->is_dense && in.is_dense;
+      }
+    cloud_->header.stamp = sectorMsg->header.stamp;
+
+    if (sectorMsg->nsectors > 0 && sectorMsg->sector + 1 >= sectorMsg->nsectors)
+      publishRevolution();
+  }
+
+  /** @brief Publish the assembled revolution, if it is whole. */
+  void SectorAssembler::publishRevolution(void)
+  {
+    if (complete_ && output_.getNumSubscribers() > 0)
+      {
+        cloud_->row_step = cloud_->width * cloud_->point_step;
+        ROS_DEBUG_STREAM("Publishing " << cloud_->width
+                         << " Velodyne points, time: "
+                         << cloud_->header.stamp);
+        output_.publish(cloud_);
+      }
+    cloud_.reset();
+  }
+
+} // namespace velodyne_pointcloud
@@ -0,0 +1,48 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class assembles streamed Velodyne sectors into full
+    revolution PointCloud2 messages.
+
+*/
+
+#ifndef _VELODYNE_POINTCLOUD_SECTOR_ASSEMBLER_H_
+#define _VELODYNE_POINTCLOUD_SECTOR_ASSEMBLER_H_ 1
+
+#include <ros/ros.h>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <velodyne_msgs/VelodyneSector.h>
+
+namespace velodyne_pointcloud
+{
+  class SectorAssembler
+  {
+  public:
+
+    SectorAssembler(ros::NodeHandle node, ros::NodeHandle private_nh);
+    ~SectorAssembler() {}
+
+  private:
+
+    void processSector(const velodyne_msgs::VelodyneSector::ConstPtr &sectorMsg);
+    void publishRevolution(void);
+
+    ros::Subscriber input_;
+    ros::Publisher output_;
+
+    sensor_msgs::PointCloud2Ptr cloud_; ///< revolution being assembled
+    uint32_t revolution_;               ///< its revolution counter
+    bool complete_;                     ///< started with its first sector
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // _VELODYNE_POINTCLOUD_SECTOR_ASSEMBLER_H_
@@ -0,0 +1,32 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+
+    This ROS node assembles streamed Velodyne sectors into full
+    revolution PointCloud2 messages.
+
+*/
+
+#include <ros/ros.h>
+#include "sector_assembler.h"
+
+/** Main node entry point. */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "sector_assembler_node");
+  ros::NodeHandle node;
+  ros::NodeHandle priv_nh("~");
+
+  // create assembler class, which subscribes to sectors
+  velodyne_pointcloud::SectorAssembler assembler(node, priv_nh);
+
+  // handle callbacks until shut down
+  ros::spin();
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS nodelet assembles streamed Velodyne sectors into full
+    revolution PointCloud2 messages.
+
+*/
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "sector_assembler.h"
+
+namespace velodyne_pointcloud
+{
+  class SectorAssemblerNodelet: public nodelet::Nodelet
+  {
+  public:
+
+    SectorAssemblerNodelet() {}
+    ~SectorAssemblerNodelet() {}
+
+  private:
+
+    virtual void onInit();
+    boost::shared_ptr<SectorAssembler> assembler_;
+  };
+
+  /** @brief Nodelet initialization. */
+  void SectorAssemblerNodelet::onInit()
+  {
+    assembler_.reset(new SectorAssembler(getNodeHandle(),
+                                         getPrivateNodeHandle()));
+  }
+
+} // namespace velodyne_pointcloud
+
+
+// Register this plugin with pluginlib.  Names must match nodelet_velodyne.xml.
+//
+// parameters: package, class name, class type, base class type
+PLUGINLIB_DECLARE_CLASS(velodyne_pointcloud, SectorAssemblerNodelet,
+                        velodyne_pointcloud::SectorAssemblerNodelet, nodelet::Nodelet);
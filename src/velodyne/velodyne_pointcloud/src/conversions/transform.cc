@@ -12,11 +12,17 @@
     This class transforms raw Velodyne 3D LIDAR packets to PointCloud2
     in the /odom frame of reference.
 
+    Each firing is transformed with the sensor pose at the time it was
+    measured, interpolated between the poses at the start and end of
+    the scan, so motion during a revolution does not skew the cloud.
+
     @author Jack O'Quin
     @author Jesse Vera
 
 */
 
+#include <algorithm>
+
 #include "transform.h"
 
 #include <pcl_conversions/pcl_conversions.h>
@@ -59,9 +65,17 @@ namespace velodyne_pointcloud
                          config.view_direction, config.view_width);
     config_.frame_id = tf::resolve(tf_prefix_, config.frame_id);
     ROS_INFO_STREAM("Target frame ID: " << config_.frame_id);
+    config_.deskew = config.deskew;
   }
 
   /** @brief Callback for raw scan messages.
+   *
+   *  All packets are unpacked into the output cloud first, noting the
+   *  time each point was measured, then transformed in place.  Each
+   *  packet is transformed with the sensor pose at its time stamp, as
+   *  before.  When de-skewing, the pose is instead looked up only at the
+   *  start and end of the scan and interpolated for each firing; if
+   *  that fails, the scan falls back to the per-packet poses.
    *
    *  @pre TF message filter has already waited until the transform to
    *       the configured @c frame_id can succeed.
@@ -72,62 +86,103 @@ namespace velodyne_pointcloud
     if (output_.getNumSubscribers() == 0)         // no one listening?
       return;                                     // avoid much work
 
-    // allocate an output point cloud with same time as raw data
+    // allocate an output point cloud with same time as raw data, and
+    // room for every return in the scan
+    size_t npackets = scanMsg->packets.size();
     VPointCloud::Ptr outMsg(new VPointCloud());
     outMsg->header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
     outMsg->header.frame_id = config_.frame_id;
     outMsg->height = 1;
+    outMsg->points.resize(npackets * velodyne_rawdata::SCANS_PER_PACKET);
+    times_.resize(outMsg->points.size());
+    packet_end_.resize(npackets);
+
+    // unpack each packet provided by the driver, in the sensor frame
+    int npoints = 0;
+    float start = 0.0, end = 0.0;       // [s] since first packet stamp
+    for (size_t next = 0; next < npackets; ++next)
+      {
+        const velodyne_msgs::VelodynePacket &pkt = scanMsg->packets[next];
+        float *times = &times_[npoints];
+        int n = data_->unpack(pkt, &outMsg->points[npoints],
+                              config_.deskew ? times : NULL);
+
+        // without de-skewing, each point gets its packet's time
+        float stamp = (pkt.stamp - scanMsg->packets[0].stamp).toSec();
+        for (int i = 0; i < n; ++i)
+          {
+            times[i] = config_.deskew ? times[i] + stamp : stamp;
+            if (npoints + i == 0 || times[i] < start)
+              start = times[i];
+            if (npoints + i == 0 || times[i] > end)
+              end = times[i];
+          }
+        npoints += n;
+        packet_end_[next] = npoints;
+      }
+
+    tf::Transform start_pose, end_pose;
+    bool deskew = (config_.deskew && npoints > 0 &&
+                   lookupPoses(*scanMsg, start, end, start_pose, end_pose));
 
-    // process each packet provided by the driver
-    for (size_t next = 0; next < scanMsg->packets.size(); ++next)
+    // transform the points of each packet into the target frame,
+    // dropping packets without a pose
+    int kept = 0;
+    int begin = 0;
+    for (size_t next = 0; next < npackets; ++next)
       {
-        // clear input point cloud to handle this packet
-        inPc_.points.clear();
-        inPc_.width = 0;
-        inPc_.height = 1;
-        std_msgs::Header header;
-        header.stamp = scanMsg->packets[next].stamp;
-        header.frame_id = scanMsg->header.frame_id;
-        pcl_conversions::toPCL(header, inPc_.header);
-
-        // unpack the raw data
-        data_->unpack(scanMsg->packets[next], inPc_);
-
-        // clear transform point cloud for this packet
-        tfPc_.points.clear();           // is this needed?
-        tfPc_.width = 0;
-        tfPc_.height = 1;
-        header.stamp = scanMsg->packets[next].stamp;
-        pcl_conversions::toPCL(header, tfPc_.header);
-        tfPc_.header.frame_id = config_.frame_id;
-
-        // transform the packet point cloud into the target frame
-        try
+        int stop = packet_end_[next];
+        if (begin == stop)
+          continue;
+
+        float t0 = times_[begin];
+        float t1 = times_[stop - 1];
+        tf::Transform first_pose, last_pose;
+        if (deskew)
           {
-            ROS_DEBUG_STREAM("transforming from " << inPc_.header.frame_id
-                             << " to " << config_.frame_id);
-            pcl_ros::transformPointCloud(config_.frame_id, inPc_, tfPc_,
-                                         listener_);
-#if 0       // use the latest transform available, should usually work fine
-            pcl_ros::transformPointCloud(inPc_.header.frame_id,
-                                         ros::Time(0), inPc_,
-                                         config_.frame_id,
-                                         tfPc_, listener_);
-#endif
+            // interpolate between the first and last firing of the packet
+            float span = end - start;
+            tfScalar a0 = (span > 0.0) ? (t0 - start) / span : 0.0;
+            tfScalar a1 = (span > 0.0) ? (t1 - start) / span : 0.0;
+            first_pose.setRotation(
+              start_pose.getRotation().slerp(end_pose.getRotation(), a0));
+            first_pose.setOrigin(
+              start_pose.getOrigin().lerp(end_pose.getOrigin(), a0));
+            last_pose.setRotation(
+              start_pose.getRotation().slerp(end_pose.getRotation(), a1));
+            last_pose.setOrigin(
+              start_pose.getOrigin().lerp(end_pose.getOrigin(), a1));
           }
-        catch (tf::TransformException &ex)
+        else if (lookupPose(*scanMsg, scanMsg->packets[next].stamp,
+                            first_pose))
           {
-            // only log tf error once every 100 times
-            ROS_WARN_THROTTLE(100, "%s", ex.what());
+            last_pose = first_pose;
+            t1 = t0;
+          }
+        else
+          {
+            begin = stop;
             continue;                   // skip this packet
           }
 
-        // append transformed packet data to end of output message
-        outMsg->points.insert(outMsg->points.end(),
-                             tfPc_.points.begin(),
-                             tfPc_.points.end());
-        outMsg->width += tfPc_.points.size();
+        // a packet spans about a millisecond, so linear is enough
+        float dt = t1 - t0;
+        for (int i = begin; i < stop; ++i)
+          {
+            VPoint &point = outMsg->points[kept++];
+            point = outMsg->points[i];
+            tf::Vector3 in(point.x, point.y, point.z);
+            tf::Vector3 out = first_pose * in;
+            if (dt > 0.0)
+              out = out.lerp(last_pose * in, (times_[i] - t0) / dt);
+            point.x = out.x();
+            point.y = out.y();
+            point.z = out.z();
+          }
+        begin = stop;
       }
+    outMsg->points.resize(kept);
+    outMsg->width = kept;
 
     // publish the accumulated cloud message
     ROS_DEBUG_STREAM("Publishing " << outMsg->height * outMsg->width
@@ -135,4 +190,62 @@ namespace velodyne_pointcloud
     output_.publish(outMsg);
   }
 
+  /** @brief Look up the sensor poses at the start and end of a scan.
+   *
+   *  The firings of the first packet start before its stamp, and TF
+   *  need not have data before the first or after the last packet, so
+   *  the lookup times are clamped to the packet stamps.  The few
+   *  firings outside of them get slightly extrapolated poses.
+   *
+   *  @param scan raw scan message
+   *  @param start time of first firing [s] since the first packet stamp,
+   *         set to the time of start_pose
+   *  @param end time of last firing [s] since the first packet stamp,
+   *         set to the time of end_pose
+   *  @returns true if poses were found
+   */
+  bool Transform::lookupPoses(const velodyne_msgs::VelodyneScan &scan,
+                              float &start, float &end,
+                              tf::Transform &start_pose,
+                              tf::Transform &end_pose)
+  {
+    const ros::Time &first = scan.packets.front().stamp;
+    float last = (scan.packets.back().stamp - first).toSec();
+    start = std::min(std::max(start, 0.0f), last);
+    end = std::min(std::max(end, 0.0f), last);
+    if (!lookupPose(scan, first + ros::Duration(start), start_pose)
+        || !lookupPose(scan, first + ros::Duration(end), end_pose))
+      {
+        ROS_WARN_THROTTLE(100, "no poses to de-skew scan, "
+                          "transforming each packet at its time stamp");
+        return false;
+      }
+    return true;
+  }
+
+  /** @brief Look up the sensor pose in the target frame at time stamp.
+   *
+   *  @returns true if the pose was found
+   */
+  bool Transform::lookupPose(const velodyne_msgs::VelodyneScan &scan,
+                             const ros::Time &stamp, tf::Transform &pose)
+  {
+    try
+      {
+        ROS_DEBUG_STREAM("transforming from " << scan.header.frame_id
+                         << " to " << config_.frame_id);
+        tf::StampedTransform transform;
+        listener_.lookupTransform(config_.frame_id, scan.header.frame_id,
+                                  stamp, transform);
+        pose = transform;
+        return true;
+      }
+    catch (tf::TransformException &ex)
+      {
+        // only log tf error once every 100 times
+        ROS_WARN_THROTTLE(100, "%s", ex.what());
+        return false;
+      }
+  }
+
 } // namespace velodyne_pointcloud
@@ -11,15 +11,18 @@
 /** @file
 
     This class transforms raw Velodyne 3D LIDAR packets to PointCloud2
-    in the /odom frame of reference.
+    in the /odom frame of reference, correcting each point for the
+    motion of the sensor while the revolution was measured.
 
 */
 
 #ifndef _VELODYNE_POINTCLOUD_TRANSFORM_H_
 #define _VELODYNE_POINTCLOUD_TRANSFORM_H_ 1
 
+#include <vector>
 #include <ros/ros.h>
 #include "tf/message_filter.h"
+#include <tf/transform_listener.h>
 #include "message_filters/subscriber.h"
 #include <sensor_msgs/PointCloud2.h>
 
@@ -29,20 +32,10 @@
 #include <dynamic_reconfigure/server.h>
 #include <velodyne_pointcloud/TransformNodeConfig.h>
 
-// include template implementations to transform a custom point cloud
-#include <pcl_ros/impl/transforms.hpp>
-
 /** types of point and cloud to work with */
 typedef velodyne_rawdata::VPoint VPoint;
 typedef velodyne_rawdata::VPointCloud VPointCloud;
 
-// instantiate template for transforming a VPointCloud
-template bool
-  pcl_ros::transformPointCloud<VPoint>(const std::string &,
-                                       const VPointCloud &,
-                                       VPointCloud &,
-                                       const tf::TransformListener &);
-
 namespace velodyne_pointcloud
 {
   class Transform
@@ -55,6 +48,11 @@ namespace velodyne_pointcloud
   private:
 
     void processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg);
+    bool lookupPoses(const velodyne_msgs::VelodyneScan &scan,
+                     float &start, float &end,
+                     tf::Transform &start_pose, tf::Transform &end_pose);
+    bool lookupPose(const velodyne_msgs::VelodyneScan &scan,
+                    const ros::Time &stamp, tf::Transform &pose);
 
     ///Pointer to dynamic reconfigure service srv_
     boost::shared_ptr<dynamic_reconfigure::Server<velodyne_pointcloud::
@@ -72,14 +70,15 @@ namespace velodyne_pointcloud
     /// configuration parameters
     typedef struct {
       std::string frame_id;          ///< target frame ID
+      bool deskew;                   ///< use per-firing time stamps
     } Config;
     Config config_;
 
-    // Point cloud buffers for collecting points within a packet.  The
-    // inPc_ and tfPc_ are class members only to avoid reallocation on
-    // every message.
-    VPointCloud inPc_;              ///< input packet point cloud
-    VPointCloud tfPc_;              ///< transformed packet point cloud
+    // Per-point times [s] since the first packet stamp, and the extent
+    // of each packet's points.  Class members only to avoid
+    // reallocation on every message.
+    std::vector<float> times_;      ///< time of each output point
+    std::vector<int> packet_end_;   ///< index after each packet's points
   };
 
 } // namespace velodyne_pointcloud
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class unpacks the packets of a Velodyne scan on a pool of
+    worker threads.
+
+*/
+
+#include "unpack_workers.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <ros/ros.h>
+
+namespace velodyne_pointcloud
+{
+  using velodyne_rawdata::SCANS_PER_PACKET;
+
+  /** @brief Constructor. */
+  UnpackWorkers::UnpackWorkers(boost::shared_ptr<velodyne_rawdata::RawData>
+                               data):
+    data_(data),
+    nworkers_(1),
+    generation_(0),
+    pending_(0),
+    shutdown_(false),
+    scan_(NULL),
+    slices_(NULL)
+  {}
+
+  UnpackWorkers::~UnpackWorkers()
+  {
+    stopThreads();
+  }
+
+  void UnpackWorkers::setWorkers(int nworkers)
+  {
+    boost::mutex::scoped_lock config_lock(config_lock_);
+    nworkers = std::max(nworkers, 1);
+    if (nworkers == nworkers_)
+      return;
+
+    stopThreads();
+    nworkers_ = nworkers;
+    shutdown_ = false;
+    for (int i = 1; i < nworkers_; ++i)
+      {
+        threads_.push_back(boost::shared_ptr<boost::thread>
+                           (new boost::thread(boost::bind
+                                              (&UnpackWorkers::workerThread,
+                                               this, i, generation_))));
+      }
+    ROS_INFO_STREAM("Converting packets with " << nworkers_ << " threads");
+  }
+
+  void UnpackWorkers::stopThreads()
+  {
+    {
+      boost::mutex::scoped_lock lock(lock_);
+      shutdown_ = true;
+    }
+    work_ready_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+      threads_[i]->join();
+    threads_.clear();
+  }
+
+  /** @brief Unpack all packets of a scan, appending to the cloud.
+   *
+   *  The cloud is grown to hold every possible return before the
+   *  workers start, so they never reallocate it.
+   */
+  void UnpackWorkers::unpack(const velodyne_msgs::VelodyneScan &scan,
+                             velodyne_rawdata::VPointCloud &pc)
+  {
+    boost::mutex::scoped_lock config_lock(config_lock_);
+
+    size_t npackets = scan.packets.size();
+    if (npackets == 0)
+      return;
+
+    size_t size = pc.points.size();
+    pc.points.resize(size + npackets * SCANS_PER_PACKET);
+    counts_.resize(npackets);
+    velodyne_rawdata::VPoint *slices = &pc.points[0] + size;
+
+    if (nworkers_ > 1 && npackets > 1)
+      {
+        {
+          boost::mutex::scoped_lock lock(lock_);
+          scan_ = &scan;
+          slices_ = slices;
+          pending_ = nworkers_ - 1;
+          ++generation_;
+        }
+        work_ready_.notify_all();
+
+        unpackSlice(0);                 // this thread's share
+
+        boost::mutex::scoped_lock lock(lock_);
+        while (pending_ > 0)
+          work_done_.wait(lock);
+        scan_ = NULL;
+        slices_ = NULL;
+      }
+    else
+      {
+        for (size_t i = 0; i < npackets; ++i)
+          counts_[i] = data_->unpack(scan.packets[i],
+                                     slices + i * SCANS_PER_PACKET);
+      }
+
+    // compact the slices in packet order; points only move down
+    size_t npoints = 0;
+    for (size_t i = 0; i < npackets; ++i)
+      {
+        velodyne_rawdata::VPoint *slice = slices + i * SCANS_PER_PACKET;
+        if (slice != slices + npoints)
+          std::copy(slice, slice + counts_[i], slices + npoints);
+        npoints += counts_[i];
+      }
+    pc.points.resize(size + npoints);
+    pc.width += npoints;
+  }
+
+  /** @brief Worker thread: unpack its slice of each new scan. */
+  void UnpackWorkers::workerThread(int worker, unsigned generation)
+  {
+    for (;;)
+      {
+        {
+          boost::mutex::scoped_lock lock(lock_);
+          while (!shutdown_ && generation_ == generation)
+            work_ready_.wait(lock);
+          if (shutdown_)
+            return;
+          generation = generation_;
+        }
+
+        unpackSlice(worker);
+
+        boost::mutex::scoped_lock lock(lock_);
+        if (--pending_ == 0)
+          work_done_.notify_one();
+      }
+  }
+
+  /** @brief Unpack the packets preassigned to one worker. */
+  void UnpackWorkers::unpackSlice(int worker)
+  {
+    size_t npackets = scan_->packets.size();
+    size_t first = npackets * worker / nworkers_;
+    size_t last = npackets * (worker + 1) / nworkers_;
+    for (size_t i = first; i < last; ++i)
+      counts_[i] = data_->unpack(scan_->packets[i],
+                                 slices_ + i * SCANS_PER_PACKET);
+  }
+
+} // namespace velodyne_pointcloud
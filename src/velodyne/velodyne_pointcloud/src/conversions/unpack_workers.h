@@ -0,0 +1,80 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class unpacks the packets of a Velodyne scan on a pool of
+    worker threads.
+
+*/
+
+#ifndef _VELODYNE_POINTCLOUD_UNPACK_WORKERS_H_
+#define _VELODYNE_POINTCLOUD_UNPACK_WORKERS_H_ 1
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_pointcloud
+{
+  /** \brief Packet-parallel scan conversion.
+   *
+   *  Each worker unpacks a fixed, contiguous range of the scan's
+   *  packets, writing packet i into its own slice of
+   *  SCANS_PER_PACKET points.  The slices are then compacted in packet
+   *  order, so the cloud is the same as unpacking serially.
+   */
+  class UnpackWorkers
+  {
+  public:
+
+    UnpackWorkers(boost::shared_ptr<velodyne_rawdata::RawData> data);
+    ~UnpackWorkers();
+
+    /** \brief Set the number of threads converting each scan.
+     *
+     *  One worker is always the calling thread; 1 converts serially.
+     */
+    void setWorkers(int nworkers);
+
+    /** \brief Unpack all packets of @a scan, appending to @a pc. */
+    void unpack(const velodyne_msgs::VelodyneScan &scan,
+                velodyne_rawdata::VPointCloud &pc);
+
+  private:
+
+    void stopThreads();
+    void workerThread(int worker, unsigned generation);
+    void unpackSlice(int worker);
+
+    boost::shared_ptr<velodyne_rawdata::RawData> data_;
+
+    boost::mutex config_lock_;          ///< serializes unpack(), setWorkers()
+    std::vector<boost::shared_ptr<boost::thread> > threads_;
+    int nworkers_;
+
+    boost::mutex lock_;                 ///< protects the job state below
+    boost::condition_variable work_ready_;
+    boost::condition_variable work_done_;
+    unsigned generation_;               ///< incremented for each scan
+    int pending_;                       ///< threads still converting
+    bool shutdown_;
+
+    /// current scan, valid while pending_ > 0
+    const velodyne_msgs::VelodyneScan *scan_;
+    velodyne_rawdata::VPoint *slices_;
+    std::vector<int> counts_;           ///< points unpacked per packet
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // _VELODYNE_POINTCLOUD_UNPACK_WORKERS_H_
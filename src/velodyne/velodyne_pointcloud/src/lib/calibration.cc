@@ -16,6 +16,7 @@
 #include <string>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 #include <yaml-cpp/yaml.h>
 
 #ifdef HAVE_NEW_YAMLCPP
@@ -53,6 +54,52 @@ namespace velodyne_pointcloud
   const std::string FOCAL_DISTANCE = "focal_distance";
   const std::string FOCAL_SLOPE = "focal_slope";
 
+  /** two-point distance correction calibration distances [m] */
+  const float TWO_PT_X_NEAR = 2.4;
+  const float TWO_PT_Y_NEAR = 1.93;
+  const float TWO_PT_FAR = 25.04;
+
+  /** intensity focal distance normalization (HDL-64E S2 manual) */
+  const float FOCAL_DISTANCE_SCALE = 13100;
+
+  const int Calibration::MIN_LASER_COEFFICIENTS;
+
+  /** Derive the packed unpack constants for a single laser. */
+  static LaserCoefficients coefficients(const LaserCorrection &c)
+  {
+    LaserCoefficients k = LaserCoefficients();
+    k.dist_correction = c.dist_correction;
+    k.cos_vert_correction = c.cos_vert_correction;
+    k.sin_vert_correction = c.sin_vert_correction;
+    k.cos_rot_correction = c.cos_rot_correction;
+    k.sin_rot_correction = c.sin_rot_correction;
+    k.horiz_offset_correction = c.horiz_offset_correction;
+    k.xy_offset = c.vert_offset_correction * c.sin_vert_correction;
+    k.z_offset = c.vert_offset_correction * c.cos_vert_correction;
+
+    // Linear interpolation between the near and far distance
+    // corrections, folded into a single multiply-add:
+    //   (dc - dcx) * (xx - near) / (far - near) + dcx - dc
+    if (c.two_pt_correction_available) {
+      k.two_pt_slope_x = (c.dist_correction - c.dist_correction_x)
+        / (TWO_PT_FAR - TWO_PT_X_NEAR);
+      k.two_pt_offset_x = c.dist_correction_x - c.dist_correction
+        - k.two_pt_slope_x * TWO_PT_X_NEAR;
+      k.two_pt_slope_y = (c.dist_correction - c.dist_correction_y)
+        / (TWO_PT_FAR - TWO_PT_Y_NEAR);
+      k.two_pt_offset_y = c.dist_correction_y - c.dist_correction
+        - k.two_pt_slope_y * TWO_PT_Y_NEAR;
+    }
+
+    float focal = 1 - c.focal_distance / FOCAL_DISTANCE_SCALE;
+    k.focal_offset = 256 * focal * focal;
+    k.focal_slope = c.focal_slope;
+    k.min_intensity = c.min_intensity;
+    k.max_intensity = c.max_intensity;
+    k.laser_ring = c.laser_ring;
+    return k;
+  }
+
   /** Read calibration for a single laser. */
   void operator >> (const YAML::Node& node,
                     std::pair<int, LaserCorrection>& correction)
@@ -182,6 +229,20 @@ namespace velodyne_pointcloud
         }
       }
     }
+
+    // Pack the constants the unpack code needs, in hardware laser
+    // order.  The table always covers both HDL-64E banks, so any
+    // laser number a packet can address is a valid index.
+    calibration.laser_coefficients.assign
+      (std::max(num_lasers, Calibration::MIN_LASER_COEFFICIENTS),
+       LaserCoefficients());
+    for (std::map<int, LaserCorrection>::const_iterator
+           it = calibration.laser_corrections.begin();
+         it != calibration.laser_corrections.end(); ++it) {
+      if (it->first >= 0
+          && it->first < (int) calibration.laser_coefficients.size())
+        calibration.laser_coefficients[it->first] = coefficients(it->second);
+    }
   }
 
   YAML::Emitter& operator << (YAML::Emitter& out,
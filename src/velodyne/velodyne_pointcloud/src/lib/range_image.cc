@@ -0,0 +1,94 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Organized range images of Velodyne scans.
+ */
+
+#include <math.h>
+#include <limits>
+#include <vector>
+
+#include <velodyne_pointcloud/range_image.h>
+
+namespace velodyne_rawdata
+{
+  void addToRangeImage(const VPoint *points, int npoints,
+                       velodyne_msgs::VelodyneRangeImage &image)
+  {
+    const float units_per_meter = 1.0f / image.range_resolution;
+
+    for (int i = 0; i < npoints; ++i)
+      {
+        const VPoint &point = points[i];
+        if (point.ring >= image.rings)
+          continue;
+
+        float range = sqrtf(point.x * point.x + point.y * point.y
+                            + point.z * point.z);
+        int units = (int) (range * units_per_meter + 0.5f);
+        if (units <= 0 || units > 65535)
+          continue;
+
+        int column = rangeImageColumn(point.x, point.y, image.columns);
+        size_t cell = (size_t) point.ring * image.columns + column;
+        if (image.range[cell] == 0 || units < image.range[cell])
+          {
+            image.range[cell] = units;
+            float intensity = point.intensity + 0.5f;
+            image.intensity[cell] =
+              (intensity < 0.0f)? 0: (intensity > 255.0f)? 255: intensity;
+          }
+      }
+  }
+
+  void rangeImageToCloud(const velodyne_msgs::VelodyneRangeImage &image,
+                         VPointCloud &pc)
+  {
+    pc.width = image.columns;
+    pc.height = image.rings;
+    pc.is_dense = false;
+    pc.points.resize((size_t) image.rings * image.columns);
+
+    std::vector<float> cos_azimuth(image.columns);
+    std::vector<float> sin_azimuth(image.columns);
+    for (int column = 0; column < image.columns; ++column)
+      {
+        float azimuth = -M_PI + (column + 0.5f) * 2.0f * M_PI / image.columns;
+        cos_azimuth[column] = cosf(azimuth);
+        sin_azimuth[column] = sinf(azimuth);
+      }
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (int ring = 0; ring < image.rings; ++ring)
+      {
+        float cos_elevation = cosf(image.elevation[ring]);
+        float sin_elevation = sinf(image.elevation[ring]);
+        size_t row = (size_t) ring * image.columns;
+        for (int column = 0; column < image.columns; ++column)
+          {
+            VPoint &point = pc.points[row + column];
+            point.ring = ring;
+            point.intensity = image.intensity[row + column];
+            if (image.range[row + column] == 0)
+              {
+                point.x = point.y = point.z = nan;
+                continue;
+              }
+
+            float range = image.range[row + column] * image.range_resolution;
+            float xy_range = range * cos_elevation;
+            point.x = xy_range * cos_azimuth[column];
+            point.y = xy_range * sin_azimuth[column];
+            point.z = range * sin_elevation;
+          }
+      }
+  }
+
+} // namespace velodyne_rawdata
@@ -33,16 +33,24 @@
 #include <angles/angles.h>
 
 #include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/range_image.h>
+#include "unpack_block.h"
 
 namespace velodyne_rawdata
 {
+  static const char *UNPACK_ENGINE_NAMES[] =
+    {"per-return", "block scalar", "block SSE2", "block AVX2", "auto"};
+
   ////////////////////////////////////////////////////////////////////////
   //
   // RawData base class implementation
   //
   ////////////////////////////////////////////////////////////////////////
 
-  RawData::RawData() {}
+  RawData::RawData():
+    engine_(UNPACK_BLOCK_SCALAR),
+    unpack_block_(&unpack_block_scalar)
+  {}
   
   /** Update parameters: conversions and update */
   void RawData::setParameters(double min_range,
@@ -103,7 +111,12 @@ namespace velodyne_rawdata
       cos_rot_table_[rot_index] = cosf(rotation);
       sin_rot_table_[rot_index] = sinf(rotation);
     }
-   return 0;
+
+    setupBanks();
+    setupTiming();
+    setUnpackEngine(UNPACK_AUTO);
+    ROS_INFO_STREAM("Unpack engine: " << UNPACK_ENGINE_NAMES[engine_]);
+    return 0;
   }
 
 
@@ -134,9 +147,134 @@ namespace velodyne_rawdata
 	  cos_rot_table_[rot_index] = cosf(rotation);
 	  sin_rot_table_[rot_index] = sinf(rotation);
       }
+
+      setupBanks();
+      setupTiming();
+      setUnpackEngine(UNPACK_AUTO);
       return 0;
   }
 
+  /** Transpose the HDL bank coefficients into structure-of-arrays. */
+  void RawData::setupBanks()
+  {
+    for (int bank = 0; bank < 2; ++bank)
+      {
+        BankCorrections &b = banks_[bank];
+        for (int j = 0; j < LASERS_PER_BANK; ++j)
+          {
+            const velodyne_pointcloud::LaserCoefficients &c =
+              calibration_.laser_coefficients[j + bank * LASERS_PER_BANK];
+
+            b.dist_correction[j] = c.dist_correction;
+            b.cos_vert_correction[j] = c.cos_vert_correction;
+            b.sin_vert_correction[j] = c.sin_vert_correction;
+            b.cos_rot_correction[j] = c.cos_rot_correction;
+            b.sin_rot_correction[j] = c.sin_rot_correction;
+            b.horiz_offset_correction[j] = c.horiz_offset_correction;
+            b.xy_offset[j] = c.xy_offset;
+            b.z_offset[j] = c.z_offset;
+            b.two_pt_slope_x[j] = c.two_pt_slope_x;
+            b.two_pt_offset_x[j] = c.two_pt_offset_x;
+            b.two_pt_slope_y[j] = c.two_pt_slope_y;
+            b.two_pt_offset_y[j] = c.two_pt_offset_y;
+            b.focal_offset[j] = c.focal_offset;
+            b.focal_slope[j] = c.focal_slope;
+            b.min_intensity[j] = c.min_intensity;
+            b.max_intensity[j] = c.max_intensity;
+            b.laser_ring[j] = c.laser_ring;
+          }
+      }
+  }
+
+  /** Tabulate firing times within a packet for this device.
+   *
+   *  The VLP-16 fires its 16 lasers one after another, twice per
+   *  block, and the HDL-32E its 32 lasers once per block.  HDL-64E
+   *  timing is not modelled: its points all get the packet time.
+   */
+  void RawData::setupTiming()
+  {
+    float block_duration = 0.0;         // [µs]
+    for (int j = 0; j < SCANS_PER_BLOCK; ++j)
+      return_time_[j] = 0.0;
+
+    if (calibration_.num_lasers == 16)
+      {
+        block_duration = VLP16_BLOCK_TDURATION;
+        for (int firing = 0; firing < VLP16_FIRINGS_PER_BLOCK; ++firing)
+          for (int dsr = 0; dsr < VLP16_SCANS_PER_FIRING; ++dsr)
+            return_time_[firing * VLP16_SCANS_PER_FIRING + dsr] =
+              1e-6f * (firing * VLP16_FIRING_TOFFSET
+                       + dsr * VLP16_DSR_TOFFSET);
+      }
+    else if (calibration_.num_lasers == 32)
+      {
+        block_duration = HDL32E_BLOCK_TDURATION;
+        for (int j = 0; j < SCANS_PER_BLOCK; ++j)
+          return_time_[j] = 1e-6f * j * HDL32E_DSR_TOFFSET;
+      }
+
+    // the packet is stamped when it arrives, after its last block
+    for (int i = 0; i < BLOCKS_PER_PACKET; ++i)
+      block_time_[i] = 1e-6f * (i - BLOCKS_PER_PACKET) * block_duration;
+  }
+
+  /** Select the unpack implementation, checking the CPU at run time. */
+  UnpackEngine RawData::setUnpackEngine(UnpackEngine engine)
+  {
+#if defined(HAVE_UNPACK_SSE2) || defined(HAVE_UNPACK_AVX2)
+    __builtin_cpu_init();
+#endif
+
+    if (engine == UNPACK_AUTO)
+      {
+        engine = UNPACK_BLOCK_SCALAR;
+#ifdef HAVE_UNPACK_SSE2
+        if (__builtin_cpu_supports("sse2"))
+          engine = UNPACK_BLOCK_SSE2;
+#endif
+#ifdef HAVE_UNPACK_AVX2
+        if (__builtin_cpu_supports("avx2"))
+          engine = UNPACK_BLOCK_AVX2;
+#endif
+      }
+
+    engine_ = UNPACK_BLOCK_SCALAR;
+    unpack_block_ = &unpack_block_scalar;
+    switch (engine)
+      {
+      case UNPACK_PER_RETURN:
+        engine_ = UNPACK_PER_RETURN;
+        break;
+#ifdef HAVE_UNPACK_SSE2
+      case UNPACK_BLOCK_SSE2:
+        if (__builtin_cpu_supports("sse2"))
+          {
+            engine_ = UNPACK_BLOCK_SSE2;
+            unpack_block_ = &unpack_block_sse2;
+          }
+        break;
+#endif
+#ifdef HAVE_UNPACK_AVX2
+      case UNPACK_BLOCK_AVX2:
+        if (__builtin_cpu_supports("avx2"))
+          {
+            engine_ = UNPACK_BLOCK_AVX2;
+            unpack_block_ = &unpack_block_avx2;
+          }
+        break;
+#endif
+      default:
+        break;
+      }
+
+    if (engine_ != engine)
+      ROS_WARN_STREAM("Unpack engine " << UNPACK_ENGINE_NAMES[engine]
+                      << " not available, using "
+                      << UNPACK_ENGINE_NAMES[engine_]);
+    return engine_;
+  }
+
 
   /** @brief convert raw packet to point cloud
    *
@@ -144,19 +282,72 @@ namespace velodyne_rawdata
    *  @param pc shared pointer to point cloud (points are appended)
    */
   void RawData::unpack(const velodyne_msgs::VelodynePacket &pkt,
-                       VPointCloud &pc)
+                       VPointCloud &pc) const
+  {
+    size_t size = pc.points.size();
+    pc.points.resize(size + SCANS_PER_PACKET);
+    int npoints = unpack(pkt, &pc.points[size]);
+    pc.points.resize(size + npoints);
+    pc.width += npoints;
+  }
+
+  /** @brief set up an empty range image of this device's rings */
+  void RawData::setupRangeImage(int columns,
+                                velodyne_msgs::VelodyneRangeImage &image) const
+  {
+    image.rings = calibration_.num_lasers;
+    image.columns = columns;
+    image.range_resolution = DISTANCE_RESOLUTION;
+    image.elevation.assign(image.rings, 0.0f);
+    for (int i = 0; i < calibration_.num_lasers; ++i)
+      {
+        const velodyne_pointcloud::LaserCoefficients &corrections =
+          calibration_.laser_coefficients[i];
+        if (corrections.laser_ring < image.rings)
+          image.elevation[corrections.laser_ring] =
+            atan2f(corrections.sin_vert_correction,
+                   corrections.cos_vert_correction);
+      }
+    image.range.assign((size_t) image.rings * columns, 0);
+    image.intensity.assign((size_t) image.rings * columns, 0);
+  }
+
+  /** @brief convert raw packet to range image cells */
+  void RawData::unpack(const velodyne_msgs::VelodynePacket &pkt,
+                       velodyne_msgs::VelodyneRangeImage &image) const
+  {
+    VPoint points[SCANS_PER_PACKET];
+    int npoints = unpack(pkt, points);
+    addToRangeImage(points, npoints, image);
+  }
+
+  /** @brief convert raw packet to points in a caller-provided buffer
+   *
+   *  @param pkt raw packet to unpack
+   *  @param points room for at least SCANS_PER_PACKET points
+   *  @param times if not NULL, room for a firing time per point
+   *  @returns number of points stored
+   */
+  int RawData::unpack(const velodyne_msgs::VelodynePacket &pkt,
+                      VPoint *points, float *times) const
   {
     ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
     
     /** special parsing for the VLP16 **/
     if (calibration_.num_lasers == 16)
     {
-      unpack_vlp16(pkt, pc);
-      return;
+      return unpack_vlp16(pkt, points, times);
     }
     
     const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
 
+    if (engine_ != UNPACK_PER_RETURN)
+    {
+      return unpack_blocks(raw, points, times);
+    }
+
+    int npoints = 0;
+
     for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
 
       // upper bank lasers are numbered [0..31]
@@ -174,8 +365,8 @@ namespace velodyne_rawdata
         uint8_t laser_number;       ///< hardware laser number
 
         laser_number = j + bank_origin;
-        velodyne_pointcloud::LaserCorrection &corrections = 
-          calibration_.laser_corrections[laser_number];
+        const velodyne_pointcloud::LaserCoefficients &corrections =
+          calibration_.laser_coefficients[laser_number];
 
         /** Position Calculation */
 
@@ -184,12 +375,7 @@ namespace velodyne_rawdata
         tmp.bytes[1] = raw->blocks[i].data[k+1];
         /*condition added to avoid calculating points which are not
           in the interesting defined area (min_angle < area < max_angle)*/
-        if ((raw->blocks[i].rotation >= config_.min_angle 
-             && raw->blocks[i].rotation <= config_.max_angle 
-             && config_.min_angle < config_.max_angle)
-             ||(config_.min_angle > config_.max_angle 
-             && (raw->blocks[i].rotation <= config_.max_angle 
-             || raw->blocks[i].rotation >= config_.min_angle))){
+        if (angleInRange(raw->blocks[i].rotation)) {
           float distance = tmp.uint * DISTANCE_RESOLUTION;
           distance += corrections.dist_correction;
   
@@ -208,14 +394,13 @@ namespace velodyne_rawdata
             cos_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
   
           float horiz_offset = corrections.horiz_offset_correction;
-          float vert_offset = corrections.vert_offset_correction;
   
           // Compute the distance in the xy plane (w/o accounting for rotation)
           /**the new term of 'vert_offset * sin_vert_angle'
            * was added to the expression due to the mathemathical
            * model we used.
            */
-          float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
+          float xy_distance = distance * cos_vert_angle - corrections.xy_offset;
   
           // Calculate temporal X, use absolute value.
           float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
@@ -226,33 +411,24 @@ namespace velodyne_rawdata
     
           // Get 2points calibration values,Linear interpolation to get distance
           // correction for X and Y, that means distance correction use
-          // different value at different distance
-          float distance_corr_x = 0;
-          float distance_corr_y = 0;
-          if (corrections.two_pt_correction_available) {
-            distance_corr_x = 
-              (corrections.dist_correction - corrections.dist_correction_x)
-                * (xx - 2.4) / (25.04 - 2.4) 
-              + corrections.dist_correction_x;
-            distance_corr_x -= corrections.dist_correction;
-            distance_corr_y = 
-              (corrections.dist_correction - corrections.dist_correction_y)
-                * (yy - 1.93) / (25.04 - 1.93)
-              + corrections.dist_correction_y;
-            distance_corr_y -= corrections.dist_correction;
-          }
+          // different value at different distance (zero slope and
+          // offset for lasers without two-point calibration)
+          float distance_corr_x =
+            corrections.two_pt_slope_x * xx + corrections.two_pt_offset_x;
+          float distance_corr_y =
+            corrections.two_pt_slope_y * yy + corrections.two_pt_offset_y;
   
           float distance_x = distance + distance_corr_x;
           /**the new term of 'vert_offset * sin_vert_angle'
            * was added to the expression due to the mathemathical
            * model we used.
            */
-          xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle ;
+          xy_distance = distance_x * cos_vert_angle - corrections.xy_offset;
           ///the expression wiht '-' is proved to be better than the one with '+'
           x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
   
           float distance_y = distance + distance_corr_y;
-          xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle ;
+          xy_distance = distance_y * cos_vert_angle - corrections.xy_offset;
           /**the new term of 'vert_offset * sin_vert_angle'
            * was added to the expression due to the mathemathical
            * model we used.
@@ -265,7 +441,7 @@ namespace velodyne_rawdata
            * was added to the expression due to the mathemathical
            * model we used.
            */
-          z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
+          z = distance_y * sin_vert_angle + corrections.z_offset;
   
           /** Use standard ROS coordinate system (right-hand rule) */
           float x_coord = y;
@@ -273,20 +449,14 @@ namespace velodyne_rawdata
           float z_coord = z;
   
           /** Intensity Calculation */
-  
-          float min_intensity = corrections.min_intensity;
-          float max_intensity = corrections.max_intensity;
-  
           intensity = raw->blocks[i].data[k+2];
-  
-          float focal_offset = 256 
-                             * (1 - corrections.focal_distance / 13100) 
-                             * (1 - corrections.focal_distance / 13100);
-          float focal_slope = corrections.focal_slope;
-          intensity += focal_slope * (abs(focal_offset - 256 * 
-            (1 - static_cast<float>(tmp.uint)/65535)*(1 - static_cast<float>(tmp.uint)/65535)));
-          intensity = (intensity < min_intensity) ? min_intensity : intensity;
-          intensity = (intensity > max_intensity) ? max_intensity : intensity;
+          float range_scale = 1 - static_cast<float>(tmp.uint)/65535;
+          intensity += corrections.focal_slope
+            * fabsf(corrections.focal_offset - 256 * range_scale * range_scale);
+          intensity = (intensity < corrections.min_intensity) ?
+            corrections.min_intensity : intensity;
+          intensity = (intensity > corrections.max_intensity) ?
+            corrections.max_intensity : intensity;
   
           if (pointInRange(distance)) {
   
@@ -299,22 +469,75 @@ namespace velodyne_rawdata
             point.intensity = intensity;
   
             // append this point to the cloud
-            pc.points.push_back(point);
-            ++pc.width;
+            if (times)
+              times[npoints] = block_time_[i] + return_time_[j];
+            points[npoints++] = point;
           }
         }
       }
     }
+    return npoints;
   }
   
+  /** @brief convert raw HDL packet to point cloud, one block at a time
+   *
+   *  Same result as the per-return loop in unpack(), but each block
+   *  is converted by the selected block engine before range filtering.
+   *
+   *  @param raw raw packet to unpack
+   *  @param points room for at least SCANS_PER_PACKET points
+   *  @param times if not NULL, room for a firing time per point
+   *  @returns number of points stored
+   */
+  int RawData::unpack_blocks(const raw_packet_t *raw, VPoint *points,
+                             float *times) const
+  {
+    BlockPoints out;
+    int npoints = 0;
+
+    for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
+
+      const raw_block_t &block = raw->blocks[i];
+      if (!angleInRange(block.rotation))
+        continue;
+
+      // upper bank lasers are [0..31], lower bank lasers are [32..63]
+      const BankCorrections &bank =
+        banks_[(block.header == LOWER_BANK) ? 1 : 0];
+      unpack_block_(bank, block,
+                    cos_rot_table_[block.rotation],
+                    sin_rot_table_[block.rotation],
+                    out);
+
+      for (int j = 0; j < LASERS_PER_BANK; j++) {
+        if (pointInRange(out.distance[j])) {
+          VPoint point;
+          point.ring = bank.laser_ring[j];
+          point.x = out.x[j];
+          point.y = out.y[j];
+          point.z = out.z[j];
+          point.intensity = out.intensity[j];
+
+          if (times)
+            times[npoints] = block_time_[i] + return_time_[j];
+          points[npoints++] = point;
+        }
+      }
+    }
+    return npoints;
+  }
+
   /** @brief convert raw VLP16 packet to point cloud
    *
    *  @param pkt raw packet to unpack
-   *  @param pc shared pointer to point cloud (points are appended)
+   *  @param points room for at least SCANS_PER_PACKET points
+   *  @param times if not NULL, room for a firing time per point
+   *  @returns number of points stored
    */
-  void RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
-                             VPointCloud &pc)
+  int RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
+                            VPoint *points, float *times) const
   {
+    int npoints = 0;
     float azimuth;
     float azimuth_diff;
     float last_azimuth_diff=0;
@@ -334,7 +557,7 @@ namespace velodyne_rawdata
         ROS_WARN_STREAM_THROTTLE(60, "skipping invalid VLP-16 packet: block "
                                  << block << " header value is "
                                  << raw->blocks[block].header);
-        return;                         // bad packet: skip the rest
+        return npoints;                 // bad packet: skip the rest
       }
 
       // Calculate difference between current and next block's azimuth angle.
@@ -348,8 +571,8 @@ namespace velodyne_rawdata
 
       for (int firing=0, k=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
         for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++, k+=RAW_SCAN_SIZE){
-          velodyne_pointcloud::LaserCorrection &corrections = 
-            calibration_.laser_corrections[dsr];
+          const velodyne_pointcloud::LaserCoefficients &corrections =
+            calibration_.laser_coefficients[dsr];
 
           /** Position Calculation */
           union two_bytes tmp;
@@ -362,12 +585,7 @@ namespace velodyne_rawdata
           
           /*condition added to avoid calculating points which are not
             in the interesting defined area (min_angle < area < max_angle)*/
-          if ((azimuth_corrected >= config_.min_angle 
-               && azimuth_corrected <= config_.max_angle 
-               && config_.min_angle < config_.max_angle)
-               ||(config_.min_angle > config_.max_angle 
-               && (azimuth_corrected <= config_.max_angle 
-               || azimuth_corrected >= config_.min_angle))){
+          if (angleInRange(azimuth_corrected)) {
 
             // convert polar coordinates to Euclidean XYZ
             float distance = tmp.uint * DISTANCE_RESOLUTION;
@@ -388,14 +606,13 @@ namespace velodyne_rawdata
               cos_rot_table_[azimuth_corrected] * sin_rot_correction;
     
             float horiz_offset = corrections.horiz_offset_correction;
-            float vert_offset = corrections.vert_offset_correction;
     
             // Compute the distance in the xy plane (w/o accounting for rotation)
             /**the new term of 'vert_offset * sin_vert_angle'
              * was added to the expression due to the mathemathical
              * model we used.
              */
-            float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
+            float xy_distance = distance * cos_vert_angle - corrections.xy_offset;
     
             // Calculate temporal X, use absolute value.
             float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
@@ -406,28 +623,19 @@ namespace velodyne_rawdata
       
             // Get 2points calibration values,Linear interpolation to get distance
             // correction for X and Y, that means distance correction use
-            // different value at different distance
-            float distance_corr_x = 0;
-            float distance_corr_y = 0;
-            if (corrections.two_pt_correction_available) {
-              distance_corr_x = 
-                (corrections.dist_correction - corrections.dist_correction_x)
-                  * (xx - 2.4) / (25.04 - 2.4) 
-                + corrections.dist_correction_x;
-              distance_corr_x -= corrections.dist_correction;
-              distance_corr_y = 
-                (corrections.dist_correction - corrections.dist_correction_y)
-                  * (yy - 1.93) / (25.04 - 1.93)
-                + corrections.dist_correction_y;
-              distance_corr_y -= corrections.dist_correction;
-            }
+            // different value at different distance (zero slope and
+            // offset for lasers without two-point calibration)
+            float distance_corr_x =
+              corrections.two_pt_slope_x * xx + corrections.two_pt_offset_x;
+            float distance_corr_y =
+              corrections.two_pt_slope_y * yy + corrections.two_pt_offset_y;
     
             float distance_x = distance + distance_corr_x;
             /**the new term of 'vert_offset * sin_vert_angle'
              * was added to the expression due to the mathemathical
              * model we used.
              */
-            xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle ;
+            xy_distance = distance_x * cos_vert_angle - corrections.xy_offset;
             x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
     
             float distance_y = distance + distance_corr_y;
@@ -435,7 +643,7 @@ namespace velodyne_rawdata
              * was added to the expression due to the mathemathical
              * model we used.
              */
-            xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle ;
+            xy_distance = distance_y * cos_vert_angle - corrections.xy_offset;
             y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
     
             // Using distance_y is not symmetric, but the velodyne manual
@@ -444,7 +652,7 @@ namespace velodyne_rawdata
              * was added to the expression due to the mathemathical
              * model we used.
              */
-            z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
+            z = distance_y * sin_vert_angle + corrections.z_offset;
   
     
             /** Use standard ROS coordinate system (right-hand rule) */
@@ -453,19 +661,14 @@ namespace velodyne_rawdata
             float z_coord = z;
     
             /** Intensity Calculation */
-            float min_intensity = corrections.min_intensity;
-            float max_intensity = corrections.max_intensity;
-    
             intensity = raw->blocks[block].data[k+2];
-    
-            float focal_offset = 256 
-                               * (1 - corrections.focal_distance / 13100) 
-                               * (1 - corrections.focal_distance / 13100);
-            float focal_slope = corrections.focal_slope;
-            intensity += focal_slope * (abs(focal_offset - 256 * 
-              (1 - tmp.uint/65535)*(1 - tmp.uint/65535)));
-            intensity = (intensity < min_intensity) ? min_intensity : intensity;
-            intensity = (intensity > max_intensity) ? max_intensity : intensity;
+            float range_scale = 1 - static_cast<float>(tmp.uint)/65535;
+            intensity += corrections.focal_slope
+              * fabsf(corrections.focal_offset - 256 * range_scale * range_scale);
+            intensity = (intensity < corrections.min_intensity) ?
+              corrections.min_intensity : intensity;
+            intensity = (intensity > corrections.max_intensity) ?
+              corrections.max_intensity : intensity;
     
             if (pointInRange(distance)) {
     
@@ -477,13 +680,16 @@ namespace velodyne_rawdata
               point.z = z_coord;
               point.intensity = intensity;
 
-              pc.points.push_back(point);
-              ++pc.width;
+              if (times)
+                times[npoints] = block_time_[block]
+                  + return_time_[firing * VLP16_SCANS_PER_FIRING + dsr];
+              points[npoints++] = point;
             }
           }
         }
       }
     }
+    return npoints;
   }  
 
 } // namespace velodyne_rawdata
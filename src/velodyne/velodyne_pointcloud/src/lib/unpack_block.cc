@@ -0,0 +1,84 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Portable block unpack engine.
+ *
+ *  Written as independent per-lane loops over the structure-of-arrays
+ *  corrections, so the compiler may vectorize it for whatever target
+ *  the package is built for.
+ */
+
+#include <math.h>
+
+#include "unpack_block.h"
+
+namespace velodyne_rawdata
+{
+  void unpack_block_scalar(const BankCorrections &bank,
+                           const raw_block_t &block,
+                           float cos_rot, float sin_rot,
+                           BlockPoints &out)
+  {
+    float raw_distance[LASERS_PER_BANK];
+    float raw_intensity[LASERS_PER_BANK];
+    split_block(block, raw_distance, raw_intensity);
+
+    for (int j = 0; j < LASERS_PER_BANK; j++)
+      {
+        float distance = raw_distance[j] * DISTANCE_RESOLUTION
+          + bank.dist_correction[j];
+
+        float cos_vert_angle = bank.cos_vert_correction[j];
+        float sin_vert_angle = bank.sin_vert_correction[j];
+        float horiz_offset = bank.horiz_offset_correction[j];
+
+        // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+        // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+        float cos_rot_angle = cos_rot * bank.cos_rot_correction[j]
+          + sin_rot * bank.sin_rot_correction[j];
+        float sin_rot_angle = sin_rot * bank.cos_rot_correction[j]
+          - cos_rot * bank.sin_rot_correction[j];
+
+        float xy_distance = distance * cos_vert_angle - bank.xy_offset[j];
+        float xx = fabsf(xy_distance * sin_rot_angle
+                         - horiz_offset * cos_rot_angle);
+        float yy = fabsf(xy_distance * cos_rot_angle
+                         + horiz_offset * sin_rot_angle);
+
+        // two-point correction, zero slope and offset for lasers without it
+        float distance_x = distance
+          + bank.two_pt_slope_x[j] * xx + bank.two_pt_offset_x[j];
+        xy_distance = distance_x * cos_vert_angle - bank.xy_offset[j];
+        float x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
+
+        float distance_y = distance
+          + bank.two_pt_slope_y[j] * yy + bank.two_pt_offset_y[j];
+        xy_distance = distance_y * cos_vert_angle - bank.xy_offset[j];
+        float y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
+        float z = distance_y * sin_vert_angle + bank.z_offset[j];
+
+        float range_scale = 1 - raw_distance[j] / 65535;
+        float intensity = raw_intensity[j] + bank.focal_slope[j]
+          * fabsf(bank.focal_offset[j] - 256 * range_scale * range_scale);
+        intensity = (intensity < bank.min_intensity[j]) ?
+          bank.min_intensity[j] : intensity;
+        intensity = (intensity > bank.max_intensity[j]) ?
+          bank.max_intensity[j] : intensity;
+
+        /** Use standard ROS coordinate system (right-hand rule) */
+        out.x[j] = y;
+        out.y[j] = -x;
+        out.z[j] = z;
+        out.intensity[j] = intensity;
+        out.distance[j] = distance;
+      }
+  }
+
+} // namespace velodyne_rawdata
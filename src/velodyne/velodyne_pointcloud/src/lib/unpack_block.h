@@ -0,0 +1,72 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Block unpack engines for raw Velodyne HDL data.
+ *
+ *  Each engine converts the 32 returns of one raw_block_t into
+ *  BlockPoints, using the same equations as RawData::unpack().  The
+ *  SSE2 and AVX2 engines are only compiled when the compiler supports
+ *  them; RawData checks the CPU before selecting one.
+ */
+
+#ifndef __VELODYNE_UNPACK_BLOCK_H
+#define __VELODYNE_UNPACK_BLOCK_H
+
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_rawdata
+{
+  typedef void (*UnpackBlockFn)(const BankCorrections &bank,
+                                const raw_block_t &block,
+                                float cos_rot, float sin_rot,
+                                BlockPoints &out);
+
+  void unpack_block_scalar(const BankCorrections &bank,
+                           const raw_block_t &block,
+                           float cos_rot, float sin_rot,
+                           BlockPoints &out);
+
+#ifdef HAVE_UNPACK_SSE2
+  void unpack_block_sse2(const BankCorrections &bank,
+                         const raw_block_t &block,
+                         float cos_rot, float sin_rot,
+                         BlockPoints &out);
+#endif
+
+#ifdef HAVE_UNPACK_AVX2
+  void unpack_block_avx2(const BankCorrections &bank,
+                         const raw_block_t &block,
+                         float cos_rot, float sin_rot,
+                         BlockPoints &out);
+#endif
+
+  /** @brief De-interleave the distance and intensity bytes of a block.
+   *
+   *  Raw returns are packed as three bytes (little-endian distance,
+   *  intensity), which no vector load can use directly.
+   */
+  inline void split_block(const raw_block_t &block,
+                          float distance[LASERS_PER_BANK],
+                          float intensity[LASERS_PER_BANK])
+  {
+    for (int j = 0, k = 0; j < LASERS_PER_BANK; j++, k += RAW_SCAN_SIZE)
+      {
+        union two_bytes tmp;
+        tmp.bytes[0] = block.data[k];
+        tmp.bytes[1] = block.data[k+1];
+        distance[j] = tmp.uint;
+        intensity[j] = block.data[k+2];
+      }
+  }
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_UNPACK_BLOCK_H
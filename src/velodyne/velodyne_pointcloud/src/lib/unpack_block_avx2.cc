@@ -0,0 +1,26 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  AVX2 block unpack engine: eight lasers per instruction.
+ *
+ *  Only unpack_block_avx2() is compiled for AVX2 (see unpack_block_simd.h);
+ *  it is only called after RawData has checked that the CPU supports it.
+ */
+
+#include <immintrin.h>
+
+#include "unpack_block.h"
+
+#define UNPACK_SIMD_FN unpack_block_avx2
+#define UNPACK_SIMD_TARGET __attribute__((target("avx2")))
+#define UNPACK_SIMD_WIDTH 8
+#define UNPACK_SIMD_VEC __m256
+#define UNPACK_SIMD(op) _mm256_##op
+#include "unpack_block_simd.h"
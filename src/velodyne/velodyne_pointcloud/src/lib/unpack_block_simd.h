@@ -0,0 +1,135 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Body of the vectorized block unpack engines.
+ *
+ *  Not a normal header: each engine source includes it once, after
+ *  defining
+ *
+ *    UNPACK_SIMD_FN      name of the engine function
+ *    UNPACK_SIMD_TARGET  target attribute of the engine function
+ *    UNPACK_SIMD_WIDTH   lasers per vector
+ *    UNPACK_SIMD_VEC     vector type, e.g. __m128
+ *    UNPACK_SIMD(op)     intrinsic for op, e.g. _mm_##op
+ *
+ *  so the SSE2 and AVX2 engines share one set of equations.  Only the
+ *  engine function is compiled for the vector target, the rest of the
+ *  translation unit keeps the flags of the package (no inline or
+ *  template code included here may use vector instructions).
+ */
+
+#define V UNPACK_SIMD_VEC
+#define SIMD(op) UNPACK_SIMD(op)
+
+namespace velodyne_rawdata
+{
+  UNPACK_SIMD_TARGET
+  void UNPACK_SIMD_FN(const BankCorrections &bank,
+                      const raw_block_t &block,
+                      float cos_rot, float sin_rot,
+                      BlockPoints &out)
+  {
+    float raw_distance[LASERS_PER_BANK];
+    float raw_intensity[LASERS_PER_BANK];
+    split_block(block, raw_distance, raw_intensity);
+
+    const V sign_mask = SIMD(set1_ps)(-0.0f);
+    const V resolution = SIMD(set1_ps)(DISTANCE_RESOLUTION);
+    const V one = SIMD(set1_ps)(1.0f);
+    const V max_raw = SIMD(set1_ps)(65535.0f);
+    const V focal_scale = SIMD(set1_ps)(256.0f);
+    const V cos_rot_v = SIMD(set1_ps)(cos_rot);
+    const V sin_rot_v = SIMD(set1_ps)(sin_rot);
+
+    for (int j = 0; j < LASERS_PER_BANK; j += UNPACK_SIMD_WIDTH)
+      {
+        V raw = SIMD(loadu_ps)(&raw_distance[j]);
+        V distance = SIMD(add_ps)(SIMD(mul_ps)(raw, resolution),
+                                  SIMD(loadu_ps)(&bank.dist_correction[j]));
+
+        V cos_vert = SIMD(loadu_ps)(&bank.cos_vert_correction[j]);
+        V sin_vert = SIMD(loadu_ps)(&bank.sin_vert_correction[j]);
+        V cos_rot_corr = SIMD(loadu_ps)(&bank.cos_rot_correction[j]);
+        V sin_rot_corr = SIMD(loadu_ps)(&bank.sin_rot_correction[j]);
+        V horiz_offset = SIMD(loadu_ps)(&bank.horiz_offset_correction[j]);
+        V xy_offset = SIMD(loadu_ps)(&bank.xy_offset[j]);
+
+        // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+        // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+        V cos_rot_angle = SIMD(add_ps)(SIMD(mul_ps)(cos_rot_v, cos_rot_corr),
+                                       SIMD(mul_ps)(sin_rot_v, sin_rot_corr));
+        V sin_rot_angle = SIMD(sub_ps)(SIMD(mul_ps)(sin_rot_v, cos_rot_corr),
+                                       SIMD(mul_ps)(cos_rot_v, sin_rot_corr));
+
+        V horiz_cos = SIMD(mul_ps)(horiz_offset, cos_rot_angle);
+        V horiz_sin = SIMD(mul_ps)(horiz_offset, sin_rot_angle);
+
+        V xy_distance = SIMD(sub_ps)(SIMD(mul_ps)(distance, cos_vert),
+                                     xy_offset);
+        V xx = SIMD(andnot_ps)(sign_mask,
+                               SIMD(sub_ps)(SIMD(mul_ps)(xy_distance,
+                                                         sin_rot_angle),
+                                            horiz_cos));
+        V yy = SIMD(andnot_ps)(sign_mask,
+                               SIMD(add_ps)(SIMD(mul_ps)(xy_distance,
+                                                         cos_rot_angle),
+                                            horiz_sin));
+
+        // two-point correction, zero slope and offset for lasers without it
+        V slope_x = SIMD(loadu_ps)(&bank.two_pt_slope_x[j]);
+        V offset_x = SIMD(loadu_ps)(&bank.two_pt_offset_x[j]);
+        V distance_x = SIMD(add_ps)(distance,
+                                    SIMD(add_ps)(SIMD(mul_ps)(slope_x, xx),
+                                                 offset_x));
+        xy_distance = SIMD(sub_ps)(SIMD(mul_ps)(distance_x, cos_vert),
+                                   xy_offset);
+        V x = SIMD(sub_ps)(SIMD(mul_ps)(xy_distance, sin_rot_angle),
+                           horiz_cos);
+
+        V slope_y = SIMD(loadu_ps)(&bank.two_pt_slope_y[j]);
+        V offset_y = SIMD(loadu_ps)(&bank.two_pt_offset_y[j]);
+        V distance_y = SIMD(add_ps)(distance,
+                                    SIMD(add_ps)(SIMD(mul_ps)(slope_y, yy),
+                                                 offset_y));
+        xy_distance = SIMD(sub_ps)(SIMD(mul_ps)(distance_y, cos_vert),
+                                   xy_offset);
+        V y = SIMD(add_ps)(SIMD(mul_ps)(xy_distance, cos_rot_angle),
+                           horiz_sin);
+        V z = SIMD(add_ps)(SIMD(mul_ps)(distance_y, sin_vert),
+                           SIMD(loadu_ps)(&bank.z_offset[j]));
+
+        V range_scale = SIMD(sub_ps)(one, SIMD(div_ps)(raw, max_raw));
+        V focal = SIMD(mul_ps)(SIMD(mul_ps)(focal_scale, range_scale),
+                               range_scale);
+        focal = SIMD(andnot_ps)(sign_mask,
+                                SIMD(sub_ps)(SIMD(loadu_ps)(&bank.focal_offset[j]),
+                                             focal));
+        V intensity = SIMD(add_ps)(SIMD(loadu_ps)(&raw_intensity[j]),
+                                   SIMD(mul_ps)(SIMD(loadu_ps)(&bank.focal_slope[j]),
+                                                focal));
+        intensity = SIMD(max_ps)(intensity,
+                                 SIMD(loadu_ps)(&bank.min_intensity[j]));
+        intensity = SIMD(min_ps)(intensity,
+                                 SIMD(loadu_ps)(&bank.max_intensity[j]));
+
+        /** Use standard ROS coordinate system (right-hand rule) */
+        SIMD(storeu_ps)(&out.x[j], y);
+        SIMD(storeu_ps)(&out.y[j], SIMD(xor_ps)(x, sign_mask));
+        SIMD(storeu_ps)(&out.z[j], z);
+        SIMD(storeu_ps)(&out.intensity[j], intensity);
+        SIMD(storeu_ps)(&out.distance[j], distance);
+      }
+  }
+
+} // namespace velodyne_rawdata
+
+#undef SIMD
+#undef V
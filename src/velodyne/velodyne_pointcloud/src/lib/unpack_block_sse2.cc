@@ -0,0 +1,26 @@
+/*
+ *  Copyright (C) 2016 Austin Robot Technology
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  SSE2 block unpack engine: four lasers per instruction.
+ *
+ *  Only unpack_block_sse2() is compiled for SSE2 (see unpack_block_simd.h);
+ *  it is only called after RawData has checked that the CPU supports it.
+ */
+
+#include <emmintrin.h>
+
+#include "unpack_block.h"
+
+#define UNPACK_SIMD_FN unpack_block_sse2
+#define UNPACK_SIMD_TARGET __attribute__((target("sse2")))
+#define UNPACK_SIMD_WIDTH 4
+#define UNPACK_SIMD_VEC __m128
+#define UNPACK_SIMD(op) _mm_##op
+#include "unpack_block_simd.h"
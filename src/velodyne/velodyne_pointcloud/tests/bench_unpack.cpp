@@ -0,0 +1,218 @@
+//
+// Microbenchmark for raw data unpacking.
+//
+// Times RawData::unpack() on synthesized packets for each bundled
+// device calibration and every block engine this CPU runs, plus
+// Calibration::read().  Results go to stdout as JSON, always with the
+// same keys in the same order, so runs on two commits can be diffed.
+//
+// usage: bench_unpack [packets [repeats]]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <ros/console.h>
+#include <ros/package.h>
+#include <velodyne_pointcloud/rawdata.h>
+using namespace velodyne_rawdata;
+
+namespace
+{
+  /** bundled calibration of each device model */
+  struct Model
+  {
+    const char *name;
+    const char *calibration;            ///< file in params/
+    bool lower_bank;                    ///< alternate bank headers
+  };
+
+  const Model MODELS[] =
+    {
+      {"HDL-32E", "32db.yaml", false},
+      {"HDL-64E_S2.1", "64e_s2.1-sztaki.yaml", true},
+      {"VLP-16", "VLP16db.yaml", false},
+    };
+  const int N_MODELS = sizeof(MODELS) / sizeof(MODELS[0]);
+
+  const char *ENGINE_KEYS[] =
+    {"per_return", "block_scalar", "block_sse2", "block_avx2"};
+
+  /** timing of one engine, not supported if this CPU cannot run it */
+  struct Timing
+  {
+    bool supported;
+    double seconds;                     ///< best pass over all packets
+    size_t npoints;
+    Timing(): supported(false), seconds(0.0), npoints(0) {}
+  };
+
+  struct Result
+  {
+    double calibration_read;            ///< best seconds
+    Timing engines[UNPACK_AUTO];
+    Result(): calibration_read(0.0) {}
+  };
+
+  double now(void)
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+  }
+
+  /** Fill packets with deterministic returns from a rotating device. */
+  void make_packets(std::vector<velodyne_msgs::VelodynePacket> &pkts,
+                    bool lower_bank)
+  {
+    uint32_t state = 12345;
+    uint16_t rotation = 0;
+    for (size_t n = 0; n < pkts.size(); ++n)
+      {
+        raw_packet_t *raw = (raw_packet_t *) &pkts[n].data[0];
+        for (int i = 0; i < BLOCKS_PER_PACKET; i++)
+          {
+            bool lower = lower_bank && (i % 2);
+            raw->blocks[i].header = lower ? LOWER_BANK : UPPER_BANK;
+            raw->blocks[i].rotation = rotation;
+            if (!lower_bank || lower)
+              rotation = (rotation + 20) % ROTATION_MAX_UNITS;
+            for (int k = 0; k < BLOCK_DATA_SIZE; k++)
+              {
+                state = state * 1664525u + 1013904223u;
+                raw->blocks[i].data[k] = state >> 24;
+              }
+          }
+        raw->revolution = n;
+      }
+  }
+
+  /** @returns best seconds per pass over all packets */
+  double time_unpack(const RawData &data,
+                     const std::vector<velodyne_msgs::VelodynePacket> &pkts,
+                     int repeats, size_t *npoints)
+  {
+    std::vector<VPoint> points(SCANS_PER_PACKET);
+    double best = 0.0;
+    for (int r = 0; r < repeats; ++r)
+      {
+        size_t count = 0;
+        double start = now();
+        for (size_t n = 0; n < pkts.size(); ++n)
+          count += data.unpack(pkts[n], &points[0]);
+        double elapsed = now() - start;
+        if (r == 0 || elapsed < best)
+          best = elapsed;
+        *npoints = count;
+      }
+    return best;
+  }
+
+  /** @returns best seconds to read a calibration file */
+  double time_calibration(const std::string &file, int repeats)
+  {
+    double best = 0.0;
+    for (int r = 0; r < repeats; ++r)
+      {
+        double start = now();
+        velodyne_pointcloud::Calibration calibration(false);
+        calibration.read(file);
+        double elapsed = now() - start;
+        if (r == 0 || elapsed < best)
+          best = elapsed;
+      }
+    return best;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int npackets = (argc > 1) ? atoi(argv[1]) : 20000;
+  int repeats = (argc > 2) ? atoi(argv[2]) : 5;
+  if (npackets <= 0 || repeats <= 0)
+    {
+      fprintf(stderr, "usage: %s [packets [repeats]]\n", argv[0]);
+      return 2;
+    }
+  std::string params =
+    ros::package::getPath("velodyne_pointcloud") + "/params/";
+
+  // RawData logs calibration details on stdout, keep it for the JSON
+  if (ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME,
+                                     ros::console::levels::Warn))
+    ros::console::notifyLoggerLevelsChanged();
+
+  // run everything before printing, so nothing else ends up in between
+  std::vector<Result> results(N_MODELS);
+  for (int m = 0; m < N_MODELS; ++m)
+    {
+      const Model &model = MODELS[m];
+      std::string file = params + model.calibration;
+      Result &result = results[m];
+
+      RawData data;
+      if (data.setupOffline(file, 130.0, 0.4) != 0)
+        {
+          fprintf(stderr, "cannot read %s\n", file.c_str());
+          return 1;
+        }
+      data.setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+
+      std::vector<velodyne_msgs::VelodynePacket> pkts(npackets);
+      make_packets(pkts, model.lower_bank);
+
+      result.calibration_read = time_calibration(file, repeats);
+
+      // the VLP-16 has a single unpack path
+      bool vlp16 = (std::string(model.name) == "VLP-16");
+      int engines = vlp16 ? 1 : UNPACK_AUTO;
+      for (int e = 0; e < engines; ++e)
+        {
+          Timing &timing = result.engines[e];
+          timing.supported = (data.setUnpackEngine((UnpackEngine) e) == e);
+          if (timing.supported)
+            timing.seconds = time_unpack(data, pkts, repeats,
+                                         &timing.npoints);
+        }
+    }
+
+  printf("{\n  \"packets\": %d,\n  \"repeats\": %d,\n  \"models\": [",
+         npackets, repeats);
+  for (int m = 0; m < N_MODELS; ++m)
+    {
+      const Model &model = MODELS[m];
+      const Result &result = results[m];
+      printf("%s\n    {\n      \"model\": \"%s\",\n"
+             "      \"calibration\": \"%s\",\n"
+             "      \"calibration_read_ms\": %.3f,\n"
+             "      \"engines\": {",
+             (m > 0) ? "," : "", model.name, model.calibration,
+             1e3 * result.calibration_read);
+
+      bool vlp16 = (std::string(model.name) == "VLP-16");
+      int engines = vlp16 ? 1 : UNPACK_AUTO;
+      for (int e = 0; e < engines; ++e)
+        {
+          const Timing &timing = result.engines[e];
+          const char *key = vlp16 ? "vlp16" : ENGINE_KEYS[e];
+          if (!timing.supported)        // same keys on every CPU
+            {
+              printf("%s\n        \"%s\": null", (e > 0) ? "," : "", key);
+              continue;
+            }
+          printf("%s\n        \"%s\": {\"points\": %lu, "
+                 "\"ns_per_point\": %.3f, \"points_per_s\": %.0f}",
+                 (e > 0) ? "," : "", key,
+                 (unsigned long) timing.npoints,
+                 timing.npoints ? 1e9 * timing.seconds / timing.npoints : 0.0,
+                 timing.seconds > 0.0 ? timing.npoints / timing.seconds : 0.0);
+        }
+      printf("\n      }\n    }");
+    }
+  printf("\n  ]\n}\n");
+  return 0;
+}
@@ -154,6 +154,75 @@ TEST(Calibration, hdl64e_s2_float_intensities)
   EXPECT_EQ(laser.min_intensity, 0);
 }
 
+TEST(Calibration, vlp16_coefficients)
+{
+  Calibration calibration(g_package_path + "/params/VLP16db.yaml", false);
+  ASSERT_TRUE(calibration.initialized);
+  ASSERT_EQ(calibration.laser_coefficients.size(),
+            (size_t) Calibration::MIN_LASER_COEFFICIENTS);
+
+  LaserCoefficients k = calibration.laser_coefficients[15];
+  LaserCorrection laser = calibration.laser_corrections[15];
+  EXPECT_FLOAT_EQ(k.sin_vert_correction, laser.sin_vert_correction);
+  EXPECT_FLOAT_EQ(k.two_pt_slope_x, 0.0);
+  EXPECT_FLOAT_EQ(k.two_pt_offset_y, 0.0);
+  EXPECT_FLOAT_EQ(k.max_intensity, 255.0);
+  EXPECT_EQ(k.laser_ring, laser.laser_ring);
+
+  // lasers the device does not have are all zero
+  k = calibration.laser_coefficients[16];
+  EXPECT_FLOAT_EQ(k.cos_vert_correction, 0.0);
+  EXPECT_FLOAT_EQ(k.max_intensity, 0.0);
+}
+
+TEST(Calibration, hdl64e_s21_coefficients)
+{
+  Calibration calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml",
+                          false);
+  ASSERT_TRUE(calibration.initialized);
+  ASSERT_EQ(calibration.laser_coefficients.size(), (size_t) 64);
+
+  for (int i = 0; i < 64; ++i)
+    {
+      LaserCorrection laser = calibration.laser_corrections[i];
+      LaserCoefficients k = calibration.laser_coefficients[i];
+      float focal = 1 - laser.focal_distance / 13100;
+      EXPECT_FLOAT_EQ(k.focal_offset, 256 * focal * focal);
+      EXPECT_FLOAT_EQ(k.focal_slope, laser.focal_slope);
+      EXPECT_FLOAT_EQ(k.xy_offset, laser.vert_offset_correction
+                      * laser.sin_vert_correction);
+      EXPECT_FLOAT_EQ(k.z_offset, laser.vert_offset_correction
+                      * laser.cos_vert_correction);
+      EXPECT_FLOAT_EQ(k.min_intensity, laser.min_intensity);
+      EXPECT_EQ(k.laser_ring, laser.laser_ring);
+    }
+}
+
+TEST(Calibration, two_point_coefficients)
+{
+  Calibration calibration(g_package_path + "/params/64e_utexas.yaml", false);
+  ASSERT_TRUE(calibration.initialized);
+  LaserCorrection &laser = calibration.laser_corrections[5];
+  laser.two_pt_correction_available = true;
+  laser.dist_correction_x = laser.dist_correction + 0.02;
+  laser.dist_correction_y = laser.dist_correction - 0.03;
+  std::string two_pt_file("/tmp/test_calibration_two_pt.yaml");
+  calibration.write(two_pt_file);
+
+  Calibration two_pt(two_pt_file, false);
+  ASSERT_TRUE(two_pt.initialized);
+  LaserCoefficients k = two_pt.laser_coefficients[5];
+
+  // no correction at the far distance, near correction at the near ones
+  EXPECT_NEAR(k.two_pt_slope_x * 25.04 + k.two_pt_offset_x, 0.0, 1e-6);
+  EXPECT_NEAR(k.two_pt_slope_y * 25.04 + k.two_pt_offset_y, 0.0, 1e-6);
+  EXPECT_NEAR(k.two_pt_slope_x * 2.4 + k.two_pt_offset_x, 0.02, 1e-6);
+  EXPECT_NEAR(k.two_pt_slope_y * 1.93 + k.two_pt_offset_y, -0.03, 1e-6);
+
+  // other lasers are unchanged
+  EXPECT_FLOAT_EQ(two_pt.laser_coefficients[4].two_pt_slope_x, 0.0);
+}
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv)
 {
@@ -0,0 +1,65 @@
+//
+// C++ unit tests for the point cloud buffer pool.
+//
+
+#include <gtest/gtest.h>
+
+#include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/cloud_pool.h>
+using namespace velodyne_pointcloud;
+using velodyne_rawdata::VPoint;
+using velodyne_rawdata::VPointCloud;
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(CloudPool, reserve)
+{
+  CloudPool<VPointCloud> pool;
+  VPointCloud::Ptr cloud = pool.allocate(1000);
+  EXPECT_EQ(cloud->points.size(), 0u);
+  EXPECT_GE(cloud->points.capacity(), 1000u);
+  EXPECT_EQ(cloud->width, 0u);
+  EXPECT_EQ(cloud->height, 1u);
+}
+
+TEST(CloudPool, reuse_after_release)
+{
+  CloudPool<VPointCloud> pool;
+  VPointCloud::Ptr cloud = pool.allocate(100);
+  VPointCloud *first = cloud.get();
+  cloud->points.push_back(VPoint());
+  cloud->width = 1;
+  cloud.reset();                        // subscriber done with it
+
+  cloud = pool.allocate(100);
+  EXPECT_EQ(cloud.get(), first);
+  EXPECT_EQ(cloud->points.size(), 0u);
+  EXPECT_EQ(cloud->width, 0u);
+  EXPECT_EQ(pool.size(), 1u);
+}
+
+TEST(CloudPool, held_clouds_not_reused)
+{
+  CloudPool<VPointCloud> pool(2);
+  VPointCloud::Ptr a = pool.allocate(10);
+  VPointCloud::Ptr subscriber = a;      // still being used
+  a.reset();
+
+  VPointCloud::Ptr b = pool.allocate(10);
+  EXPECT_NE(b.get(), subscriber.get());
+
+  // the pool does not grow beyond its limit
+  VPointCloud::Ptr c = pool.allocate(10);
+  EXPECT_NE(c.get(), subscriber.get());
+  EXPECT_NE(c.get(), b.get());
+  EXPECT_EQ(pool.size(), 2u);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
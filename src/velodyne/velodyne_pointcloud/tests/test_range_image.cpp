@@ -0,0 +1,143 @@
+//
+// C++ unit tests for organized range images.
+//
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <ros/package.h>
+#include <velodyne_pointcloud/range_image.h>
+using namespace velodyne_rawdata;
+
+// global test data
+std::string g_package_name("velodyne_pointcloud");
+std::string g_package_path;
+
+static const int COLUMNS = 2000;
+
+void init_global_data(void)
+{
+  g_package_path = ros::package::getPath(g_package_name);
+}
+
+/** Fill a packet with deterministic pseudo-random returns. */
+void make_packet(velodyne_msgs::VelodynePacket &pkt, unsigned seed)
+{
+  raw_packet_t *raw = (raw_packet_t *) &pkt.data[0];
+  uint32_t state = seed * 2654435761u + 1;
+  for (int i = 0; i < BLOCKS_PER_PACKET; i++)
+    {
+      raw->blocks[i].header = UPPER_BANK;
+      raw->blocks[i].rotation = (seed * 200 + i * 16) % ROTATION_MAX_UNITS;
+      for (int k = 0; k < BLOCK_DATA_SIZE; k++)
+        {
+          state = state * 1664525u + 1013904223u;
+          raw->blocks[i].data[k] = state >> 24;
+        }
+    }
+}
+
+void setup(RawData &data, const std::string &calibration_file)
+{
+  ASSERT_EQ(data.setupOffline(calibration_file, 130.0, 0.4), 0);
+  data.setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(RangeImage, layout)
+{
+  RawData data;
+  setup(data, g_package_path + "/params/32db.yaml");
+  velodyne_msgs::VelodyneRangeImage image;
+  data.setupRangeImage(COLUMNS, image);
+  EXPECT_EQ(image.rings, 32);
+  EXPECT_EQ(image.columns, COLUMNS);
+  EXPECT_EQ(image.elevation.size(), 32u);
+  EXPECT_EQ(image.range.size(), 32u * COLUMNS);
+  EXPECT_EQ(image.intensity.size(), 32u * COLUMNS);
+
+  // rings are numbered from the lowest laser up
+  for (int ring = 1; ring < image.rings; ++ring)
+    EXPECT_GT(image.elevation[ring], image.elevation[ring - 1]);
+}
+
+TEST(RangeImage, cells_match_points)
+{
+  RawData data;
+  setup(data, g_package_path + "/params/32db.yaml");
+  velodyne_msgs::VelodyneRangeImage image;
+  data.setupRangeImage(COLUMNS, image);
+
+  VPointCloud points;
+  for (unsigned seed = 0; seed < 20; ++seed)
+    {
+      velodyne_msgs::VelodynePacket pkt;
+      make_packet(pkt, seed);
+      data.unpack(pkt, points);
+      data.unpack(pkt, image);
+    }
+  ASSERT_GT(points.points.size(), 0u);
+
+  // every point's cell holds a return at least as near
+  size_t filled = 0;
+  for (size_t i = 0; i < points.points.size(); ++i)
+    {
+      const VPoint &p = points.points[i];
+      float range = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+      int column = rangeImageColumn(p.x, p.y, COLUMNS);
+      size_t cell = (size_t) p.ring * COLUMNS + column;
+      ASSERT_GT(image.range[cell], 0);
+      EXPECT_LE(image.range[cell] * image.range_resolution,
+                range + image.range_resolution);
+    }
+  for (size_t cell = 0; cell < image.range.size(); ++cell)
+    if (image.range[cell] != 0)
+      ++filled;
+  EXPECT_LE(filled, points.points.size());
+}
+
+TEST(RangeImage, cloud_view)
+{
+  RawData data;
+  setup(data, g_package_path + "/params/32db.yaml");
+  velodyne_msgs::VelodyneRangeImage image;
+  data.setupRangeImage(COLUMNS, image);
+
+  VPoint points[SCANS_PER_PACKET];
+  velodyne_msgs::VelodynePacket pkt;
+  make_packet(pkt, 3);
+  int npoints = data.unpack(pkt, points);
+  ASSERT_GT(npoints, 0);
+  addToRangeImage(points, npoints, image);
+
+  VPointCloud view;
+  rangeImageToCloud(image, view);
+  EXPECT_EQ(view.height, (uint32_t) image.rings);
+  EXPECT_EQ(view.width, (uint32_t) image.columns);
+  EXPECT_FALSE(view.is_dense);
+
+  for (size_t cell = 0; cell < view.points.size(); ++cell)
+    {
+      const VPoint &p = view.points[cell];
+      EXPECT_EQ((size_t) p.ring, cell / COLUMNS);
+      if (image.range[cell] == 0)
+        {
+          EXPECT_TRUE(isnan(p.x));
+          continue;
+        }
+      float range = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+      EXPECT_NEAR(range, image.range[cell] * image.range_resolution, 1e-3);
+      EXPECT_NEAR(asinf(p.z / range), image.elevation[p.ring], 1e-4);
+    }
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}
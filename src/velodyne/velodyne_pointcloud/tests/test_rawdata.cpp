@@ -0,0 +1,373 @@
+//
+// C++ unit tests for raw data unpacking.
+//
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <angles/angles.h>
+#include <ros/package.h>
+#include <velodyne_pointcloud/rawdata.h>
+using namespace velodyne_rawdata;
+
+// global test data
+std::string g_package_name("velodyne_pointcloud");
+std::string g_package_path;
+
+// block engines only differ from the per-return path, and the float
+// coefficients from the original equations, by rounding
+static const float POSITION_EPSILON = 1e-4;   // [m]
+static const float INTENSITY_EPSILON = 1e-3;
+
+void init_global_data(void)
+{
+  g_package_path = ros::package::getPath(g_package_name);
+}
+
+/** Fill a packet with deterministic pseudo-random returns.
+ *
+ *  Blocks alternate upper and lower bank headers when @a lower_bank
+ *  is set, as an HDL-64E does.
+ */
+void make_packet(velodyne_msgs::VelodynePacket &pkt, unsigned seed,
+                 bool lower_bank)
+{
+  raw_packet_t *raw = (raw_packet_t *) &pkt.data[0];
+  uint32_t state = seed * 2654435761u + 1;
+  for (int i = 0; i < BLOCKS_PER_PACKET; i++)
+    {
+      raw->blocks[i].header =
+        (lower_bank && (i % 2)) ? LOWER_BANK : UPPER_BANK;
+      state = state * 1664525u + 1013904223u;
+      raw->blocks[i].rotation = (state >> 8) % ROTATION_MAX_UNITS;
+      for (int k = 0; k < BLOCK_DATA_SIZE; k++)
+        {
+          state = state * 1664525u + 1013904223u;
+          raw->blocks[i].data[k] = state >> 24;
+        }
+    }
+  raw->revolution = seed;
+}
+
+/** Unpack the same packets with the per-return path and @a engine. */
+void compare_engines(const std::string &calibration_file,
+                     UnpackEngine engine, bool lower_bank)
+{
+  RawData data;
+  ASSERT_EQ(data.setupOffline(calibration_file, 130.0, 0.4), 0);
+  data.setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+  if (data.setUnpackEngine(engine) != engine)
+    {
+      std::cerr << "engine " << engine << " not supported here, skipped"
+                << std::endl;
+      return;
+    }
+
+  for (unsigned seed = 0; seed < 50; ++seed)
+    {
+      velodyne_msgs::VelodynePacket pkt;
+      make_packet(pkt, seed, lower_bank);
+
+      VPointCloud expected, actual;
+      data.setUnpackEngine(UNPACK_PER_RETURN);
+      data.unpack(pkt, expected);
+      data.setUnpackEngine(engine);
+      data.unpack(pkt, actual);
+
+      ASSERT_EQ(expected.points.size(), actual.points.size());
+      ASSERT_EQ(expected.width, actual.width);
+      for (size_t i = 0; i < expected.points.size(); ++i)
+        {
+          EXPECT_EQ(expected.points[i].ring, actual.points[i].ring);
+          EXPECT_NEAR(expected.points[i].x, actual.points[i].x,
+                      POSITION_EPSILON);
+          EXPECT_NEAR(expected.points[i].y, actual.points[i].y,
+                      POSITION_EPSILON);
+          EXPECT_NEAR(expected.points[i].z, actual.points[i].z,
+                      POSITION_EPSILON);
+          EXPECT_NEAR(expected.points[i].intensity,
+                      actual.points[i].intensity, INTENSITY_EPSILON);
+        }
+    }
+}
+
+/** Unpack a packet (not VLP-16) with the original per-return
+ *  equations, straight from the laser corrections, as RawData did
+ *  before the coefficients were precomputed.  The two-point correction
+ *  is computed in double, as it was.
+ */
+void baseline_unpack(const velodyne_pointcloud::Calibration &calibration,
+                     const velodyne_msgs::VelodynePacket &pkt,
+                     float min_range, float max_range, VPointCloud &pc)
+{
+  const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+  for (int i = 0; i < BLOCKS_PER_PACKET; i++)
+    {
+      int bank_origin = (raw->blocks[i].header == LOWER_BANK) ? 32 : 0;
+      float rotation = angles::from_degrees(ROTATION_RESOLUTION
+                                            * raw->blocks[i].rotation);
+      float cos_rot = cosf(rotation);
+      float sin_rot = sinf(rotation);
+
+      for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE)
+        {
+          const velodyne_pointcloud::LaserCorrection &corrections =
+            calibration.laser_corrections.find(j + bank_origin)->second;
+
+          union two_bytes tmp;
+          tmp.bytes[0] = raw->blocks[i].data[k];
+          tmp.bytes[1] = raw->blocks[i].data[k+1];
+          float distance = tmp.uint * DISTANCE_RESOLUTION;
+          distance += corrections.dist_correction;
+
+          float cos_vert_angle = corrections.cos_vert_correction;
+          float sin_vert_angle = corrections.sin_vert_correction;
+          float cos_rot_angle = cos_rot * corrections.cos_rot_correction
+            + sin_rot * corrections.sin_rot_correction;
+          float sin_rot_angle = sin_rot * corrections.cos_rot_correction
+            - cos_rot * corrections.sin_rot_correction;
+          float horiz_offset = corrections.horiz_offset_correction;
+          float vert_offset = corrections.vert_offset_correction;
+
+          float xy_distance = distance * cos_vert_angle
+            - vert_offset * sin_vert_angle;
+          float xx = fabsf(xy_distance * sin_rot_angle
+                           - horiz_offset * cos_rot_angle);
+          float yy = fabsf(xy_distance * cos_rot_angle
+                           + horiz_offset * sin_rot_angle);
+
+          float distance_corr_x = 0;
+          float distance_corr_y = 0;
+          if (corrections.two_pt_correction_available)
+            {
+              distance_corr_x =
+                (corrections.dist_correction - corrections.dist_correction_x)
+                * (xx - 2.4) / (25.04 - 2.4)
+                + corrections.dist_correction_x;
+              distance_corr_x -= corrections.dist_correction;
+              distance_corr_y =
+                (corrections.dist_correction - corrections.dist_correction_y)
+                * (yy - 1.93) / (25.04 - 1.93)
+                + corrections.dist_correction_y;
+              distance_corr_y -= corrections.dist_correction;
+            }
+
+          float distance_x = distance + distance_corr_x;
+          xy_distance = distance_x * cos_vert_angle
+            - vert_offset * sin_vert_angle;
+          float x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
+
+          float distance_y = distance + distance_corr_y;
+          xy_distance = distance_y * cos_vert_angle
+            - vert_offset * sin_vert_angle;
+          float y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
+          float z = distance_y * sin_vert_angle + vert_offset * cos_vert_angle;
+
+          float intensity = raw->blocks[i].data[k+2];
+          float focal_offset = 256
+            * (1 - corrections.focal_distance / 13100)
+            * (1 - corrections.focal_distance / 13100);
+          float range_scale = 1 - static_cast<float>(tmp.uint) / 65535;
+          intensity += corrections.focal_slope
+            * fabsf(focal_offset - 256 * range_scale * range_scale);
+          if (intensity < corrections.min_intensity)
+            intensity = corrections.min_intensity;
+          if (intensity > corrections.max_intensity)
+            intensity = corrections.max_intensity;
+
+          if (distance >= min_range && distance <= max_range)
+            {
+              VPoint point;
+              point.ring = corrections.laser_ring;
+              point.x = y;
+              point.y = -x;
+              point.z = z;
+              point.intensity = intensity;
+              pc.points.push_back(point);
+              ++pc.width;
+            }
+        }
+    }
+}
+
+/** Unpack packets with @a engine and compare them to the original
+ *  equations. */
+void compare_baseline(const std::string &calibration_file,
+                      UnpackEngine engine, bool lower_bank)
+{
+  RawData data;
+  ASSERT_EQ(data.setupOffline(calibration_file, 130.0, 0.4), 0);
+  data.setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+  if (data.setUnpackEngine(engine) != engine)
+    {
+      std::cerr << "engine " << engine << " not supported here, skipped"
+                << std::endl;
+      return;
+    }
+  velodyne_pointcloud::Calibration calibration(calibration_file, false);
+  ASSERT_TRUE(calibration.initialized);
+
+  for (unsigned seed = 0; seed < 50; ++seed)
+    {
+      velodyne_msgs::VelodynePacket pkt;
+      make_packet(pkt, seed, lower_bank);
+
+      VPointCloud expected, actual;
+      baseline_unpack(calibration, pkt, 0.4, 130.0, expected);
+      data.unpack(pkt, actual);
+
+      ASSERT_EQ(expected.points.size(), actual.points.size());
+      for (size_t i = 0; i < expected.points.size(); ++i)
+        {
+          EXPECT_EQ(expected.points[i].ring, actual.points[i].ring);
+          EXPECT_NEAR(expected.points[i].x, actual.points[i].x,
+                      POSITION_EPSILON);
+          EXPECT_NEAR(expected.points[i].y, actual.points[i].y,
+                      POSITION_EPSILON);
+          EXPECT_NEAR(expected.points[i].z, actual.points[i].z,
+                      POSITION_EPSILON);
+          EXPECT_NEAR(expected.points[i].intensity,
+                      actual.points[i].intensity, INTENSITY_EPSILON);
+        }
+    }
+}
+
+/** Write a copy of a calibration with two-point correction enabled. */
+std::string two_point_calibration(const std::string &calibration_file)
+{
+  velodyne_pointcloud::Calibration calibration(calibration_file, false);
+  for (std::map<int, velodyne_pointcloud::LaserCorrection>::iterator
+         it = calibration.laser_corrections.begin();
+       it != calibration.laser_corrections.end(); ++it)
+    {
+      it->second.two_pt_correction_available = true;
+      it->second.dist_correction_x = it->second.dist_correction + 0.02;
+      it->second.dist_correction_y = it->second.dist_correction - 0.03;
+    }
+  std::string two_pt_file("/tmp/test_rawdata_two_pt.yaml");
+  calibration.write(two_pt_file);
+  return two_pt_file;
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(RawData, auto_engine)
+{
+  RawData data;
+  ASSERT_EQ(data.setupOffline(g_package_path + "/params/32db.yaml",
+                              130.0, 0.4), 0);
+  EXPECT_NE(data.getUnpackEngine(), UNPACK_AUTO);
+  EXPECT_NE(data.getUnpackEngine(), UNPACK_PER_RETURN);
+}
+
+TEST(RawData, block_scalar_hdl32e)
+{
+  compare_engines(g_package_path + "/params/32db.yaml",
+                  UNPACK_BLOCK_SCALAR, false);
+}
+
+TEST(RawData, block_sse2_hdl32e)
+{
+  compare_engines(g_package_path + "/params/32db.yaml",
+                  UNPACK_BLOCK_SSE2, false);
+}
+
+TEST(RawData, block_avx2_hdl32e)
+{
+  compare_engines(g_package_path + "/params/32db.yaml",
+                  UNPACK_BLOCK_AVX2, false);
+}
+
+TEST(RawData, block_engines_hdl64e_s21)
+{
+  std::string calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml");
+  compare_engines(calibration, UNPACK_BLOCK_SCALAR, true);
+  compare_engines(calibration, UNPACK_BLOCK_SSE2, true);
+  compare_engines(calibration, UNPACK_BLOCK_AVX2, true);
+}
+
+TEST(RawData, block_engines_two_point)
+{
+  std::string calibration =
+    two_point_calibration(g_package_path + "/params/64e_utexas.yaml");
+  compare_engines(calibration, UNPACK_BLOCK_SCALAR, true);
+  compare_engines(calibration, UNPACK_BLOCK_SSE2, true);
+  compare_engines(calibration, UNPACK_BLOCK_AVX2, true);
+}
+
+TEST(RawData, baseline_hdl32e)
+{
+  std::string calibration(g_package_path + "/params/32db.yaml");
+  compare_baseline(calibration, UNPACK_PER_RETURN, false);
+  compare_baseline(calibration, UNPACK_BLOCK_SCALAR, false);
+  compare_baseline(calibration, UNPACK_BLOCK_SSE2, false);
+  compare_baseline(calibration, UNPACK_BLOCK_AVX2, false);
+}
+
+TEST(RawData, baseline_hdl64e_s21)
+{
+  std::string calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml");
+  compare_baseline(calibration, UNPACK_PER_RETURN, true);
+  compare_baseline(calibration, UNPACK_BLOCK_SCALAR, true);
+}
+
+TEST(RawData, baseline_two_point)
+{
+  // float two-point coefficients stay within POSITION_EPSILON of the
+  // original double interpolation
+  std::string calibration =
+    two_point_calibration(g_package_path + "/params/64e_utexas.yaml");
+  compare_baseline(calibration, UNPACK_PER_RETURN, true);
+  compare_baseline(calibration, UNPACK_BLOCK_SCALAR, true);
+  compare_baseline(calibration, UNPACK_BLOCK_SSE2, true);
+  compare_baseline(calibration, UNPACK_BLOCK_AVX2, true);
+}
+
+/** Firing times must not change the points, and must lie within the
+ *  packet, ending at its stamp. */
+void check_times(const std::string &calibration_file, bool lower_bank,
+                 float block_duration)
+{
+  RawData data;
+  ASSERT_EQ(data.setupOffline(calibration_file, 130.0, 0.4), 0);
+  data.setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+
+  velodyne_msgs::VelodynePacket pkt;
+  make_packet(pkt, 7, lower_bank);
+  VPoint expected[SCANS_PER_PACKET], actual[SCANS_PER_PACKET];
+  float times[SCANS_PER_PACKET];
+  int n = data.unpack(pkt, expected);
+  ASSERT_EQ(data.unpack(pkt, actual, times), n);
+  ASSERT_GT(n, 0);
+
+  float earliest = -1e-6f * BLOCKS_PER_PACKET * block_duration;
+  for (int i = 0; i < n; ++i)
+    {
+      EXPECT_EQ(expected[i].x, actual[i].x);
+      EXPECT_GE(times[i], earliest - 1e-9f);
+      EXPECT_LE(times[i], 0.0f);
+    }
+}
+
+TEST(RawData, firing_times_vlp16)
+{
+  // pseudo-random rotations: only checks the time bounds
+  check_times(g_package_path + "/params/VLP16db.yaml", false,
+              VLP16_BLOCK_TDURATION);
+}
+
+TEST(RawData, firing_times_hdl32e)
+{
+  check_times(g_package_path + "/params/32db.yaml", false,
+              HDL32E_BLOCK_TDURATION);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,114 @@
+//
+// C++ unit tests for packet-parallel scan conversion.
+//
+
+#include <gtest/gtest.h>
+
+#include <ros/package.h>
+#include <velodyne_pointcloud/rawdata.h>
+#include "../src/conversions/unpack_workers.h"
+using namespace velodyne_rawdata;
+using velodyne_pointcloud::UnpackWorkers;
+
+// global test data
+std::string g_package_name("velodyne_pointcloud");
+std::string g_package_path;
+
+void init_global_data(void)
+{
+  g_package_path = ros::package::getPath(g_package_name);
+}
+
+/** Build a scan of deterministic pseudo-random HDL-64E packets. */
+void make_scan(velodyne_msgs::VelodyneScan &scan, int npackets)
+{
+  scan.packets.resize(npackets);
+  uint32_t state = 12345;
+  for (int p = 0; p < npackets; ++p)
+    {
+      raw_packet_t *raw = (raw_packet_t *) &scan.packets[p].data[0];
+      for (int i = 0; i < BLOCKS_PER_PACKET; i++)
+        {
+          raw->blocks[i].header = (i % 2) ? LOWER_BANK : UPPER_BANK;
+          state = state * 1664525u + 1013904223u;
+          raw->blocks[i].rotation = (state >> 8) % ROTATION_MAX_UNITS;
+          for (int k = 0; k < BLOCK_DATA_SIZE; k++)
+            {
+              state = state * 1664525u + 1013904223u;
+              raw->blocks[i].data[k] = state >> 24;
+            }
+        }
+    }
+}
+
+/** Compare parallel conversion of a scan with the serial result. */
+void compare_workers(int nworkers, int npackets)
+{
+  boost::shared_ptr<RawData> data(new RawData());
+  ASSERT_EQ(data->setupOffline(g_package_path +
+                               "/params/64e_s2.1-sztaki.yaml", 130.0, 0.4), 0);
+  data->setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+
+  velodyne_msgs::VelodyneScan scan;
+  make_scan(scan, npackets);
+
+  VPointCloud expected;
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+    data->unpack(scan.packets[i], expected);
+
+  UnpackWorkers workers(data);
+  workers.setWorkers(nworkers);
+  for (int repeat = 0; repeat < 3; ++repeat)
+    {
+      VPointCloud actual;
+      workers.unpack(scan, actual);
+      ASSERT_EQ(expected.points.size(), actual.points.size());
+      EXPECT_EQ(expected.width, actual.width);
+      for (size_t i = 0; i < expected.points.size(); ++i)
+        {
+          EXPECT_EQ(expected.points[i].ring, actual.points[i].ring);
+          EXPECT_EQ(expected.points[i].x, actual.points[i].x);
+          EXPECT_EQ(expected.points[i].y, actual.points[i].y);
+          EXPECT_EQ(expected.points[i].z, actual.points[i].z);
+          EXPECT_EQ(expected.points[i].intensity, actual.points[i].intensity);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(UnpackWorkers, serial)
+{
+  compare_workers(1, 50);
+}
+
+TEST(UnpackWorkers, parallel)
+{
+  compare_workers(4, 50);
+}
+
+TEST(UnpackWorkers, more_workers_than_packets)
+{
+  compare_workers(8, 3);
+}
+
+TEST(UnpackWorkers, empty_scan)
+{
+  boost::shared_ptr<RawData> data(new RawData());
+  UnpackWorkers workers(data);
+  workers.setWorkers(2);
+  velodyne_msgs::VelodyneScan scan;
+  VPointCloud pc;
+  workers.unpack(scan, pc);
+  EXPECT_EQ(pc.points.size(), 0u);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}